@@ -39,18 +39,50 @@
 
 int main (int argc, char *argv[])
 {
-  unsigned i, n;
-  int distance;
-  unsigned len = 128;
-  FILE *inflow;
+  unsigned n;
+  long distance;
+  struct treefile infile;
   struct tree intree1, intree2;
-  char *newick;
-  char c;
+  struct skeleton skeleton1, skeleton2;
+  struct pathestimate estimate;
+  double bound = 0.0;
+  unsigned long long maxsamples = 0; /* both 0 for the exact distance */
+  uint64_t seed = 1;
 
   /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-naive") == 0) naivealgorithms = 1; /* every path is walked separately */
+    else if (strcmp(argv[1], "-e") == 0 && argc > 3) {
+      bound = atof(argv[2]);
+      if ( bound <= 0.0 ) {
+        fprintf(stderr, "Wrong error bound \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-t") == 0 && argc > 3) {
+      threadsnum = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : cpucount();
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-seed") == 0 && argc > 3) {
+      seed = strtoull(argv[2], NULL, 10);
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-samples") == 0 && argc > 3) {
+      maxsamples = strtoull(argv[2], NULL, 10);
+      argv++;
+      argc--;
+    }
+    else break;
+    argv++;
+    argc--;
+  }
   if (argc < 2)
   {
-    fprintf(stderr, "Usage: %s <input tree 1> [<input tree 2>]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-naive] [-t <n>] [-e <error>] [-seed <n>] [-samples <n>] <input tree 1> [<input tree 2>]\n", argv[0]);
     fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
     return 1;
   }
@@ -61,62 +93,72 @@ int main (int argc, char *argv[])
     fprintf(stderr, "between two phylogenetic trees.\n");
     fprintf(stderr, "Trees should be in Newick format.\n");
     fprintf(stderr, "Both trees can be in one file or in separate files.\n");
-    fprintf(stderr, "Usage: %s <input file> [<input file 2>]\n", argv[0]);
+    fprintf(stderr, "Use \"-\" as a file name to read trees from the standard input.\n");
+    fprintf(stderr, "Option -naive counts branches between every pair of leaves (slow, for checks).\n");
+    fprintf(stderr, "Option -e <error> estimates the distance by random pairs of leaves until\n");
+    fprintf(stderr, "1.96 standard errors are within error, -samples <n> checks n pairs\n");
+    fprintf(stderr, "(or at most n pairs with -e), -seed <n> sets the random seed (1 by default).\n");
+    fprintf(stderr, "Such estimates need trees with the same leaves.\n");
+    fprintf(stderr, "Option -t <n> computes the distance on n threads (0 for all processors).\n");
+    fprintf(stderr, "Usage: %s [-naive] [-t <n>] [-e <error>] [-seed <n>] [-samples <n>] <input file> [<input file 2>]\n", argv[0]);
     fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
     return 0;
   }
 
-  inflow = fopen(argv[1], "r");
-  if ( inflow == NULL ) {
-    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
-    exit(1);
-  }
-
-  newick = (char*)malloc(sizeof(char) * len);
-  i = 0;
-  c = '\0';
-  while (!feof(inflow) && (c != ';') ) {
-    c = fgetc(inflow);
-    if ( !feof(inflow) && c != '\n' && c != '\r') {
-      i++;
-      if (i > len - 2) {
-        len = 2 * len;
-        newick = (char*)realloc(newick, sizeof(char) * len);
+  if ( bound > 0.0 || maxsamples > 0 ) { /* the trees are read without branch matrices */
+    if ( opentrees(&infile, argv[1]) ) {
+      fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+      exit(1);
+    }
+    if ( !readtreeskeleton(&infile, &skeleton1) ) {
+      fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[1]);
+      exit(1);
+    }
+    if (argc > 2) {
+      closetrees(&infile);
+      if ( opentrees(&infile, argv[2]) ) {
+        fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
+        exit(1);
       }
-      newick[i-1] = c;
     }
+    if ( !readtreeskeleton(&infile, &skeleton2) ) {
+      if (argc > 2) {
+        fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[2]);
+      }
+      else {
+        fprintf(stderr, "Only one tree in \"%s\"!\n", argv[1]);
+      }
+      exit(1);
+    }
+    closetrees(&infile);
+    if ( samplepaths(&skeleton1, &skeleton2, 2, bound, maxsamples, seed, &estimate) ) {
+      fprintf(stderr, "The trees have different leaves!\n");
+      exit(1);
+    }
+    printf("%.4f\n", estimate.distance);
+    printf("Standard error: %.4f (%llu pairs sampled)\n", estimate.error, estimate.samples);
+    freeskeleton(skeleton1);
+    freeskeleton(skeleton2);
+    return 0;
   }
-  if ( feof(inflow) ) {
+
+  if ( opentrees(&infile, argv[1]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+    exit(1);
+  }
+  if ( !readtree(&infile, &intree1) ) {
     fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[1]);
     exit(1);
   }
-  newick[i] = '\0';
-  intree1 = readbrackets(newick);
-  free(newick);
 
   if (argc > 2) { /* second tree is in separate file */
-    fclose(inflow);
-    inflow = fopen(argv[2], "r");
-    if ( inflow == NULL ) {
+    closetrees(&infile);
+    if ( opentrees(&infile, argv[2]) ) {
       fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
       exit(1);
     }
   }
-  newick = (char*) malloc(sizeof(char) * len);
-  i = 0;
-  c = '\0';
-  while (!feof(inflow) && (c != ';') ) {
-    c = fgetc(inflow);
-    if ( !feof(inflow) && c != '\n' && c != '\r') {
-      i++;
-      if (i > len - 2) {
-        len = 2*len;
-        newick = (char*)realloc(newick, sizeof(char)*len);
-      }
-      newick[i-1] = c;
-    }
-  }
-  if ( feof(inflow) ) {
+  if ( !readtree(&infile, &intree2) ) {
     if (argc > 2) {
       fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[2]);
     }
@@ -125,10 +167,7 @@ int main (int argc, char *argv[])
     }
     exit(1);
   }
-  fclose(inflow);
-  newick[i] = '\0';
-  intree2 = readbrackets(newick);
-  free(newick);
+  closetrees(&infile);
   n = intree1.leavesnum;
   if ( n == intree2.leavesnum ) 
     distance = treedist2(intree1, intree2, 2);
@@ -0,0 +1,370 @@
+/*  lca.c finds lowest common ancestors in tree skeletons and estimates
+    distances between trees by random samples of leaves for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  The lowest common ancestor of two nodes is the node of the least
+    level between their first visits in the Euler tour of the tree.
+    The tour is cut into blocks of LCABLOCK positions; a sparse table
+    keeps the minima of 1, 2, 4, ... consecutive blocks, so a query
+    looks through at most two blocks and two table cells, and the
+    index takes O(n) memory.
+*/
+
+#include "treedist.h"
+
+#define LCABLOCK 32
+#define CHECKEVERY 1024 /* samples between checks of the confidence interval */
+#define Z95 1.959963985 /* quantile of the normal distribution for 95% */
+
+/****************************************************************
+* makelcaindex: the LCA index of a skeleton
+*****************************************************************/
+struct lcaindex makelcaindex(struct skeleton *inskeleton) {
+  struct lcaindex result;
+  unsigned n, v, c, i, j, pos, top, len, half;
+  unsigned *childstart, *child, *next, *stack;
+
+  n = inskeleton->nodesnum;
+  result.nodesnum = n;
+  result.tourlength = 2 * n - 1;
+  result.tour = (unsigned*)malloc(sizeof(unsigned) * (2 * result.tourlength + 2 * n));
+  result.level = result.tour + result.tourlength;
+  result.visit = result.level + result.tourlength;
+  result.depth = result.visit + n;
+  result.length = (double*)malloc(sizeof(double) * n);
+
+  /* children of every node */
+  childstart = (unsigned*)calloc(n + 2, sizeof(unsigned));
+  child = (unsigned*)malloc(sizeof(unsigned) * (3 * n + 1));
+  next = child + n;
+  stack = next + n;
+  for ( v = 0; v < n; v++ ) {
+    if ( v != inskeleton->root ) childstart[inskeleton->parent[v] + 2]++;
+  }
+  for ( v = 0; v < n; v++ ) childstart[v + 2] += childstart[v + 1];
+  for ( v = 0; v < n; v++ ) {
+    if ( v != inskeleton->root ) child[childstart[inskeleton->parent[v] + 1]++] = v;
+  }
+  for ( v = 0; v < n; v++ ) next[v] = childstart[v];
+
+  /* Euler tour without recursion */
+  v = inskeleton->root;
+  result.depth[v] = 0;
+  result.length[v] = 0.0;
+  result.visit[v] = 0;
+  result.tour[0] = v;
+  result.level[0] = 0;
+  pos = 1;
+  top = 0;
+  stack[0] = v;
+  for (;;) {
+    v = stack[top];
+    if ( next[v] < childstart[v + 1] ) {
+      c = child[next[v]++];
+      result.depth[c] = result.depth[v] + inskeleton->weight[c];
+      result.length[c] = result.length[v] + inskeleton->length[c];
+      stack[++top] = c;
+      result.visit[c] = pos;
+    }
+    else if ( top > 0 ) {
+      c = stack[--top];
+    }
+    else break;
+    result.tour[pos] = c;
+    result.level[pos] = top;
+    pos++;
+  }
+  free(childstart);
+  free(child);
+
+  /* minima of blocks and of their runs */
+  result.blocks = (result.tourlength + LCABLOCK - 1) / LCABLOCK;
+  result.levels = 1;
+  while ( (1u << result.levels) <= result.blocks ) result.levels++;
+  result.table = (unsigned*)malloc(sizeof(unsigned) * result.blocks * result.levels);
+  for ( i = 0; i < result.blocks; i++ ) {
+    len = i * LCABLOCK;
+    result.table[i] = len;
+    for ( pos = len + 1; pos < len + LCABLOCK && pos < result.tourlength; pos++ ) {
+      if ( result.level[pos] < result.level[result.table[i]] ) result.table[i] = pos;
+    }
+  }
+  for ( j = 1; j < result.levels; j++ ) {
+    half = 1u << (j - 1);
+    for ( i = 0; i + 2 * half <= result.blocks; i++ ) {
+      c = result.table[(j - 1) * result.blocks + i];
+      v = result.table[(j - 1) * result.blocks + i + half];
+      result.table[j * result.blocks + i] = result.level[v] < result.level[c] ? v : c;
+    }
+  }
+  return result;
+} /* makelcaindex */
+
+void freelcaindex(struct lcaindex index) {
+  free(index.tour);
+  free(index.length);
+  free(index.table);
+} /* freelcaindex */
+
+/****************************************************************
+* lca: the lowest common ancestor of nodes u and v
+*****************************************************************/
+unsigned lca(struct lcaindex *index, unsigned u, unsigned v) {
+  unsigned l, r, bl, br, best, pos, j, c;
+
+  l = index->visit[u];
+  r = index->visit[v];
+  if ( l > r ) {
+    pos = l;
+    l = r;
+    r = pos;
+  }
+  bl = l / LCABLOCK;
+  br = r / LCABLOCK;
+  best = l;
+  if ( bl == br ) {
+    for ( pos = l + 1; pos <= r; pos++ ) {
+      if ( index->level[pos] < index->level[best] ) best = pos;
+    }
+    return index->tour[best];
+  }
+  for ( pos = l + 1; pos < (bl + 1) * LCABLOCK; pos++ ) {
+    if ( index->level[pos] < index->level[best] ) best = pos;
+  }
+  for ( pos = br * LCABLOCK; pos <= r; pos++ ) {
+    if ( index->level[pos] < index->level[best] ) best = pos;
+  }
+  if ( br > bl + 1 ) {
+    j = 0;
+    while ( (2u << j) <= br - bl - 1 ) j++;
+    c = index->table[j * index->blocks + bl + 1];
+    if ( index->level[c] < index->level[best] ) best = c;
+    c = index->table[j * index->blocks + br - (1u << j)];
+    if ( index->level[c] < index->level[best] ) best = c;
+  }
+  return index->tour[best];
+} /* lca */
+
+/****************************************************************
+* pathweight: weight of the path between nodes u and v, that is
+*  the number of branches between them
+*****************************************************************/
+unsigned pathweight(struct lcaindex *index, unsigned u, unsigned v) {
+  return index->depth[u] + index->depth[v] - 2 * index->depth[lca(index, u, v)];
+} /* pathweight */
+
+/****************************************************************
+* pathlength: sum of branch lengths on the path between nodes
+*****************************************************************/
+double pathlength(struct lcaindex *index, unsigned u, unsigned v) {
+  return index->length[u] + index->length[v] - 2.0 * index->length[lca(index, u, v)];
+} /* pathlength */
+
+/****************************************************************
+* nextrandom: splitmix64 generator, the same numbers for the same
+*  seed on every machine
+*****************************************************************/
+static uint64_t nextrandom(uint64_t *state) {
+  uint64_t z;
+
+  z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+} /* nextrandom */
+
+/****************************************************************
+* quartettopology: which pair of leaves is separated from the other
+*  pair (2 for ab|cd, 3 for ac|bd, 4 for ad|bc), 0 if unresolved;
+*  the same codes as of whichsplittree()
+*****************************************************************/
+static char quartettopology(struct lcaindex *index, unsigned a, unsigned b, unsigned c, unsigned d) {
+  unsigned s1, s2, s3;
+
+  s1 = pathweight(index, a, b) + pathweight(index, c, d);
+  s2 = pathweight(index, a, c) + pathweight(index, b, d);
+  s3 = pathweight(index, a, d) + pathweight(index, b, c);
+  if ( s1 < s2 && s1 < s3 ) return 2;
+  if ( s2 < s1 && s2 < s3 ) return 3;
+  if ( s3 < s1 && s3 < s2 ) return 4;
+  return 0;
+} /* quartettopology */
+
+/****************************************************************
+* wilson: 95% Wilson score interval of a fraction of agreed samples
+*****************************************************************/
+static void wilson(unsigned long long agreed, unsigned long long samples, double *low, double *high) {
+  double p, z2n, center, half;
+
+  p = (double)agreed / samples;
+  z2n = Z95 * Z95 / samples;
+  center = (p + z2n / 2.0) / (1.0 + z2n);
+  half = Z95 * sqrt(p * (1.0 - p) / samples + z2n / (4.0 * samples)) / (1.0 + z2n);
+  *low = center - half < 0.0 ? 0.0 : center - half;
+  *high = center + half > 1.0 ? 1.0 : center + half;
+} /* wilson */
+
+/****************************************************************
+* matchleaves: nodes of the leaves of skeleton small in it and in
+*  skeleton big, one array of 2 * small->leavesnum numbers, or NULL
+*  if small has leaves absent in big
+*****************************************************************/
+static unsigned *matchleaves(struct skeleton *small, struct skeleton *big) {
+  unsigned *result;
+  unsigned k, a, n;
+
+  n = small->leavesnum;
+  result = (unsigned*)malloc(sizeof(unsigned) * 2 * (n + 1));
+  for ( k = 0; k < n; k++ ) {
+    result[k] = small->leafnode[k];
+    a = findleaf(big->names, small->names.leaf[k]);
+    if ( a == big->leavesnum ) {
+      free(result);
+      return NULL;
+    }
+    result[n + k] = big->leafnode[a];
+  }
+  return result;
+} /* matchleaves */
+
+/****************************************************************
+* samplequartets: estimate the quartet distance by random quartets.
+*  Quartets are taken from the leaves of the smaller tree, which
+*  is the quartet distance to the bigger tree restricted to them.
+*  Sampling stops when the 95% confidence interval is not wider
+*  than 2 * bound, or after maxsamples quartets (0 for no limit).
+*  Returns 1 if the smaller tree has leaves absent in the bigger one.
+*****************************************************************/
+int samplequartets(struct skeleton *skeleton1, struct skeleton *skeleton2, double bound,
+                   unsigned long long maxsamples, uint64_t seed, struct quartetestimate *estimate) {
+  struct skeleton *small, *big;
+  struct lcaindex index1, index2;
+  unsigned *node1, *node2;
+  unsigned n, a, b, c, d;
+  unsigned long long agreed = 0, samples = 0;
+  uint64_t state = seed;
+  double low = 0.0, high = 1.0;
+
+  small = skeleton1;
+  big = skeleton2;
+  if ( skeleton2->leavesnum < skeleton1->leavesnum ) {
+    small = skeleton2;
+    big = skeleton1;
+  }
+  n = small->leavesnum;
+  node1 = matchleaves(small, big);
+  if ( node1 == NULL ) return 1;
+  node2 = node1 + n;
+  estimate->distance = 0.0;
+  estimate->low = 0.0;
+  estimate->high = 0.0;
+  estimate->samples = 0;
+  if ( n < 4 ) {
+    free(node1);
+    return 0;
+  }
+
+  index1 = makelcaindex(small);
+  index2 = makelcaindex(big);
+  for (;;) {
+    a = nextrandom(&state) % n;
+    do b = nextrandom(&state) % n; while ( b == a );
+    do c = nextrandom(&state) % n; while ( c == a || c == b );
+    do d = nextrandom(&state) % n; while ( d == a || d == b || d == c );
+    if ( quartettopology(&index1, node1[a], node1[b], node1[c], node1[d])
+         == quartettopology(&index2, node2[a], node2[b], node2[c], node2[d]) ) agreed++;
+    samples++;
+    if ( samples == maxsamples ) break;
+    if ( samples % CHECKEVERY == 0 ) {
+      wilson(agreed, samples, &low, &high);
+      if ( high - low <= 2.0 * bound ) break;
+    }
+  }
+  wilson(agreed, samples, &low, &high);
+  estimate->distance = 1.0 - (double)agreed / samples;
+  estimate->low = 1.0 - high;
+  estimate->high = 1.0 - low;
+  estimate->samples = samples;
+  freelcaindex(index1);
+  freelcaindex(index2);
+  free(node1);
+  return 0;
+} /* samplequartets */
+
+/****************************************************************
+* samplepaths: estimate the L1 (p = 1) or L2 (p = 2) distance by
+*  random pairs of leaves, that is the mean absolute difference
+*  of path lengths or the square root of the mean squared one.
+*  Sampling stops when 1.96 standard errors of the estimate are
+*  not more than bound, or after maxsamples pairs (0 for no limit).
+*  Returns 1 if the trees have different leaves.
+*****************************************************************/
+int samplepaths(struct skeleton *skeleton1, struct skeleton *skeleton2, char p, double bound,
+                unsigned long long maxsamples, uint64_t seed, struct pathestimate *estimate) {
+  struct lcaindex index1, index2;
+  unsigned *node1, *node2;
+  unsigned n, a, b;
+  unsigned long long samples = 0;
+  uint64_t state = seed;
+  double diff, delta, mean = 0.0, square = 0.0, error = 0.0;
+
+  n = skeleton1->leavesnum;
+  if ( n != skeleton2->leavesnum ) return 1;
+  node1 = matchleaves(skeleton1, skeleton2);
+  if ( node1 == NULL ) return 1;
+  node2 = node1 + n;
+  estimate->distance = 0.0;
+  estimate->error = 0.0;
+  estimate->samples = 0;
+  if ( n < 2 ) {
+    free(node1);
+    return 0;
+  }
+
+  index1 = makelcaindex(skeleton1);
+  index2 = makelcaindex(skeleton2);
+  for (;;) {
+    a = nextrandom(&state) % n;
+    do b = nextrandom(&state) % n; while ( b == a );
+    diff = (double)pathweight(&index1, node1[a], node1[b]) - (double)pathweight(&index2, node2[a], node2[b]);
+    diff = p == 1 ? fabs(diff) : diff * diff;
+    samples++;
+    delta = diff - mean; /* Welford's running mean and variance */
+    mean += delta / samples;
+    square += delta * (diff - mean);
+    if ( samples == maxsamples ) break;
+    if ( samples % CHECKEVERY == 0 && bound > 0.0 ) {
+      error = sqrt(square / (samples - 1) / samples);
+      if ( p == 2 ) error = mean > 0.0 ? error / (2.0 * sqrt(mean)) : 0.0;
+      if ( Z95 * error <= bound ) break;
+    }
+  }
+  error = samples > 1 ? sqrt(square / (samples - 1) / samples) : 0.0;
+  if ( p == 2 ) error = mean > 0.0 ? error / (2.0 * sqrt(mean)) : 0.0;
+  estimate->distance = p == 1 ? mean : sqrt(mean);
+  estimate->error = error;
+  estimate->samples = samples;
+  freelcaindex(index1);
+  freelcaindex(index2);
+  free(node1);
+  return 0;
+} /* samplepaths */
@@ -0,0 +1,802 @@
+/*  matrix.c computes distances between all pairs of trees of a collection
+    for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  The upper triangle of the matrix is cut into square tiles of
+    t x t pairs, t being chosen so that the splits of the 2t trees
+    of a tile take half of the L2 cache. A thread compares every tree
+    of the rows of a tile with every tree of its columns, so the splits
+    of a tree are read from memory once per tile and not once per pair.
+    Tiles are taken by threads one by one as they finish the previous
+    ones (see runparallel()), so tiles on the diagonal, which have half
+    the pairs, and pairs of different cost are balanced.
+
+    For a matrix too big for one process, computeshard() computes shard
+    s of k: the tiles in the order of rows are cut into k runs of equal
+    estimated cost, the cost of a pair being the mean number of leaves
+    of its trees. The tiles do not depend on the machine, so every shard
+    can be run as a separate process anywhere. A shard writes its part
+    of the matrix to a file of its own:
+
+    part header     struct partheader
+    tiles           tilesnum pairs of uint32, the first row and column
+    distances       floats of the pairs i < j of every tile, in the order
+                    of tiles, rows and columns, metrics of a pair together
+
+    and readpart() puts a part into the matrix, see treedist-merge.
+
+    A matrix too big for RAM is written into a binary file, either by
+    computemapped() as the tiles are computed or by mergemapped() from
+    the part files, a tile of a part at a time:
+
+    matrix header   struct mappedheader
+    distances       from the byte valuepos, for every metric the pairs
+                    i < j in the order of rows, as floats or, if
+                    quantized, as uint16 numbers of 1/scale of a metric
+                    (65535 for larger distances)
+
+    Both map the file into memory by windows of whole bands of tiles,
+    a window being unmapped before the next one, so only one window
+    is in RAM besides the trees (computemapped()) or a tile of a part
+    (mergemapped()). With a memory limit the window is made smaller to
+    fit it, and computemapped() makes its tiles smaller as well.
+*/
+
+#include "treedist.h"
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MAXTILE 256 /* trees in a side of a tile */
+#define SHARDCACHE 262144 /* the cache size assumed for shards */
+#define PARTMAGIC "TREEPRT\n"
+#define PARTVERSION 1
+#define PARTBYTEORDER 0x01020304u
+#define MAPPEDMAGIC "TREEMAT\n"
+#define MAPPEDVERSION 1
+#define MERGEWINDOW 67108864 /* pairs of a window of mergemapped() without a memory limit */
+
+/* Tiles of the upper triangle shared by threads */
+struct matrixjob {
+  struct collection *coll;
+  struct distmatrix *matrix;
+  unsigned tile; /* trees in a side of a tile */
+  unsigned tilesnum;
+  unsigned *tilerow, *tilecol; /* first trees of the rows and columns of tiles */
+  float *value; /* distances of the tiles one after another, or NULL for matrix->value */
+  size_t *offset; /* position of the first distance of a tile in value */
+  char *window[METRICSNUM]; /* mapped distances of a metric from the pair windowfirst, or NULL */
+  size_t windowfirst;
+  char quantize; /* 1 for uint16 distances in window */
+  float scale[METRICSNUM];
+};
+
+struct partheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t treenum;
+  uint32_t metricsnum;
+  uint32_t metrics[METRICSNUM];
+  uint32_t shard; /* from 1 */
+  uint32_t shards;
+  uint32_t tile;
+  uint32_t tilesnum;
+  uint64_t valuesnum;
+};
+
+struct mappedheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t treenum;
+  uint32_t metricsnum;
+  uint32_t metrics[METRICSNUM];
+  uint32_t quantized; /* 1 for uint16 distances, 0 for floats */
+  float scale[METRICSNUM]; /* a uint16 distance is the number of 1/scale */
+  uint64_t valuepos;
+};
+
+/* distance number k of a window, as a float or as a uint16 number of 1/scale */
+static void putvalue(char *window, size_t k, float distance, char quantize, float scale) {
+  if ( !quantize ) ((float*)window)[k] = distance;
+  else {
+    distance = distance * scale + 0.5f;
+    ((uint16_t*)window)[k] = distance < 65535.0f ? (uint16_t)distance : 65535;
+  }
+} /* putvalue */
+
+/* position of the pair i < j in the triangle of n trees */
+static size_t pairindex(unsigned n, unsigned i, unsigned j) {
+  return (size_t)i * (2 * (size_t)n - i - 1) / 2 + (j - i - 1);
+} /* pairindex */
+
+/****************************************************************
+* tilesize: trees in a side of a tile for a collection and a cache
+*  of a given size; tiles are made smaller if there are too few of
+*  them to keep all threads busy
+*****************************************************************/
+static unsigned tilesize(struct collection *coll, unsigned threads, unsigned long cache) {
+  unsigned long pertree, tile, blocks;
+  unsigned n;
+
+  n = coll->treenum;
+  if ( coll->splitbytes > 0 ) pertree = coll->splitbytes / n + 1;
+  else { /* splits are made by every pair, their size is estimated */
+    pertree = (unsigned long)coll->trees[0].branchnum * ((coll->trees[0].leavesnum + 63) / 64 * 8 + 12) + 1;
+  }
+  tile = cache / 2 / (2 * pertree);
+  if ( tile < 1 ) tile = 1;
+  if ( tile > MAXTILE ) tile = MAXTILE;
+  for (;;) {
+    blocks = (n + tile - 1) / tile;
+    if ( tile == 1 || blocks * (blocks + 1) / 2 >= 4 * (unsigned long)threads ) break;
+    tile /= 2;
+  }
+  return (unsigned)tile;
+} /* tilesize */
+
+/****************************************************************
+* matrixtile: all pairs i < j of tile k, i in its rows, j in its columns
+*****************************************************************/
+static void matrixtile(void *arg, unsigned k) {
+  struct matrixjob *job = (struct matrixjob*)arg;
+  struct distmatrix *matrix = job->matrix;
+  struct comparison comp;
+  unsigned i, j, m, n, rowend, colend;
+  float *value;
+  size_t p;
+
+  n = matrix->treenum;
+  rowend = job->tilerow[k] + job->tile < n ? job->tilerow[k] + job->tile : n;
+  colend = job->tilecol[k] + job->tile < n ? job->tilecol[k] + job->tile : n;
+  value = job->value != NULL ? job->value + job->offset[k] : NULL;
+  for ( i = job->tilerow[k]; i < rowend; i++ ) {
+    for ( j = job->tilecol[k] > i + 1 ? job->tilecol[k] : i + 1; j < colend; j++ ) {
+      startpair(&comp, job->coll, i, j);
+      p = pairindex(n, i, j);
+      if ( job->window[0] != NULL ) { /* into the mapped file */
+        for ( m = 0; m < matrix->metricsnum; m++ ) {
+          putvalue(job->window[m], p - job->windowfirst, (float)metricvalue(&comp, matrix->metrics[m]),
+                   job->quantize, job->scale[m]);
+        }
+      }
+      else {
+        if ( job->value == NULL ) value = matrix->value + p * matrix->metricsnum;
+        for ( m = 0; m < matrix->metricsnum; m++ ) {
+          value[m] = (float)metricvalue(&comp, matrix->metrics[m]);
+        }
+        value += matrix->metricsnum;
+      }
+      finishcomparison(&comp);
+    }
+  }
+} /* matrixtile */
+
+/****************************************************************
+* maketiles: tiles of a given side over the upper triangle of
+*  a collection in the order of rows
+*****************************************************************/
+static void maketiles(struct matrixjob *job, unsigned treenum, unsigned tile) {
+  unsigned blocks, bi, bj, k;
+
+  job->tile = tile;
+  blocks = (treenum + tile - 1) / tile;
+  job->tilesnum = blocks * (blocks + 1) / 2;
+  job->tilerow = (unsigned*)malloc(sizeof(unsigned) * 2 * (job->tilesnum + 1));
+  job->tilecol = job->tilerow + job->tilesnum;
+  k = 0;
+  for ( bi = 0; bi < blocks; bi++ ) {
+    for ( bj = bi; bj < blocks; bj++ ) {
+      job->tilerow[k] = bi * tile;
+      job->tilecol[k] = bj * tile;
+      k++;
+    }
+  }
+  job->value = NULL;
+  job->offset = NULL;
+  job->window[0] = NULL;
+} /* maketiles */
+
+/****************************************************************
+* computematrix: distances of the metrics of the matrix between all
+*  pairs of trees of the collection, on up to threads threads.
+*  Every pair is compared on one thread.
+*****************************************************************/
+void computematrix(struct collection *coll, struct distmatrix *matrix, unsigned threads) {
+  struct matrixjob job;
+  size_t pairs;
+
+  matrix->treenum = coll->treenum;
+  pairs = coll->treenum < 2 ? 0 : (size_t)coll->treenum * (coll->treenum - 1) / 2;
+  matrix->value = (float*)malloc(sizeof(float) * (pairs * matrix->metricsnum + 1));
+  if ( matrix->value == NULL ) {
+    fprintf(stderr, "Not enough memory for distances of %u trees\n", coll->treenum);
+    exit(1);
+  }
+  if ( pairs == 0 ) return;
+
+  job.coll = coll;
+  job.matrix = matrix;
+  maketiles(&job, coll->treenum, tilesize(coll, threads, cachesize()));
+  runparallel(threads, job.tilesnum, matrixtile, &job);
+  free(job.tilerow);
+} /* computematrix */
+
+/* number of pairs i < j of tile k */
+static size_t tilepairs(struct matrixjob *job, unsigned n, unsigned k) {
+  size_t rows, cols;
+
+  rows = job->tilerow[k] + job->tile < n ? job->tile : n - job->tilerow[k];
+  cols = job->tilecol[k] + job->tile < n ? job->tile : n - job->tilecol[k];
+  return job->tilerow[k] == job->tilecol[k] ? rows * (rows - 1) / 2 : rows * cols;
+} /* tilepairs */
+
+/****************************************************************
+* computeshard: distances of shard number shard (from 1) of shards
+*  into a part file, return 0 on success. Runs of tiles of equal
+*  cost (leaves of the pairs) are found from the prefix sums of
+*  leaves over the trees, so every shard finds the same runs.
+*****************************************************************/
+int computeshard(struct collection *coll, struct distmatrix *matrix, unsigned shard, unsigned shards,
+                 unsigned threads, char *filename) {
+  struct matrixjob job;
+  struct partheader header;
+  double *leaves, total, cost, rows, cols, sumrows, sumcols;
+  unsigned n, k, first, last;
+  size_t valuesnum;
+  FILE *out;
+  int result = 0;
+
+  n = coll->treenum;
+  matrix->treenum = n;
+  matrix->value = NULL;
+  job.coll = coll;
+  job.matrix = matrix;
+  maketiles(&job, n, tilesize(coll, 16 * shards, SHARDCACHE));
+
+  /* leaves[i] is the sum of leaves of trees before tree i */
+  leaves = (double*)malloc(sizeof(double) * (n + 1 + job.tilesnum + 1));
+  leaves[0] = 0.0;
+  for ( k = 0; k < n; k++ ) leaves[k + 1] = leaves[k] + coll->trees[k].leavesnum;
+  total = 0.0;
+  for ( k = 0; k < job.tilesnum; k++ ) { /* the cost of a pair is the mean of leaves of its trees */
+    rows = (job.tilerow[k] + job.tile < n ? job.tilerow[k] + job.tile : n) - job.tilerow[k];
+    cols = (job.tilecol[k] + job.tile < n ? job.tilecol[k] + job.tile : n) - job.tilecol[k];
+    sumrows = leaves[job.tilerow[k] + (unsigned)rows] - leaves[job.tilerow[k]];
+    sumcols = leaves[job.tilecol[k] + (unsigned)cols] - leaves[job.tilecol[k]];
+    if ( job.tilerow[k] == job.tilecol[k] ) cost = (rows - 1) * sumrows / 2;
+    else cost = (cols * sumrows + rows * sumcols) / 2;
+    leaves[n + 1 + k] = total;
+    total += cost;
+  }
+  for ( first = 0; first < job.tilesnum && leaves[n + 1 + first] < total * (shard - 1) / shards; first++ ) ;
+  for ( last = first; last < job.tilesnum && leaves[n + 1 + last] < total * shard / shards; last++ ) ;
+  if ( shard == shards ) last = job.tilesnum;
+  free(leaves);
+
+  /* tiles first ... last - 1 */
+  job.offset = (size_t*)malloc(sizeof(size_t) * (last - first + 1));
+  valuesnum = 0;
+  for ( k = first; k < last; k++ ) {
+    job.offset[k - first] = valuesnum;
+    valuesnum += tilepairs(&job, n, k) * matrix->metricsnum;
+  }
+  job.value = (float*)malloc(sizeof(float) * (valuesnum + 1));
+  if ( job.value == NULL ) {
+    fprintf(stderr, "Not enough memory for distances of shard %u\n", shard);
+    exit(1);
+  }
+  job.tilerow += first;
+  job.tilecol += first;
+  runparallel(threads, last - first, matrixtile, &job);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PARTMAGIC, 8);
+  header.version = PARTVERSION;
+  header.byteorder = PARTBYTEORDER;
+  header.treenum = n;
+  header.metricsnum = matrix->metricsnum;
+  for ( k = 0; k < matrix->metricsnum; k++ ) header.metrics[k] = matrix->metrics[k];
+  header.shard = shard;
+  header.shards = shards;
+  header.tile = job.tile;
+  header.tilesnum = last - first;
+  header.valuesnum = valuesnum;
+  out = fopen(filename, "wb");
+  if ( out == NULL ) result = 1;
+  else {
+    if ( fwrite(&header, sizeof(header), 1, out) != 1 ) result = 1;
+    for ( k = 0; k < last - first && result == 0; k++ ) {
+      if ( fwrite(job.tilerow + k, sizeof(unsigned), 1, out) != 1
+           || fwrite(job.tilecol + k, sizeof(unsigned), 1, out) != 1 ) result = 1;
+    }
+    if ( result == 0 && fwrite(job.value, sizeof(float), valuesnum, out) != valuesnum ) result = 1;
+    if ( fclose(out) != 0 ) result = 1;
+  }
+  free(job.tilerow - first);
+  free(job.offset);
+  free(job.value);
+  return result;
+} /* computeshard */
+
+/* read the header of a part file, return 0 if it is a right one */
+static int readpartheader(FILE *in, struct partheader *header) {
+  return fread(header, sizeof(*header), 1, in) != 1 || memcmp(header->magic, PARTMAGIC, 8) != 0
+         || header->version != PARTVERSION || header->byteorder != PARTBYTEORDER
+         || header->metricsnum == 0 || header->metricsnum > METRICSNUM || header->shards == 0
+         || header->shard == 0 || header->shard > header->shards || header->tile == 0
+         || header->tile > MAXTILE;
+} /* readpartheader */
+
+/****************************************************************
+* checkparts: read the headers of the part files of a matrix and
+*  set its trees and metrics and *shards; matrix->value is left NULL. Returns
+*  0 if the parts are all the shards of one matrix, 1 if part
+*  number *bad can not be read, 2 if it is not a part of the same
+*  matrix or is repeated, 3 if shard *bad (from 1) is missing.
+*****************************************************************/
+int checkparts(struct distmatrix *matrix, char **parts, unsigned partsnum, unsigned *shards, unsigned *bad) {
+  struct partheader header, first;
+  char *seen = NULL;
+  unsigned k, m;
+  FILE *in;
+  int result = 0;
+
+  matrix->value = NULL;
+  memset(&first, 0, sizeof(first));
+  for ( k = 0; k < partsnum && result == 0; k++ ) {
+    *bad = k;
+    in = fopen(parts[k], "rb");
+    if ( in == NULL ) return 1;
+    result = readpartheader(in, &header) ? 2 : 0;
+    fclose(in);
+    if ( result != 0 ) break;
+    if ( k == 0 ) {
+      first = header;
+      matrix->treenum = header.treenum;
+      matrix->metricsnum = header.metricsnum;
+      for ( m = 0; m < header.metricsnum; m++ ) matrix->metrics[m] = header.metrics[m];
+      seen = (char*)calloc(header.shards + 1, 1);
+    }
+    if ( header.treenum != first.treenum || header.metricsnum != first.metricsnum
+         || header.shards != first.shards || header.tile != first.tile || seen[header.shard] ) result = 2;
+    for ( m = 0; m < header.metricsnum && result == 0; m++ ) {
+      if ( header.metrics[m] != first.metrics[m] ) result = 2;
+    }
+    if ( result == 0 ) seen[header.shard] = 1;
+  }
+  *shards = first.shards;
+  for ( k = 1; result == 0 && k <= first.shards; k++ ) {
+    if ( !seen[k] ) {
+      *bad = k;
+      result = 3;
+    }
+  }
+  free(seen);
+  return result;
+} /* checkparts */
+
+/****************************************************************
+* readpart: put the distances of a part file into the matrix;
+*  the first part sets the trees, the metrics and the number of
+*  shards and allocates the matrix (matrix->value must be NULL),
+*  and *seen (shards chars) marks the shards read. Returns 0 on
+*  success, 1 if the file can not be read, 2 if it is not a part
+*  of the same matrix.
+*****************************************************************/
+int readpart(struct distmatrix *matrix, char *filename, unsigned *shards, char **seen) {
+  struct partheader header;
+  struct matrixjob job;
+  uint32_t *tiles;
+  float *value;
+  unsigned i, j, k, m, n, rowend, colend;
+  size_t pairs, count;
+  FILE *in;
+  int result = 0;
+
+  in = fopen(filename, "rb");
+  if ( in == NULL ) return 1;
+  if ( readpartheader(in, &header) ) {
+    fclose(in);
+    return 2;
+  }
+  if ( matrix->value == NULL ) {
+    matrix->treenum = header.treenum;
+    matrix->metricsnum = header.metricsnum;
+    for ( k = 0; k < header.metricsnum; k++ ) matrix->metrics[k] = header.metrics[k];
+    *shards = header.shards;
+    *seen = (char*)calloc(header.shards + 1, 1);
+    pairs = header.treenum < 2 ? 0 : (size_t)header.treenum * (header.treenum - 1) / 2;
+    matrix->value = (float*)malloc(sizeof(float) * (pairs * matrix->metricsnum + 1));
+    if ( matrix->value == NULL ) {
+      fprintf(stderr, "Not enough memory for distances of %u trees\n", header.treenum);
+      exit(1);
+    }
+  }
+  if ( header.treenum != matrix->treenum || header.metricsnum != matrix->metricsnum
+       || header.shards != *shards || (*seen)[header.shard] ) {
+    fclose(in);
+    return 2;
+  }
+  for ( k = 0; k < header.metricsnum; k++ ) {
+    if ( header.metrics[k] != matrix->metrics[k] ) {
+      fclose(in);
+      return 2;
+    }
+  }
+  (*seen)[header.shard] = 1;
+
+  tiles = (uint32_t*)malloc(sizeof(uint32_t) * 2 * (header.tilesnum + 1));
+  value = (float*)malloc(sizeof(float) * (header.valuesnum + 1));
+  if ( tiles == NULL || value == NULL ) {
+    fprintf(stderr, "Not enough memory to read \"%s\"\n", filename);
+    exit(1);
+  }
+  if ( fread(tiles, sizeof(uint32_t) * 2, header.tilesnum, in) != header.tilesnum
+       || fread(value, sizeof(float), header.valuesnum, in) != header.valuesnum ) result = 1;
+  fclose(in);
+  n = header.treenum;
+  count = 0;
+  job.tile = header.tile;
+  for ( k = 0; k < header.tilesnum && result == 0; k++ ) {
+    if ( tiles[2 * k] >= n || tiles[2 * k + 1] >= n || tiles[2 * k] > tiles[2 * k + 1] ) {
+      result = 2;
+      break;
+    }
+    rowend = tiles[2 * k] + job.tile < n ? tiles[2 * k] + job.tile : n;
+    colend = tiles[2 * k + 1] + job.tile < n ? tiles[2 * k + 1] + job.tile : n;
+    for ( i = tiles[2 * k]; i < rowend && result == 0; i++ ) {
+      for ( j = tiles[2 * k + 1] > i + 1 ? tiles[2 * k + 1] : i + 1; j < colend; j++ ) {
+        if ( count + matrix->metricsnum > header.valuesnum ) {
+          result = 2;
+          break;
+        }
+        for ( m = 0; m < matrix->metricsnum; m++ ) {
+          matrix->value[pairindex(n, i, j) * matrix->metricsnum + m] = value[count++];
+        }
+      }
+    }
+  }
+  if ( result == 0 && count != header.valuesnum ) result = 2;
+  free(tiles);
+  free(value);
+  return result;
+} /* readpart */
+
+/* the pair of the first row of band b of tiles of side tile, all pairs for b past the end */
+static size_t bandfirst(unsigned n, unsigned tile, unsigned b) {
+  return (size_t)b * tile >= n ? (size_t)n * (n - 1) / 2 : pairindex(n, b * tile, b * tile + 1);
+} /* bandfirst */
+
+/* the header of a binary matrix file of the metrics of the matrix */
+static void startheader(struct mappedheader *header, struct distmatrix *matrix, char quantize) {
+  unsigned m;
+
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, MAPPEDMAGIC, 8);
+  header->version = MAPPEDVERSION;
+  header->byteorder = PARTBYTEORDER;
+  header->treenum = matrix->treenum;
+  header->metricsnum = matrix->metricsnum;
+  header->quantized = quantize;
+  for ( m = 0; m < matrix->metricsnum; m++ ) {
+    header->metrics[m] = matrix->metrics[m];
+    /* 1e-4 for distances in [0, 1], 0.01 for mean differences of paths */
+    header->scale[m] = matrix->metrics[m] == METRICL1 || matrix->metrics[m] == METRICL2 ? 100.0f : 10000.0f;
+  }
+  header->valuepos = (sizeof(*header) + 63) / 64 * 64;
+} /* startheader */
+
+/* create a binary matrix file of its full size with the header, return its descriptor or -1 */
+static int createmapped(char *filename, struct mappedheader *header) {
+  size_t pairs;
+  int fd;
+
+  pairs = header->treenum < 2 ? 0 : (size_t)header->treenum * (header->treenum - 1) / 2;
+  fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if ( fd < 0 ) return -1;
+  if ( ftruncate(fd, header->valuepos + (header->quantized ? sizeof(uint16_t) : sizeof(float))
+                 * pairs * header->metricsnum) != 0
+       || pwrite(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header) ) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+} /* createmapped */
+
+/****************************************************************
+* mapwindow: map the distances of the pairs first ... last - 1 of
+*  every metric of a binary matrix file, window[m] being the first
+*  of metric m and map[m] the start of its map; returns 0 on
+*  success, 1 if a metric can not be mapped
+*****************************************************************/
+static int mapwindow(int fd, struct mappedheader *header, size_t first, size_t last, char **map, char **window) {
+  size_t pairs, valuesize, pagesize;
+  off_t offset, aligned;
+  unsigned m;
+
+  pairs = (size_t)header->treenum * (header->treenum - 1) / 2;
+  valuesize = header->quantized ? sizeof(uint16_t) : sizeof(float);
+  pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  for ( m = 0; m < header->metricsnum; m++ ) map[m] = NULL;
+  for ( m = 0; m < header->metricsnum; m++ ) {
+    offset = header->valuepos + valuesize * (pairs * m + first);
+    aligned = offset / pagesize * pagesize;
+    map[m] = (char*)mmap(NULL, offset - aligned + valuesize * (last - first), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, aligned);
+    if ( map[m] == MAP_FAILED ) {
+      map[m] = NULL;
+      return 1;
+    }
+    window[m] = map[m] + (offset - aligned);
+  }
+  return 0;
+} /* mapwindow */
+
+/* unmap a window of mapwindow() */
+static void unmapwindow(struct mappedheader *header, size_t first, size_t last, char **map) {
+  size_t pairs, valuesize, pagesize;
+  off_t offset, aligned;
+  unsigned m;
+
+  pairs = (size_t)header->treenum * (header->treenum - 1) / 2;
+  valuesize = header->quantized ? sizeof(uint16_t) : sizeof(float);
+  pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  for ( m = 0; m < header->metricsnum; m++ ) {
+    if ( map[m] == NULL ) continue;
+    offset = header->valuepos + valuesize * (pairs * m + first);
+    aligned = offset / pagesize * pagesize;
+    munmap(map[m], offset - aligned + valuesize * (last - first));
+    map[m] = NULL;
+  }
+} /* unmapwindow */
+
+/****************************************************************
+* computemapped: distances of the metrics of the matrix between all
+*  pairs of trees of the collection into a binary matrix file, as
+*  floats or, if quantize, as uint16; with memorylimit (bytes, 0 for
+*  none) the windows of the file are sized so that the process stays
+*  in it. Returns 0 on success, 1 if the file can not be written,
+*  2 if the limit is too small.
+*****************************************************************/
+int computemapped(struct collection *coll, struct distmatrix *matrix, unsigned threads, char *filename,
+                  char quantize, unsigned long memorylimit) {
+  struct matrixjob job;
+  struct mappedheader header;
+  unsigned n, m, tile, blocks, b0, b1;
+  unsigned long used;
+  size_t pairs, valuesize, windowpairs, first, last, start;
+  char *map[METRICSNUM];
+  int fd, result = 0;
+
+  n = coll->treenum;
+  matrix->treenum = n;
+  matrix->value = NULL;
+  pairs = n < 2 ? 0 : (size_t)n * (n - 1) / 2;
+  valuesize = quantize ? sizeof(uint16_t) : sizeof(float);
+  startheader(&header, matrix, quantize);
+  for ( m = 0; m < matrix->metricsnum; m++ ) job.scale[m] = header.scale[m];
+
+  /* the window is what is left of the limit after the trees and the tiles;
+     a window holds one band of tiles at least */
+  tile = tilesize(coll, threads, cachesize());
+  windowpairs = (size_t)-1;
+  if ( memorylimit > 0 ) {
+    used = residentmemory() + cachesize() * threads + 2 * (size_t)sysconf(_SC_PAGESIZE) * matrix->metricsnum;
+    windowpairs = memorylimit > used ? (memorylimit - used) / (matrix->metricsnum * valuesize) : 0;
+    if ( windowpairs < n ) return 2;
+    if ( tile > windowpairs / n ) tile = (unsigned)(windowpairs / n);
+  }
+
+  fd = createmapped(filename, &header);
+  if ( fd < 0 ) return 1;
+  if ( pairs == 0 ) return close(fd) != 0;
+
+  job.coll = coll;
+  job.matrix = matrix;
+  job.quantize = quantize;
+  maketiles(&job, n, tile);
+  blocks = (n + tile - 1) / tile;
+  for ( b0 = 0; b0 < blocks && result == 0; b0 = b1 ) {
+    /* bands b0 ... b1 - 1 of tiles in a window */
+    for ( b1 = b0 + 1; b1 < blocks && bandfirst(n, tile, b1 + 1) - bandfirst(n, tile, b0) <= windowpairs; b1++ ) ;
+    first = bandfirst(n, tile, b0);
+    last = bandfirst(n, tile, b1);
+    result = mapwindow(fd, &header, first, last, map, job.window);
+    if ( result == 0 ) {
+      job.windowfirst = first;
+      /* band b starts after the b * blocks - b * (b - 1) / 2 tiles of the bands above */
+      start = (size_t)b0 * blocks - (size_t)b0 * (b0 - 1) / 2;
+      job.tilerow += start;
+      job.tilecol += start;
+      runparallel(threads, (unsigned)((size_t)b1 * blocks - (size_t)b1 * (b1 - 1) / 2 - start), matrixtile, &job);
+      job.tilerow -= start;
+      job.tilecol -= start;
+    }
+    unmapwindow(&header, first, last, map);
+  }
+  free(job.tilerow);
+  if ( close(fd) != 0 ) result = 1;
+  return result;
+} /* computemapped */
+
+/****************************************************************
+* mergemapped: the distances of the part files of a matrix checked
+*  by checkparts() into a binary matrix file, as floats or, if
+*  quantize, as uint16, the same file as computemapped() makes.
+*  A part is read a tile at a time and the tile is put into a
+*  window of whole bands of tiles of the file, mapped anew when a
+*  tile is out of it, so only a window and a tile are in RAM; with
+*  memorylimit (bytes, 0 for MERGEWINDOW pairs or a band) the
+*  window is sized so that the process stays in it. Returns 0 on
+*  success, 1 if the file can not be written, 2 if the limit is
+*  too small, 3 if part number *bad can not be read or is broken.
+*****************************************************************/
+int mergemapped(struct distmatrix *matrix, char **parts, unsigned partsnum, char *filename,
+                char quantize, unsigned long memorylimit, unsigned *bad) {
+  struct mappedheader header;
+  struct partheader part;
+  uint32_t tile[2];
+  float *value;
+  unsigned i, j, k, m, n, t, b, b0, b1, blocks = 0, rowend, colend;
+  unsigned long used;
+  size_t pairs, valuesize, windowpairs = 0, first, last, count, tilecount, v, p;
+  char *map[METRICSNUM], *window[METRICSNUM];
+  FILE *in, *tilesin;
+  int fd, result = 0;
+
+  n = matrix->treenum;
+  pairs = n < 2 ? 0 : (size_t)n * (n - 1) / 2;
+  valuesize = quantize ? sizeof(uint16_t) : sizeof(float);
+  startheader(&header, matrix, quantize);
+  fd = createmapped(filename, &header);
+  if ( fd < 0 ) return 1;
+  if ( pairs == 0 ) return close(fd) != 0;
+
+  value = NULL;
+  first = last = 0;
+  b0 = b1 = 0;
+  for ( m = 0; m < matrix->metricsnum; m++ ) map[m] = NULL;
+  for ( k = 0; k < partsnum && result == 0; k++ ) {
+    *bad = k;
+    in = fopen(parts[k], "rb");
+    tilesin = fopen(parts[k], "rb");
+    if ( in == NULL || tilesin == NULL || readpartheader(in, &part) || part.treenum != n ) result = 3;
+    if ( result == 0 && value == NULL ) {
+      /* the parts have tiles of one size (see checkparts()), a window holds one band of them */
+      value = (float*)malloc(sizeof(float) * part.tile * part.tile * matrix->metricsnum);
+      if ( value == NULL ) {
+        fprintf(stderr, "Not enough memory to read \"%s\"\n", parts[k]);
+        exit(1);
+      }
+      windowpairs = MERGEWINDOW > (size_t)part.tile * n ? MERGEWINDOW : (size_t)part.tile * n;
+      if ( memorylimit > 0 ) {
+        used = residentmemory() + sizeof(float) * part.tile * part.tile * matrix->metricsnum
+               + 2 * (size_t)sysconf(_SC_PAGESIZE) * matrix->metricsnum;
+        windowpairs = memorylimit > used ? (memorylimit - used) / (matrix->metricsnum * valuesize) : 0;
+      }
+      if ( windowpairs < (size_t)part.tile * n ) result = 2;
+      blocks = (n + part.tile - 1) / part.tile;
+    }
+    /* the tiles are read by tilesin, their distances by in */
+    if ( result == 0 && (fseek(tilesin, sizeof(part), SEEK_SET) != 0
+                         || fseek(in, sizeof(part) + sizeof(tile) * (long)part.tilesnum, SEEK_SET) != 0) ) result = 3;
+    count = 0;
+    for ( t = 0; t < part.tilesnum && result == 0; t++ ) {
+      if ( fread(tile, sizeof(uint32_t), 2, tilesin) != 2 || tile[0] >= n || tile[1] >= n || tile[0] > tile[1]
+           || tile[0] % part.tile != 0 || tile[1] % part.tile != 0 ) {
+        result = 3;
+        break;
+      }
+      rowend = tile[0] + part.tile < n ? tile[0] + part.tile : n;
+      colend = tile[1] + part.tile < n ? tile[1] + part.tile : n;
+      tilecount = tile[0] == tile[1] ? (size_t)(rowend - tile[0]) * (rowend - tile[0] - 1) / 2
+                                     : (size_t)(rowend - tile[0]) * (colend - tile[1]);
+      tilecount *= matrix->metricsnum;
+      if ( count + tilecount > part.valuesnum || fread(value, sizeof(float), tilecount, in) != tilecount ) {
+        result = 3;
+        break;
+      }
+      count += tilecount;
+      b = tile[0] / part.tile;
+      if ( b < b0 || b >= b1 ) { /* bands b ... b1 - 1 in a new window */
+        unmapwindow(&header, first, last, map);
+        b0 = b;
+        for ( b1 = b0 + 1; b1 < blocks && bandfirst(n, part.tile, b1 + 1) - bandfirst(n, part.tile, b0) <= windowpairs; b1++ ) ;
+        first = bandfirst(n, part.tile, b0);
+        last = bandfirst(n, part.tile, b1);
+        if ( mapwindow(fd, &header, first, last, map, window) ) {
+          b0 = b1 = 0;
+          result = 1;
+          break;
+        }
+      }
+      v = 0;
+      for ( i = tile[0]; i < rowend; i++ ) {
+        for ( j = tile[1] > i + 1 ? tile[1] : i + 1; j < colend; j++ ) {
+          p = pairindex(n, i, j) - first;
+          for ( m = 0; m < matrix->metricsnum; m++ ) putvalue(window[m], p, value[v++], quantize, header.scale[m]);
+        }
+      }
+    }
+    if ( result == 0 && count != part.valuesnum ) result = 3;
+    if ( in != NULL ) fclose(in);
+    if ( tilesin != NULL ) fclose(tilesin);
+  }
+  unmapwindow(&header, first, last, map);
+  free(value);
+  if ( close(fd) != 0 && result == 0 ) result = 1;
+  return result;
+} /* mergemapped */
+
+float matrixvalue(struct distmatrix *matrix, unsigned i, unsigned j, unsigned k) {
+  if ( i == j ) return 0.0;
+  if ( i > j ) return matrixvalue(matrix, j, i, k);
+  return matrix->value[pairindex(matrix->treenum, i, j) * matrix->metricsnum + k];
+} /* matrixvalue */
+
+/****************************************************************
+* writephylip: square matrices in the PHYLIP format, one after
+*  another for every metric; trees are named tree1, tree2, ...
+*****************************************************************/
+void writephylip(FILE *out, struct distmatrix *matrix) {
+  unsigned i, j, k;
+  char name[16];
+
+  for ( k = 0; k < matrix->metricsnum; k++ ) {
+    fprintf(out, "%5u\n", matrix->treenum);
+    for ( i = 0; i < matrix->treenum; i++ ) {
+      sprintf(name, "tree%u", i + 1);
+      fprintf(out, "%-10s", name);
+      for ( j = 0; j < matrix->treenum; j++ ) fprintf(out, " %.4f", matrixvalue(matrix, i, j, k));
+      fprintf(out, "\n");
+    }
+  }
+} /* writephylip */
+
+/****************************************************************
+* writetsv: one row for every pair i < j with the numbers of the
+*  trees and a column for every metric, as treedist prints a pair
+*****************************************************************/
+void writetsv(FILE *out, struct distmatrix *matrix) {
+  unsigned i, j, k;
+  float *value;
+
+  fprintf(out, "tree1\ttree2");
+  for ( k = 0; k < matrix->metricsnum; k++ ) fprintf(out, "\t%s", metricnames[matrix->metrics[k]]);
+  fprintf(out, "\n");
+  value = matrix->value;
+  for ( i = 0; i < matrix->treenum; i++ ) {
+    for ( j = i + 1; j < matrix->treenum; j++ ) {
+      fprintf(out, "%u\t%u", i + 1, j + 1);
+      for ( k = 0; k < matrix->metricsnum; k++ ) fprintf(out, "\t%.4f", *value++);
+      fprintf(out, "\n");
+    }
+  }
+} /* writetsv */
+
+void freematrix(struct distmatrix *matrix) {
+  free(matrix->value);
+  matrix->value = NULL;
+} /* freematrix */
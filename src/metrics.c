@@ -0,0 +1,401 @@
+/*  metrics.c compares two trees by several distances at once for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  A comparison restricts the bigger tree to the leaves of the smaller
+    one once, as every program of the package does. The leaf map is made
+    by the first metric that needs it, the splits by the first of rf,
+    rfn, rfa and quartet, the sums of path differences by l1 or l2 (both
+    sums in one pass if both metrics are wanted). Every metric gives
+    the value its program computes, including the special cases; all
+    values are printed with four decimals, where quartet_dist prints
+    0.0 and 1.0 for trees of at most 3 common leaves or of different
+    leaves.
+*/
+
+#include "treedist.h"
+
+const char *metricnames[METRICSNUM] = { "rf", "rfn", "rfa", "l1", "l2", "quartet" };
+
+/****************************************************************
+* parsemetrics: metric numbers of a list like "rf,l2,quartet"
+*  into metrics[], their number into *count; returns 1 if a name
+*  is unknown
+*****************************************************************/
+int parsemetrics(char *list, unsigned *metrics, unsigned *count) {
+  char *name, *end;
+  size_t len;
+  unsigned m;
+
+  *count = 0;
+  name = list;
+  while ( *name != '\0' ) {
+    end = strchr(name, ',');
+    len = end ? (size_t)(end - name) : strlen(name);
+    for ( m = 0; m < METRICSNUM; m++ ) {
+      if ( strlen(metricnames[m]) == len && strncmp(name, metricnames[m], len) == 0 ) break;
+    }
+    if ( m == METRICSNUM || *count == METRICSNUM ) return 1;
+    metrics[(*count)++] = m;
+    if ( end == NULL ) break;
+    name = end + 1;
+  }
+  return *count == 0;
+} /* parsemetrics */
+
+/****************************************************************
+* startcomparison: restrict the bigger tree to the leaves of
+*  the smaller one; bit m of wanted is set if metric m will be
+*  asked for
+*****************************************************************/
+void startcomparison(struct comparison *c, struct tree intree1, struct tree intree2, unsigned wanted) {
+  memset(c, 0, sizeof(struct comparison));
+  c->tree1 = intree1;
+  c->tree2 = intree2;
+  c->wanted = wanted;
+  c->leavesnum = intree1.leavesnum < intree2.leavesnum ? intree1.leavesnum : intree2.leavesnum;
+  if ( intree1.leavesnum < intree2.leavesnum ) {
+    c->tree2 = subtree(intree2, intree1.leaf, intree1.leavesnum);
+    c->own2 = 1;
+  }
+  if ( intree1.leavesnum > intree2.leavesnum ) {
+    c->tree1 = subtree(intree1, intree2.leaf, intree2.leavesnum);
+    c->own1 = 1;
+  }
+  c->restricted = c->own1 || c->own2;
+} /* startcomparison */
+
+/****************************************************************
+* mapleaves: the leaf map of the restricted trees, returns
+*  c->leaves
+*****************************************************************/
+static int mapleaves(struct comparison *c) {
+  unsigned i, n;
+  char *used;
+
+  if ( c->leaves != 0 ) return c->leaves;
+  n = c->tree1.leavesnum;
+  if ( n != c->tree2.leavesnum ) {
+    c->leaves = -1;
+    return c->leaves;
+  }
+  c->corresp = (unsigned*)malloc(sizeof(unsigned) * (n + 1));
+  used = (char*)calloc(n + 1, 1);
+  c->leaves = 1;
+  for ( i = 0; i < n; i++ ) {
+    c->corresp[i] = findleaf(c->tree2, c->tree1.leaf[i]);
+    if ( c->corresp[i] == n ) {
+      fprintf(stderr, "The leaf \"%s\" of tree #1 has no correspondence in the tree #2\n", c->tree1.leaf[i]);
+      c->leaves = -2;
+      break;
+    }
+    if ( used[c->corresp[i]] ) c->repeated = 1;
+    used[c->corresp[i]] = 1;
+  }
+  free(used);
+  return c->leaves;
+} /* mapleaves */
+
+/* the leaf map of a pair of a collection with the same leaves, see startpair() */
+static void samemap(struct comparison *c) {
+  unsigned i;
+
+  c->corresp = (unsigned*)malloc(sizeof(unsigned) * (c->tree1.leavesnum + 1));
+  for ( i = 0; i < c->tree1.leavesnum; i++ ) c->corresp[i] = findleaf(c->tree2, c->tree1.leaf[i]);
+} /* samemap */
+
+/* splits of both trees in the leaf order of tree 1, the leaves must be the same;
+   splits given by startpair() or startreference() are used as they are */
+static void makecomparisonsplits(struct comparison *c) {
+  if ( c->havesplits ) return;
+  if ( c->given2 == NULL && c->corresp == NULL ) samemap(c);
+  c->splits1 = c->given1 ? *c->given1 : makesplits(c->tree1, NULL, c->tree1.leavesnum);
+  c->splits2 = c->given2 ? *c->given2 : makesplits(c->tree2, c->corresp, c->tree1.leavesnum);
+  c->havesplits = 1;
+} /* makecomparisonsplits */
+
+/****************************************************************
+* splitdistance: the result of branchdist() for the restricted trees
+*****************************************************************/
+unsigned splitdistance(struct comparison *c) {
+  if ( mapleaves(c) < 0 ) {
+    return c->tree1.branchnum + c->tree2.branchnum - c->tree1.leavesnum - c->tree2.leavesnum;
+  }
+  if ( !c->havecommon ) {
+    makecomparisonsplits(c);
+    c->common = commonsplits(&c->splits1, &c->splits2);
+    c->havecommon = 1;
+  }
+  return c->tree1.branchnum + c->tree2.branchnum - 2 * c->common;
+} /* splitdistance */
+
+/****************************************************************
+* pathsum: the result of treedist2() for the restricted trees;
+*  the other sum is found in the same pass if it is wanted too
+*****************************************************************/
+static long pathsum(struct comparison *c, char p) {
+  char both;
+
+  if ( mapleaves(c) < 0 ) return -1;
+  if ( naivealgorithms ) return treedist2(c->tree1, c->tree2, p);
+  if ( c->corresp == NULL ) samemap(c);
+  if ( p == 1 ? !c->havesum1 : !c->havesum2 ) {
+    both = (c->wanted >> METRICL1 & 1) && (c->wanted >> METRICL2 & 1);
+    pathdiffs(c->tree1, c->tree2, c->corresp, p == 1 || both ? &c->sum1 : NULL, p == 2 || both ? &c->sum2 : NULL);
+    if ( p == 1 || both ) c->havesum1 = 1;
+    if ( p == 2 || both ) c->havesum2 = 1;
+  }
+  return p == 1 ? c->sum1 : c->sum2;
+} /* pathsum */
+
+/****************************************************************
+* metricvalue: the distance of a given metric between the trees of a comparison,
+*  the same value as the program of the metric computes
+*****************************************************************/
+double metricvalue(struct comparison *c, unsigned metric) {
+  struct tree *t1 = &c->tree1, *t2 = &c->tree2;
+  struct quartets counts;
+  unsigned n, distance;
+  long number;
+  float result;
+
+  switch ( metric ) {
+  case METRICRF:
+    n = t1->branchnum + t2->branchnum - t1->leavesnum - t2->leavesnum;
+    result = (float)splitdistance(c)/n;
+    break;
+
+  case METRICRFN: /* rf_dist_n compares restricted trees as rf_dist */
+    if ( !c->restricted && mapleaves(c) > 0 ) {
+      splitdistance(c);
+      distance = (t1->branchnum < t2->branchnum ? t1->branchnum : t2->branchnum) - c->common;
+    }
+    else distance = splitdistance(c);
+    if ( t1->branchnum < t2->branchnum ) n = t1->branchnum - t1->leavesnum;
+    else n = t2->branchnum - t2->leavesnum;
+    if ( n == 0 ) return 0.0;
+    result = (float)distance/n;
+    break;
+
+  case METRICRFA:
+    n = t1->branchnum + t2->branchnum - t1->leavesnum - t2->leavesnum;
+    if ( mapleaves(c) == -1 ) return 1.0;
+    if ( c->leaves == -2 ) result = 1.0;
+    else if ( naivealgorithms ) result = aligndist(*t1, *t2);
+    else {
+      makecomparisonsplits(c);
+      result = t1->branchnum + t2->branchnum - 2 * alignhits(&c->splits1, &c->splits2);
+    }
+    result = result/n;
+    break;
+
+  case METRICL1:
+  case METRICL2:
+    n = c->leavesnum;
+    number = pathsum(c, metric == METRICL1 ? 1 : 2);
+    if ( number < 0 ) return 1000000;
+    result = (float)(number * 2)/(n * (n - 1));
+    if ( metric == METRICL2 ) return sqrt(result);
+    break;
+
+  default: /* METRICQUARTET, as treedist4() and quartet_dist */
+    n = c->leavesnum;
+    if ( t1->leavesnum == t2->leavesnum && t1->leavesnum > 3 ) {
+      if ( mapleaves(c) < 0 ) number = -1;
+      else if ( naivealgorithms || c->repeated ) number = treedist4(*t1, *t2);
+      else {
+        makecomparisonsplits(c);
+        splitquartets(&c->splits1, &c->splits2, &counts);
+        number = counts.same + counts.unresolved;
+      }
+    }
+    else number = t1->leavesnum <= 3 ? 0 : -1;
+    if ( number < 0 ) return 1.0;
+    if ( n <= 3 ) return 0.0;
+    result = quartetdistance(number, n);
+  }
+  return result;
+} /* metricvalue */
+
+void finishcomparison(struct comparison *c) {
+  if ( c->own1 ) freetree(c->tree1);
+  if ( c->own2 ) freetree(c->tree2);
+  if ( c->havesplits ) {
+    if ( c->given1 == NULL ) freesplits(c->splits1);
+    if ( c->given2 == NULL ) freesplits(c->splits2);
+  }
+  free(c->corresp);
+} /* finishcomparison */
+
+/* Trees of a collection shared by threads, see collectionleaves() */
+struct leavesjob {
+  struct collection *coll;
+  char *same; /* 1 for a tree with the leaves of tree 0, each written by its own thread */
+};
+
+/****************************************************************
+* collectionleaves: check that tree k of a collection has the
+*  leaves of tree 0, each once, and if splits are wanted, make
+*  its splits in the leaf order of tree 0 and index them
+*****************************************************************/
+static void collectionleaves(void *arg, unsigned k) {
+  struct leavesjob *job = (struct leavesjob*)arg;
+  struct collection *coll = job->coll;
+  struct tree *t0 = coll->trees, *t = coll->trees + k;
+  unsigned *order;
+  char *used;
+  unsigned i, n;
+
+  n = t0->leavesnum;
+  job->same[k] = 0;
+  if ( t->leavesnum != n ) return;
+  order = (unsigned*)malloc(sizeof(unsigned) * (n + 1));
+  used = (char*)calloc(n + 1, 1);
+  for ( i = 0; i < n; i++ ) {
+    order[i] = findleaf(*t, t0->leaf[i]);
+    if ( order[i] == n || used[order[i]] ) break;
+    used[order[i]] = 1;
+  }
+  job->same[k] = i == n;
+  if ( i == n && coll->splits != NULL ) {
+    coll->splits[k] = makesplits(*t, order, n);
+    indexsplits(coll->splits + k);
+  }
+  free(used);
+  free(order);
+} /* collectionleaves */
+
+/****************************************************************
+* startcollection: prepare trees to be compared pairwise by
+*  startpair(). If all trees have the same leaves and a metric of
+*  splits is wanted, the splits of every tree are made and indexed
+*  once, in the leaf order of tree 0, on up to threads threads;
+*  a pair of trees then shares them instead of making its own.
+*  For rf and rfn the splits are also numbered by internsplits(),
+*  and if no other metric needs them, only the numbers are kept.
+*****************************************************************/
+void startcollection(struct collection *coll, struct tree *trees, unsigned treenum,
+                     unsigned wanted, unsigned threads) {
+  struct leavesjob job;
+  unsigned splitmetrics, k;
+
+  memset(coll, 0, sizeof(struct collection));
+  coll->treenum = treenum;
+  coll->trees = trees;
+  coll->wanted = wanted;
+  if ( treenum == 0 ) return;
+  splitmetrics = 1u << METRICRF | 1u << METRICRFN | 1u << METRICRFA | 1u << METRICQUARTET;
+  if ( (wanted & splitmetrics) && !naivealgorithms ) {
+    coll->splits = (struct splits*)calloc(treenum, sizeof(struct splits));
+  }
+  /* every thread marks its own trees, the marks are joined after them */
+  job.coll = coll;
+  job.same = (char*)malloc(treenum);
+  runparallel(threads, treenum, collectionleaves, &job);
+  coll->sameleaves = 1;
+  for ( k = 0; k < treenum; k++ ) {
+    if ( !job.same[k] ) coll->sameleaves = 0;
+  }
+  free(job.same);
+  if ( coll->splits == NULL ) return;
+  if ( !coll->sameleaves ) { /* every pair makes its own splits */
+    for ( k = 0; k < treenum; k++ ) freesplits(coll->splits[k]);
+    free(coll->splits);
+    coll->splits = NULL;
+    return;
+  }
+  for ( k = 0; k < treenum; k++ ) {
+    coll->splitbytes += (size_t)coll->splits[k].branchnum
+                        * (sizeof(uint64_t) * (coll->splits[k].words + 1) + sizeof(unsigned))
+                        + sizeof(unsigned) * coll->splits[k].tablesize;
+  }
+  if ( wanted & (1u << METRICRF | 1u << METRICRFN) ) internsplits(coll);
+  if ( coll->id != NULL && !(wanted & (1u << METRICRFA | 1u << METRICQUARTET)) ) {
+    /* the numbers of splits are enough */
+    for ( k = 0; k < treenum; k++ ) freesplits(coll->splits[k]);
+    free(coll->splits);
+    coll->splits = NULL;
+    coll->splitbytes = sizeof(unsigned) * coll->idstart[treenum]
+                       + sizeof(uint64_t) * coll->columnwords * treenum;
+  }
+} /* startcollection */
+
+/****************************************************************
+* startpair: startcomparison() for trees i and j of a collection;
+*  the splits of the collection and their numbers are used if
+*  it has them
+*****************************************************************/
+void startpair(struct comparison *c, struct collection *coll, unsigned i, unsigned j) {
+  startcomparison(c, coll->trees[i], coll->trees[j], coll->wanted);
+  if ( !coll->sameleaves ) return;
+  c->leaves = 1; /* the leaf map is made by pathsum() only */
+  if ( coll->splits != NULL ) {
+    c->given1 = coll->splits + i;
+    c->given2 = coll->splits + j;
+  }
+  if ( coll->id != NULL ) {
+    c->common = paircommon(coll, i, j);
+    c->havecommon = 1;
+  }
+} /* startpair */
+
+void finishcollection(struct collection *coll) {
+  unsigned k;
+
+  if ( coll->splits != NULL ) {
+    for ( k = 0; k < coll->treenum; k++ ) freesplits(coll->splits[k]);
+    free(coll->splits);
+  }
+  freesplitdict(coll);
+} /* finishcollection */
+
+/****************************************************************
+* makereference: prepare a tree to be compared with many others
+*  by startreference(); its splits are made and indexed once if
+*  a metric of splits is wanted
+*****************************************************************/
+void makereference(struct reference *ref, struct tree intree, unsigned wanted) {
+  unsigned splitmetrics;
+
+  ref->tree = intree;
+  ref->wanted = wanted;
+  ref->splits = NULL;
+  splitmetrics = 1u << METRICRF | 1u << METRICRFN | 1u << METRICRFA | 1u << METRICQUARTET;
+  if ( (wanted & splitmetrics) && !naivealgorithms ) {
+    ref->stored = makesplits(intree, NULL, intree.leavesnum);
+    indexsplits(&ref->stored);
+    ref->splits = &ref->stored;
+  }
+} /* makereference */
+
+/****************************************************************
+* startreference: startcomparison() of the reference tree with
+*  another tree; the splits of the reference are used unless it
+*  is restricted to the leaves of the other tree
+*****************************************************************/
+void startreference(struct comparison *c, struct reference *ref, struct tree intree) {
+  startcomparison(c, ref->tree, intree, ref->wanted);
+  if ( !c->own1 ) c->given1 = ref->splits;
+} /* startreference */
+
+void freereference(struct reference *ref) {
+  if ( ref->splits != NULL ) freesplits(ref->stored);
+} /* freereference */
@@ -0,0 +1,565 @@
+/*  moves.c keeps the distances between a reference tree and a query tree changed by SPR
+    and NNI moves for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  The query is a binary unrooted tree hanging from leaf 0: leaves are
+    nodes 0 ... n - 1 in the leaf order of the reference, inner nodes
+    are n ... 2n - 3, every node but leaf 0 has a branch to its parent,
+    and the split of that branch is the set of leaves below the node
+    (it never has leaf 0, as makesplits() wants).
+
+    sprmove(s, t) prunes the subtree of node s, removing its parent u,
+    and grafts it on the branch above node t through a new node, which
+    takes the number u. Then
+
+    - the splits change only on the path between the old and the new
+      place of the subtree: the nodes from the old parent of u up to
+      the common ancestor lose the leaves of s, those from the new
+      parent of u up to it gain them, and u gets a new split; every
+      changed split is looked up in the reference before and after,
+      so the number of common splits is kept exactly;
+    - a path between two leaves outside s gets one branch shorter if
+      it went through u and one longer if it goes through the new u;
+      paths from the leaves of s are found again from their depth in s
+      and the distances from u. The sums of differences with the
+      reference are changed for these pairs only.
+
+    A move costs O(n) plus the changed pairs of leaves plus the path
+    between the two places times n / 64 for the splits. The changed
+    pairs are |s| (n - |s|) at most plus those crossing u, a small part
+    of n^2 for moves of small subtrees and NNI near the leaves, but no
+    method can do better for L1 and L2, whose terms are the pairs. An
+    NNI is the SPR of a child of a node onto the sibling of that node.
+*/
+
+#include "treedist.h"
+
+/****************************************************************
+* subtreeleaves: the leaves below node v into list and, if depth
+*  is not NULL, their distances from v into depth; returns their
+*  number
+*****************************************************************/
+static unsigned subtreeleaves(struct movecomparison *m, unsigned v, unsigned *list, unsigned *depth) {
+  unsigned top, count, x, c;
+
+  m->stack[0] = v;
+  m->dist[v] = 0;
+  top = 1;
+  count = 0;
+  while ( top > 0 ) {
+    x = m->stack[--top];
+    if ( x < m->leavesnum ) {
+      if ( depth != NULL ) depth[count] = m->dist[x];
+      list[count++] = x;
+      continue;
+    }
+    for ( c = 0; c < 2; c++ ) {
+      m->dist[m->child[2 * x + c]] = m->dist[x] + 1;
+      m->stack[top++] = m->child[2 * x + c];
+    }
+  }
+  return count;
+} /* subtreeleaves */
+
+/****************************************************************
+* setpath: the distance between leaves a and b of the query becomes
+*  d, the sums of differences with the reference changing with it
+*****************************************************************/
+static void setpath(struct movecomparison *m, unsigned a, unsigned b, unsigned d) {
+  size_t i = (size_t)a * m->leavesnum + b;
+  long before, after;
+
+  before = (long)m->path[i] - m->refpath[i];
+  after = (long)d - m->refpath[i];
+  m->sum1 += (after < 0 ? -after : after) - (before < 0 ? -before : before);
+  m->sum2 += after * after - before * before;
+  m->path[i] = (uint16_t)d;
+  m->path[(size_t)b * m->leavesnum + a] = (uint16_t)d;
+} /* setpath */
+
+/****************************************************************
+* updatesplit: the split of node v was changed in place; its size,
+*  hash and presence in the reference are found again
+*****************************************************************/
+static void updatesplit(struct movecomparison *m, unsigned v) {
+  uint64_t *bits;
+  unsigned w;
+
+  bits = m->splits.bits + (size_t)v * m->splits.words;
+  if ( m->present[v] ) m->common--;
+  m->splits.size[v] = 0;
+  for ( w = 0; w < m->splits.words; w++ ) m->splits.size[v] += popcount64(bits[w]);
+  m->splits.hash[v] = hashsplit(bits, m->splits.words);
+  m->present[v] = findsplit(&m->refsplits, &m->splits, v) < m->refsplits.branchnum;
+  if ( m->present[v] ) m->common++;
+} /* updatesplit */
+
+static void replacechild(struct movecomparison *m, unsigned v, unsigned old, unsigned new) {
+  if ( m->child[2 * v] == old ) m->child[2 * v] = new;
+  else m->child[2 * v + 1] = new;
+} /* replacechild */
+
+/****************************************************************
+* startmoves: a comparison of a query tree, which is changed by
+*  moves, with a reference tree of the same leaves. The sums of
+*  path differences are kept only if paths is 1. Returns 0 on
+*  success, 1 if the leaves differ or are less than 4, 2 if the
+*  query is not binary, 3 if paths are too long for 16 bits.
+*****************************************************************/
+int startmoves(struct movecomparison *m, struct tree reference, struct tree query, char paths) {
+  struct skeleton s;
+  unsigned n, b, j, k, v, x, c, top, pos, nodes;
+  unsigned *corresp, *id, *degree, *adj, *order;
+  uint64_t *bits;
+  size_t i;
+  char *name;
+  long diff;
+
+  n = reference.leavesnum;
+  if ( query.leavesnum != n || n < 4 ) return 1;
+  if ( paths && 2 * n - 3 > 65535 ) return 3;
+  corresp = (unsigned*)malloc(sizeof(unsigned) * n);
+  m->present = (char*)calloc(n, 1);
+  for ( k = 0; k < n; k++ ) {
+    corresp[k] = findleaf(reference, query.leaf[k]);
+    if ( corresp[k] == n || m->present[corresp[k]] ) {
+      free(corresp);
+      free(m->present);
+      return 1;
+    }
+    m->present[corresp[k]] = 1;
+  }
+  free(m->present);
+
+  /* a leaf is the branch above it, which readbrackets() may have
+     removed as one of the two branches at the root; then it is the
+     root of the skeleton */
+  s = treeskeleton(query);
+  b = query.branchnum;
+  nodes = 2 * n - 2;
+  id = (unsigned*)malloc(sizeof(unsigned) * (2 * (b + 1) + 4 * nodes));
+  degree = id + b + 1;
+  order = degree + b + 1;
+  adj = order + nodes;
+  for ( j = 0; j <= b; j++ ) id[j] = MOVENONE;
+  for ( k = 0; k < n && b == nodes - 1; k++ ) {
+    j = s.parent[s.leafnode[k]];
+    if ( id[j] != MOVENONE ) b = 0; /* two leaves in one node */
+    else id[j] = corresp[k];
+  }
+  pos = n;
+  for ( j = 0; j <= b && b == nodes - 1; j++ ) {
+    if ( id[j] == MOVENONE ) id[j] = pos++;
+    degree[j] = 0;
+  }
+  for ( j = 0; j < b && pos == nodes; j++ ) {
+    degree[j]++;
+    degree[s.parent[j]]++;
+  }
+  for ( j = 0; j <= b && pos == nodes; j++ ) {
+    if ( degree[j] != (id[j] < n ? 1 : 3) ) pos = 0;
+  }
+  if ( b != nodes - 1 || pos != nodes ) {
+    freeskeleton(s);
+    free(id);
+    free(corresp);
+    return 2;
+  }
+  for ( v = 0; v < nodes; v++ ) degree[v] = 0;
+  for ( j = 0; j < b; j++ ) {
+    v = id[j];
+    x = id[s.parent[j]];
+    adj[3 * v + degree[v]++] = x;
+    adj[3 * x + degree[x]++] = v;
+  }
+  freeskeleton(s);
+
+  m->leavesnum = n;
+  m->nodesnum = nodes;
+  m->parent = (unsigned*)malloc(sizeof(unsigned) * (8 * nodes + 2 * n));
+  m->child = m->parent + nodes;
+  m->stack = m->child + 2 * nodes;
+  m->dist = m->stack + nodes;
+  m->mark = m->dist + nodes;
+  m->lose = m->mark + nodes;
+  m->gain = m->lose + nodes;
+  m->list = m->gain + nodes;
+  m->other = m->list + n;
+  m->stamp = 0;
+  for ( v = 0; v < nodes; v++ ) {
+    m->mark[v] = 0;
+    m->child[2 * v] = m->child[2 * v + 1] = MOVENONE;
+  }
+
+  /* hanging from leaf 0, nodes in preorder into order */
+  m->parent[0] = MOVENONE;
+  m->stack[0] = 0;
+  top = 1;
+  pos = 0;
+  while ( top > 0 ) {
+    v = m->stack[--top];
+    order[pos++] = v;
+    for ( c = 0, k = 0; k < degree[v]; k++ ) {
+      x = adj[3 * v + k];
+      if ( x == m->parent[v] ) continue;
+      m->parent[x] = v;
+      m->child[2 * v + c++] = x;
+      m->stack[top++] = x;
+    }
+  }
+
+  m->splits.leavesnum = n;
+  m->splits.branchnum = nodes;
+  m->splits.words = (n + 63) / 64;
+  m->splits.bits = (uint64_t*)calloc((size_t)m->splits.words * (nodes + 1), sizeof(uint64_t));
+  m->splits.size = (unsigned*)malloc(sizeof(unsigned) * nodes);
+  m->splits.hash = (uint64_t*)malloc(sizeof(uint64_t) * nodes);
+  m->splits.table = NULL;
+  m->present = (char*)calloc(nodes, 1);
+  if ( m->parent == NULL || m->splits.bits == NULL || m->splits.size == NULL
+       || m->splits.hash == NULL || m->present == NULL ) {
+    fprintf(stderr, "Not enough memory for moves of a tree of %u leaves\n", n);
+    exit(1);
+  }
+  /* the last row is a work space for the moved leaves */
+  m->moved = m->splits.bits + (size_t)m->splits.words * nodes;
+  m->refsplits = makesplits(reference, NULL, n);
+  indexsplits(&m->refsplits);
+  m->branchnum = nodes - 1;
+  m->refbranchnum = reference.branchnum;
+  m->common = 0;
+  for ( pos = nodes; pos-- > 1; ) {
+    v = order[pos];
+    bits = m->splits.bits + (size_t)v * m->splits.words;
+    if ( v < n ) bits[v / 64] |= (uint64_t)1 << (v % 64);
+    else {
+      for ( c = 0; c < 2; c++ ) {
+        for ( k = 0; k < m->splits.words; k++ ) {
+          bits[k] |= m->splits.bits[(size_t)m->child[2 * v + c] * m->splits.words + k];
+        }
+      }
+    }
+    updatesplit(m, v);
+  }
+  free(id);
+
+  m->namesize = 0;
+  for ( k = 0; k < n; k++ ) m->namesize += strlen(reference.leaf[k]) + 1;
+  m->names = newtree(n, 0, m->namesize);
+  name = m->names.leaf[0];
+  for ( k = 0; k < n; k++ ) {
+    m->names.leaf[k] = name;
+    strcpy(name, reference.leaf[k]);
+    name += strlen(name) + 1;
+  }
+  indexleaves(&m->names);
+
+  m->path = m->refpath = NULL;
+  m->sum1 = m->sum2 = 0;
+  if ( paths ) {
+    m->path = (uint16_t*)malloc(sizeof(uint16_t) * 2 * (size_t)n * n);
+    if ( m->path == NULL ) {
+      fprintf(stderr, "Not enough memory for paths of a tree of %u leaves\n", n);
+      exit(1);
+    }
+    m->refpath = m->path + (size_t)n * n;
+    if ( leafpaths(reference, NULL, m->refpath) || leafpaths(query, corresp, m->path) ) {
+      free(corresp);
+      finishmoves(m);
+      return 3;
+    }
+    for ( j = 0; j < n; j++ ) {
+      for ( k = j + 1; k < n; k++ ) {
+        i = (size_t)j * n + k;
+        diff = (long)m->path[i] - m->refpath[i];
+        m->sum1 += diff < 0 ? -diff : diff;
+        m->sum2 += diff * diff;
+      }
+    }
+  }
+  free(corresp);
+  return 0;
+} /* startmoves */
+
+/****************************************************************
+* sprmove: the subtree of node subtree is pruned and grafted on
+*  the branch above node target. Returns 0 on success (nothing is
+*  done if target is the sibling of subtree), 1 if it is not a move:
+*  the nodes should not be leaf 0, nor target in the subtree or its
+*  parent, and the parent should not be leaf 0.
+*****************************************************************/
+int sprmove(struct movecomparison *m, unsigned subtree, unsigned target) {
+  unsigned n, words, s, t, u, w, p, q, a, b, lca, marka, markb;
+  unsigned k, i, nsub, nbelow, nout, nlose, ngain, top, x, y, c;
+  uint64_t *bits;
+
+  n = m->leavesnum;
+  words = m->splits.words;
+  nsub = 0;
+  s = subtree;
+  t = target;
+  if ( s == 0 || t == 0 || s >= m->nodesnum || t >= m->nodesnum ) return 1;
+  u = m->parent[s];
+  if ( u == 0 || t == u ) return 1;
+  /* in a tree of binary nodes the split of a node of the subtree is a
+     part of the split of s, that of an ancestor is bigger */
+  if ( m->splits.size[t] <= m->splits.size[s]
+       && andbits(m->splits.bits + (size_t)t * words, m->splits.bits + (size_t)s * words, words) > 0 ) return 1;
+  w = m->child[2 * u] == s ? m->child[2 * u + 1] : m->child[2 * u];
+  if ( t == w ) return 0;
+  p = m->parent[u];
+  memcpy(m->moved, m->splits.bits + (size_t)s * words, sizeof(uint64_t) * words);
+
+  /* pruning: u is removed from the paths between leaves below w and outside u */
+  if ( m->path != NULL ) {
+    nsub = subtreeleaves(m, s, m->list, m->other);
+    for ( i = 0; i < nsub; i++ ) m->lose[i] = m->other[i]; /* depths in s for later */
+    nbelow = subtreeleaves(m, w, m->gain, NULL);
+    bits = m->splits.bits + (size_t)u * words;
+    nout = 0;
+    for ( k = 0; k < n; k++ ) {
+      if ( !(bits[k / 64] >> (k % 64) & 1) ) m->other[nout++] = k;
+    }
+    for ( i = 0; i < nbelow; i++ ) {
+      x = m->gain[i];
+      for ( k = 0; k < nout; k++ ) {
+        y = m->other[k];
+        setpath(m, x, y, m->path[(size_t)x * n + y] - 1);
+      }
+    }
+  }
+  replacechild(m, p, u, w);
+  m->parent[w] = p;
+
+  /* grafting: u is put into the paths between leaves below t and the rest but s */
+  q = m->parent[t];
+  if ( m->path != NULL ) {
+    nbelow = subtreeleaves(m, t, m->gain, NULL);
+    m->stamp++;
+    for ( i = 0; i < nsub; i++ ) m->mark[m->list[i]] = m->stamp;
+    for ( i = 0; i < nbelow; i++ ) m->mark[m->gain[i]] = m->stamp;
+    nout = 0;
+    for ( k = 0; k < n; k++ ) {
+      if ( m->mark[k] != m->stamp ) m->other[nout++] = k;
+    }
+    for ( i = 0; i < nbelow; i++ ) {
+      x = m->gain[i];
+      for ( k = 0; k < nout; k++ ) {
+        y = m->other[k];
+        setpath(m, x, y, m->path[(size_t)x * n + y] + 1);
+      }
+    }
+  }
+  replacechild(m, q, t, u);
+  m->parent[u] = q;
+  m->child[2 * u] = t;
+  m->child[2 * u + 1] = s;
+  m->parent[t] = u;
+
+  /* paths from the leaves of s: their depth in s, the branch above s
+     and the distance from u found by a walk that does not enter s */
+  if ( m->path != NULL ) {
+    m->stamp++;
+    m->mark[u] = m->stamp;
+    m->dist[u] = 0;
+    m->stack[0] = u;
+    top = 1;
+    while ( top > 0 ) {
+      x = m->stack[--top];
+      for ( c = 0; c < 3; c++ ) {
+        y = c < 2 ? m->child[2 * x + c] : m->parent[x];
+        if ( y == MOVENONE || y == s || m->mark[y] == m->stamp ) continue;
+        m->mark[y] = m->stamp;
+        m->dist[y] = m->dist[x] + 1;
+        m->stack[top++] = y;
+      }
+    }
+    for ( i = 0; i < nsub; i++ ) {
+      x = m->list[i];
+      for ( y = 0; y < n; y++ ) {
+        if ( m->mark[y] == m->stamp ) setpath(m, x, y, m->lose[i] + 1 + m->dist[y]);
+      }
+    }
+  }
+
+  /* splits: the two paths up to their common ancestor, walked in turn */
+  m->stamp += 2;
+  marka = m->stamp - 1;
+  markb = m->stamp;
+  nlose = ngain = 0;
+  a = p;
+  b = q;
+  for (;;) {
+    if ( m->mark[a] == markb ) {
+      lca = a;
+      break;
+    }
+    if ( m->mark[a] != marka ) {
+      m->mark[a] = marka;
+      m->lose[nlose++] = a;
+    }
+    if ( m->mark[b] == marka ) {
+      lca = b;
+      break;
+    }
+    if ( m->mark[b] != markb ) {
+      m->mark[b] = markb;
+      m->gain[ngain++] = b;
+    }
+    if ( m->parent[a] != MOVENONE ) a = m->parent[a];
+    if ( m->parent[b] != MOVENONE ) b = m->parent[b];
+  }
+  for ( i = 0; i < nlose && m->lose[i] != lca; i++ ) {
+    bits = m->splits.bits + (size_t)m->lose[i] * words;
+    for ( k = 0; k < words; k++ ) bits[k] &= ~m->moved[k];
+    updatesplit(m, m->lose[i]);
+  }
+  for ( i = 0; i < ngain && m->gain[i] != lca; i++ ) {
+    bits = m->splits.bits + (size_t)m->gain[i] * words;
+    for ( k = 0; k < words; k++ ) bits[k] |= m->moved[k];
+    updatesplit(m, m->gain[i]);
+  }
+  bits = m->splits.bits + (size_t)u * words;
+  for ( k = 0; k < words; k++ ) bits[k] = m->splits.bits[(size_t)t * words + k] | m->moved[k];
+  updatesplit(m, u);
+  return 0;
+} /* sprmove */
+
+/****************************************************************
+* nnimove: child number which (0 or 1) of inner node v is swapped
+*  with the sibling of v. Returns 0 on success, 1 if it is not a move.
+*****************************************************************/
+int nnimove(struct movecomparison *m, unsigned v, unsigned which) {
+  unsigned u;
+
+  if ( v < m->leavesnum || v >= m->nodesnum || which > 1 ) return 1;
+  u = m->parent[v];
+  if ( u == 0 ) return 1;
+  return sprmove(m, m->child[2 * v + 1 - which], m->child[2 * u] == v ? m->child[2 * u + 1] : m->child[2 * u]);
+} /* nnimove */
+
+/****************************************************************
+* movevalue: the number metricvalue() gives for the query and the
+*  reference, for METRICRF, and METRICL1 and METRICL2 if the paths
+*  are kept; -1 for other metrics
+*****************************************************************/
+double movevalue(struct movecomparison *m, unsigned metric) {
+  unsigned n;
+  long number;
+  float result;
+
+  switch ( metric ) {
+  case METRICRF:
+    n = m->branchnum + m->refbranchnum - 2 * m->leavesnum;
+    result = (float)(m->branchnum + m->refbranchnum - 2 * m->common)/n;
+    break;
+
+  case METRICL1:
+  case METRICL2:
+    if ( m->path == NULL ) return -1.0;
+    n = m->leavesnum;
+    number = metric == METRICL1 ? m->sum1 : m->sum2;
+    result = (float)(number * 2)/(n * (n - 1));
+    if ( metric == METRICL2 ) return sqrt(result);
+    break;
+
+  default:
+    return -1.0;
+  }
+  return result;
+} /* movevalue */
+
+/* Newick of the subtree of node v at out, returns the end */
+static char *writesubtree(struct movecomparison *m, unsigned v, char *out) {
+  unsigned top, x, c;
+
+  m->stack[0] = v;
+  m->dist[v] = 0; /* the next child */
+  top = 1;
+  while ( top > 0 ) {
+    x = m->stack[top - 1];
+    if ( x < m->leavesnum ) {
+      strcpy(out, m->names.leaf[x]);
+      out += strlen(out);
+      top--;
+      continue;
+    }
+    if ( m->dist[x] == 2 ) {
+      *out++ = ')';
+      top--;
+      continue;
+    }
+    *out++ = m->dist[x] == 0 ? '(' : ',';
+    c = m->child[2 * x + m->dist[x]++];
+    m->dist[c] = 0;
+    m->stack[top++] = c;
+  }
+  return out;
+} /* writesubtree */
+
+/****************************************************************
+* movednewick: the query in Newick without branch lengths, three
+*  subtrees at the root, in a malloc() string
+*****************************************************************/
+char *movednewick(struct movecomparison *m) {
+  char *result, *out;
+  unsigned c;
+
+  result = (char*)malloc(m->namesize + 2 * m->nodesnum + 8);
+  if ( result == NULL ) {
+    fprintf(stderr, "Not enough memory for a tree of %u leaves\n", m->leavesnum);
+    exit(1);
+  }
+  out = result;
+  *out++ = '(';
+  strcpy(out, m->names.leaf[0]);
+  out += strlen(out);
+  c = m->child[0];
+  *out++ = ',';
+  out = writesubtree(m, m->child[2 * c], out);
+  *out++ = ',';
+  out = writesubtree(m, m->child[2 * c + 1], out);
+  strcpy(out, ");");
+  return result;
+} /* movednewick */
+
+/****************************************************************
+* movedtree: the query as readbrackets() makes it
+*****************************************************************/
+struct tree movedtree(struct movecomparison *m) {
+  struct tree result;
+  char *newick;
+
+  newick = movednewick(m);
+  result = readbrackets(newick);
+  free(newick);
+  return result;
+} /* movedtree */
+
+void finishmoves(struct movecomparison *m) {
+  free(m->parent);
+  freesplits(m->splits);
+  freesplits(m->refsplits);
+  free(m->present);
+  freetree(m->names);
+  free(m->path);
+} /* finishmoves */
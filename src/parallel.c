@@ -0,0 +1,137 @@
+/*  parallel.c runs independent pieces of work on several threads
+    for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+
+struct parallel {
+  unsigned count; /* number of pieces */
+  unsigned next; /* the first piece nobody took */
+  void (*work)(void *arg, unsigned index);
+  void *arg;
+};
+
+/****************************************************************
+* cpucount: the number of processors online
+*****************************************************************/
+unsigned cpucount(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (unsigned)n : 1;
+} /* cpucount */
+
+/****************************************************************
+* cachesize: bytes of the L2 cache of a processor, or 256 KB if
+*  the system does not tell it
+*****************************************************************/
+unsigned long cachesize(void) {
+  long n = -1;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+  return n > 0 ? (unsigned long)n : 262144;
+} /* cachesize */
+
+/****************************************************************
+* residentmemory: bytes of memory the process has in RAM now,
+*  or 0 if the system does not tell it
+*****************************************************************/
+unsigned long residentmemory(void) {
+  unsigned long size, resident = 0;
+  FILE *statm;
+
+  statm = fopen("/proc/self/statm", "r");
+  if ( statm == NULL ) return 0;
+  if ( fscanf(statm, "%lu %lu", &size, &resident) != 2 ) resident = 0;
+  fclose(statm);
+  return resident * (unsigned long)sysconf(_SC_PAGESIZE);
+} /* residentmemory */
+
+/****************************************************************
+* parsememory: a size of memory as bytes with an optional suffix
+*  K, M or G, return 0 on success, 1 if the text is not a size
+*  above 0 or the size does not fit in unsigned long
+*****************************************************************/
+int parsememory(const char *text, unsigned long *bytes) {
+  unsigned shift = 0;
+  char *end;
+
+  if ( !isdigit((unsigned char)text[0]) ) return 1;
+  errno = 0;
+  *bytes = strtoul(text, &end, 10);
+  if ( errno == ERANGE ) return 1;
+  if ( *end != '\0' && end[1] == '\0' && strchr("kKmMgG", *end) != NULL ) { /* a suffix */
+    shift = *end == 'k' || *end == 'K' ? 10 : (*end == 'm' || *end == 'M' ? 20 : 30);
+    end++;
+  }
+  if ( *bytes == 0 || *end != '\0' || *bytes > ULONG_MAX >> shift ) return 1;
+  *bytes <<= shift;
+  return 0;
+} /* parsememory */
+
+static void *worker(void *arg) {
+  struct parallel *job = (struct parallel*)arg;
+  unsigned k;
+
+  while ( (k = __sync_fetch_and_add(&job->next, 1)) < job->count ) {
+    job->work(job->arg, k);
+  }
+  return NULL;
+} /* worker */
+
+/****************************************************************
+* runparallel: call work(arg, k) for k = 0 ... count - 1 on
+*  at most threads threads (the calling one included). Every
+*  thread takes the next piece when done with the previous one,
+*  so pieces of different cost are balanced. Returns when all
+*  pieces are done.
+*****************************************************************/
+void runparallel(unsigned threads, unsigned count, void (*work)(void *arg, unsigned index), void *arg) {
+  struct parallel job;
+  pthread_t *thread;
+  unsigned t, started;
+
+  if ( threads > count ) threads = count;
+  job.count = count;
+  job.next = 0;
+  job.work = work;
+  job.arg = arg;
+  if ( threads <= 1 ) {
+    worker(&job);
+    return;
+  }
+  thread = (pthread_t*)malloc(sizeof(pthread_t) * (threads - 1));
+  started = 0;
+  for ( t = 0; t < threads - 1; t++ ) {
+    if ( pthread_create(thread + t, NULL, worker, &job) != 0 ) break;
+    started++;
+  }
+  worker(&job);
+  for ( t = 0; t < started; t++ ) {
+    pthread_join(thread[t], NULL);
+  }
+  free(thread);
+} /* runparallel */
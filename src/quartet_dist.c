@@ -36,19 +36,55 @@
 
 int main (int argc, char *argv[])
 {
-  unsigned i, n;
+  unsigned n;
   long number;
   float distance;
-  unsigned len = 128;
-  FILE *inflow;
+  struct treefile infile;
   struct tree intree1, intree2;
-  char *newick;
-  char c;
+  struct quartets counts;
+  struct skeleton skeleton1, skeleton2;
+  struct quartetestimate estimate;
+  char verbose = 0;
+  int result = 0;
+  double bound = 0.0; /* 0 for the exact distance */
+  unsigned long long maxsamples = 0;
+  uint64_t seed = 1;
 
   /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-naive") == 0) naivealgorithms = 1; /* every quartet is checked */
+    else if (strcmp(argv[1], "-v") == 0) verbose = 1;
+    else if (strcmp(argv[1], "-e") == 0 && argc > 3) {
+      bound = atof(argv[2]);
+      if ( bound <= 0.0 ) {
+        fprintf(stderr, "Wrong error bound \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-t") == 0 && argc > 3) {
+      threadsnum = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : cpucount();
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-seed") == 0 && argc > 3) {
+      seed = strtoull(argv[2], NULL, 10);
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-samples") == 0 && argc > 3) {
+      maxsamples = strtoull(argv[2], NULL, 10);
+      argv++;
+      argc--;
+    }
+    else break;
+    argv++;
+    argc--;
+  }
   if (argc < 2)
   {
-    fprintf(stderr, "Usage: %s <input tree 1> [<input tree 2>]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-naive] [-t <n>] [-v] [-e <error> [-seed <n>] [-samples <n>]] <input tree 1> [<input tree 2>]\n", argv[0]);
     fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
     return 1;
   }
@@ -59,90 +95,118 @@ int main (int argc, char *argv[])
     fprintf(stderr, "distance between two phylogenetic trees.\n");
     fprintf(stderr, "Trees should be in Newick format.\n");
     fprintf(stderr, "Both trees can be in one file or in separate files.\n");
-    fprintf(stderr, "Usage: %s <input file> [<input file 2>]\n", argv[0]);
+    fprintf(stderr, "Use \"-\" as a file name to read trees from the standard input.\n");
+    fprintf(stderr, "Option -v prints the numbers of quartets resolved by both trees in the same\n");
+    fprintf(stderr, "and in different ways, by one tree only and by neither tree.\n");
+    fprintf(stderr, "Option -naive checks every quartet separately (slow, for checks).\n");
+    fprintf(stderr, "Option -e <error> estimates the distance by random quartets until the 95%%\n");
+    fprintf(stderr, "confidence interval is within +-error, for huge trees; -seed <n> sets\n");
+    fprintf(stderr, "the random seed (1 by default), -samples <n> limits the number of quartets.\n");
+    fprintf(stderr, "Option -t <n> computes the distance on n threads (0 for all processors).\n");
+    fprintf(stderr, "Usage: %s [-naive] [-t <n>] [-v] [-e <error> [-seed <n>] [-samples <n>]] <input file> [<input file 2>]\n", argv[0]);
     fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
     fprintf(stderr, "Example: %s twotrees.tre\n", argv[0]);
+    fprintf(stderr, "Example: %s -e 0.001 bigtrees.tre\n", argv[0]);
     return 0;
   }
 
-  inflow = fopen(argv[1], "r");
-  if ( inflow == NULL ) {
-    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
-    exit(1);
-  }
-
-  newick = (char*) malloc(sizeof(char)*len);
-  i = 0;
-  c = '\0';
-  while (!feof(inflow) && (c != ';') ) {
-    c = fgetc(inflow);
-    if ( !feof(inflow) && c != '\n' && c != '\r') {
-      i++;
-      if (i > len - 2) {
-        len = 2*len;
-        newick = (char*)realloc(newick, sizeof(char)*len);
+  if ( bound > 0.0 ) { /* the trees are read without branch matrices */
+    if ( opentrees(&infile, argv[1]) ) {
+      fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+      exit(1);
+    }
+    if ( !readtreeskeleton(&infile, &skeleton1) ) {
+      fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[1]);
+      exit(1);
+    }
+    if (argc > 2) {
+      closetrees(&infile);
+      if ( opentrees(&infile, argv[2]) ) {
+        fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
+        exit(1);
+      }
+    }
+    if ( !readtreeskeleton(&infile, &skeleton2) ) {
+      if (argc > 2) {
+        fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[2]);
       }
-      newick[i-1] = c;
+      else {
+        fprintf(stderr, "Only one tree in \"%s\"!\n", argv[1]);
+      }
+      exit(1);
+    }
+    closetrees(&infile);
+    if ( samplequartets(&skeleton1, &skeleton2, bound, maxsamples, seed, &estimate) ) {
+      puts("1.0");
+      return 0;
+    }
+    if ( estimate.samples == 0 ) {
+      puts("0.0");
+      return 0;
     }
+    printf("%.4f\n", estimate.distance);
+    printf("95%% confidence interval: %.4f - %.4f (%llu quartets sampled)\n",
+           estimate.low, estimate.high, estimate.samples);
+    freeskeleton(skeleton1);
+    freeskeleton(skeleton2);
+    return 0;
+  }
+
+  if ( opentrees(&infile, argv[1]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+    exit(1);
   }
-  if ( feof(inflow) ) {
+  if ( !readtree(&infile, &intree1) ) {
     fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[1]);
     exit(1);
   }
-  newick[i] = '\0';
-  intree1 = readbrackets(newick);
-  free(newick);
 
   if (argc > 2) { /* second tree is in separate file */
-    fclose(inflow);
-    inflow = fopen(argv[2], "r");
-    if ( inflow == NULL ) {
+    closetrees(&infile);
+    if ( opentrees(&infile, argv[2]) ) {
       fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
       exit(1);
     }
   }
-  newick = (char*) malloc(sizeof(char)*len);
-  i = 0;
-  c = '\0';
-  while (!feof(inflow) && (c != ';') ) {
-    c = fgetc(inflow);
-    if ( !feof(inflow) && c != '\n' && c != '\r') {
-      i++;
-      if (i > len - 2) {
-        len = 2*len;
-        newick = (char*)realloc(newick, sizeof(char)*len);
-      }
-      newick[i-1] = c;
-    }
-  }
-  if ( feof(inflow) ) {
-    if (argc > 2) 
+  if ( !readtree(&infile, &intree2) ) {
+    if (argc > 2) {
       fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[2]);
-    else
+    }
+    else {
       fprintf(stderr, "Only one tree in \"%s\"!\n", argv[1]);
+    }
     exit(1);
   }
-  fclose(inflow);
-  newick[i] = '\0';
-  intree2 = readbrackets(newick);
-  free(newick);
+  closetrees(&infile);
 
   n = intree1.leavesnum;
-  if ( n == intree2.leavesnum )
-    number = treedist4(intree1, intree2);
   if ( n < intree2.leavesnum )
-    number = treedist4(intree1, subtree(intree2, intree1.leaf, intree1.leavesnum));
+    intree2 = subtree(intree2, intree1.leaf, intree1.leavesnum);
   if ( n > intree2.leavesnum ) {
-    number = treedist4(subtree(intree1, intree2.leaf, intree2.leavesnum), intree2);
+    intree1 = subtree(intree1, intree2.leaf, intree2.leavesnum);
     n = intree2.leavesnum;
   }
+  if ( verbose ) { /* the counts give the common fourths as in treedist4() */
+    result = quartetcounts(intree1, intree2, &counts);
+    if ( n <= 3 ) number = 0;
+    else number = result ? -1 : counts.same + counts.unresolved;
+  }
+  else number = treedist4(intree1, intree2);
   if ( number >= 0 ) {
     if ( n > 3 ) {
-      distance = 1.0 - (float)(number * 24)/(n * (n - 1) * (n - 2) * (n - 3));
+      distance = quartetdistance(number, n);
       printf("%.4f\n", distance);
     }
     else puts("0.0");
   }
   else puts("1.0");
+  if ( verbose && result == 0 ) {
+    printf("Quartets: %lld\n", counts.total);
+    printf("Resolved by both trees in the same way: %lld\n", counts.same);
+    printf("Resolved by both trees in different ways: %lld\n", counts.different);
+    printf("Resolved by tree 1 only: %lld\n", counts.only1);
+    printf("Resolved by tree 2 only: %lld\n", counts.only2);
+    printf("Resolved by neither tree: %lld\n", counts.unresolved);
+  }
   return 0;
 } /* main */
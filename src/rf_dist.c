@@ -35,18 +35,20 @@
 
 int main (int argc, char *argv[])
 {
-  unsigned i, n;
+  unsigned n;
   unsigned distance;
-  unsigned len = 128;
-  FILE *inflow;
+  struct treefile infile;
   struct tree intree1, intree2, tmptree;
-  char *newick;
-  char c;
 
   /* Checking command line */
+  if (argc > 1 && strcmp(argv[1], "-naive") == 0) { /* splits are compared pairwise */
+    naivealgorithms = 1;
+    argv++;
+    argc--;
+  }
   if (argc < 2)
   {
-    fprintf(stderr, "Usage: %s <input tree 1> [<input tree 2>]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-naive] <input tree 1> [<input tree 2>]\n", argv[0]);
     fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
     return 1;
   }
@@ -57,63 +59,31 @@ int main (int argc, char *argv[])
     fprintf(stderr, "distance between two phylogenetic trees.\n");
     fprintf(stderr, "Trees should be in Newick format.\n");
     fprintf(stderr, "Both trees can be in one file or in separate files.\n");
-    fprintf(stderr, "Usage: %s <input file> [<input file 2>]\n", argv[0]);
+    fprintf(stderr, "Use \"-\" as a file name to read trees from the standard input.\n");
+    fprintf(stderr, "Option -naive compares all pairs of splits instead of hashing them (for checks).\n");
+    fprintf(stderr, "Usage: %s [-naive] <input file> [<input file 2>]\n", argv[0]);
     fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
     fprintf(stderr, "Example: %s twotrees.tre\n", argv[0]);
     return 0;
   }
 
-  inflow = fopen(argv[1], "r");
-  if ( inflow == NULL ) {
+  if ( opentrees(&infile, argv[1]) ) {
     fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
     exit(1);
   }
-
-  newick = (char*) malloc(sizeof(char)*len);
-  i = 0;
-  c = '\0';
-  while (!feof(inflow) && (c != ';') ) {
-    c = fgetc(inflow);
-    if ( !feof(inflow) && c != '\n' && c != '\r') {
-      i++;
-      if (i > len - 2) {
-        len = 2*len;
-        newick = (char*)realloc(newick, sizeof(char)*len);
-      }
-      newick[i-1] = c;
-    }
-  }
-  if ( feof(inflow) ) {
+  if ( !readtree(&infile, &intree1) ) {
     fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[1]);
     exit(1);
   }
-  newick[i] = '\0';
-  intree1 = readbrackets(newick);
-  free(newick);
 
   if (argc > 2) { /* second tree is in separate file */
-    fclose(inflow);
-    inflow = fopen(argv[2], "r");
-    if ( inflow == NULL ) {
+    closetrees(&infile);
+    if ( opentrees(&infile, argv[2]) ) {
       fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
       exit(1);
     }
   }
-  newick = (char*) malloc(sizeof(char)*len);
-  i = 0;
-  c = '\0';
-  while (!feof(inflow) && (c != ';') ) {
-    c = fgetc(inflow);
-    if ( !feof(inflow) && c != '\n' && c != '\r') {
-      i++;
-      if (i > len - 2) {
-        len = 2*len;
-        newick = (char*)realloc(newick, sizeof(char)*len);
-      }
-      newick[i-1] = c;
-    }
-  }
-  if ( feof(inflow) ) {
+  if ( !readtree(&infile, &intree2) ) {
     if (argc > 2) {
       fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[2]);
     }
@@ -122,10 +92,7 @@ int main (int argc, char *argv[])
     }
     exit(1);
   }
-  fclose(inflow);
-  newick[i] = '\0';
-  intree2 = readbrackets(newick);
-  free(newick);
+  closetrees(&infile);
   if (intree1.leavesnum == intree2.leavesnum) {
     distance = branchdist(intree1, intree2);
     n = intree1.branchnum + intree2.branchnum - intree1.leavesnum - intree2.leavesnum;
@@ -0,0 +1,281 @@
+/*  sketch.c makes MinHash sketches of trees and their LSH index (.lsh) for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  A split is hashed by its leaf names, so the hash does not depend on
+    the order of leaves in the Newick text: every leaf name gets a 64-bit
+    hash, and a split is the sum of hashes of the leaves on the side
+    without the leaf of the smallest hash. Trivial splits are skipped,
+    they are the same for all trees of the same leaves.
+    The sketch of a tree keeps, for each of rows * bands hash functions,
+    the minimum over its splits; the share of equal minima of two
+    sketches estimates the Jaccard similarity of their sets of splits:
+    for binary trees of m inner splits with c common ones it is
+    c / (2m - c) = (1 - rf) / (1 + rf), not 1 - rf.
+
+    Layout of a .lsh file (numbers in the byte order of the machine
+    that wrote it, checked by the byteorder field):
+
+    file header     struct lshheader
+    sketches        treenum times rows * bands uint32 minima
+    buckets         for every band, treenum pairs of uint32 (key, tree)
+                    sorted by key; the key of a band is a hash of its
+                    rows minima, so trees with equal minima of a band
+                    are neighbours there and are found by binary search
+*/
+
+#include "treedist.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LSHMAGIC "TREELSH\n"
+#define LSHVERSION 1
+#define LSHBYTEORDER 0x01020304u
+
+struct lshheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint64_t treenum;
+  uint32_t rows;
+  uint32_t bands;
+  uint64_t sketchpos; /* offsets of sketches and buckets */
+  uint64_t bucketpos;
+};
+
+/* the finalizer of splitmix64 */
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+} /* mix64 */
+
+static uint64_t namehash(const char *name) {
+  uint64_t h = 14695981039346656037ull;
+
+  while ( *name ) {
+    h ^= (unsigned char)*name++;
+    h *= 1099511628211ull;
+  }
+  return mix64(h);
+} /* namehash */
+
+/****************************************************************
+* sketchtree: minima of size hash functions over the nontrivial
+*  splits of a tree into sketch[]
+*****************************************************************/
+void sketchtree(struct tree intree, unsigned size, uint32_t *sketch) {
+  uint64_t *leafhash, *seed, h;
+  const uint64_t *bits;
+  unsigned n, i, k, f, first, count, side;
+  uint32_t v;
+
+  n = intree.leavesnum;
+  for ( f = 0; f < size; f++ ) sketch[f] = 0xffffffffu;
+  if ( n < 4 ) return;
+  leafhash = (uint64_t*)malloc(sizeof(uint64_t) * (n + size));
+  seed = leafhash + n;
+  for ( f = 0; f < size; f++ ) seed[f] = mix64(f + 1);
+  first = 0;
+  for ( k = 0; k < n; k++ ) {
+    leafhash[k] = namehash(intree.leaf[k]);
+    if ( leafhash[k] < leafhash[first] ) first = k;
+  }
+  for ( i = 0; i < intree.branchnum; i++ ) {
+    bits = BRANCHROW(intree, i);
+    side = HASBIT(bits, first);
+    h = 0;
+    count = 0;
+    for ( k = 0; k < n; k++ ) {
+      if ( HASBIT(bits, k) != side ) {
+        h += leafhash[k];
+        count++;
+      }
+    }
+    if ( count < 2 || count > n - 2 ) continue;
+    for ( f = 0; f < size; f++ ) {
+      v = (uint32_t)(mix64(h ^ seed[f]) >> 32);
+      if ( v < sketch[f] ) sketch[f] = v;
+    }
+  }
+  free(leafhash);
+} /* sketchtree */
+
+/****************************************************************
+* sketchsimilarity: the share of equal minima of two sketches
+*****************************************************************/
+double sketchsimilarity(const uint32_t *a, const uint32_t *b, unsigned size) {
+  unsigned f, same = 0;
+
+  for ( f = 0; f < size; f++ ) same += a[f] == b[f];
+  return size ? (double)same / size : 0.0;
+} /* sketchsimilarity */
+
+/* the bucket key of band j of a sketch */
+static uint32_t bandkey(const uint32_t *sketch, unsigned rows, unsigned j) {
+  uint64_t h = mix64(j + 0x9e3779b97f4a7c15ull);
+  unsigned r;
+
+  for ( r = 0; r < rows; r++ ) h = mix64(h ^ sketch[j * rows + r]);
+  return (uint32_t)(h >> 32);
+} /* bandkey */
+
+static int compareunsigned(const void *x, const void *y) {
+  unsigned a = *(const unsigned*)x, b = *(const unsigned*)y;
+
+  return a < b ? -1 : (a > b);
+} /* compareunsigned */
+
+static int comparepairs(const void *x, const void *y) {
+  const uint32_t *a = (const uint32_t*)x, *b = (const uint32_t*)y;
+
+  if ( a[0] != b[0] ) return a[0] < b[0] ? -1 : 1;
+  return a[1] < b[1] ? -1 : (a[1] > b[1]);
+} /* comparepairs */
+
+/****************************************************************
+* writelshindex: write the sketches of treenum trees (rows * bands
+*  numbers each) and their buckets into a .lsh file, return 0 on
+*  success
+*****************************************************************/
+int writelshindex(char *filename, const uint32_t *sketches, unsigned treenum, unsigned rows, unsigned bands) {
+  struct lshheader header;
+  uint32_t *pairs;
+  unsigned size, j, t;
+  FILE *out;
+  int result = 0;
+
+  size = rows * bands;
+  out = fopen(filename, "wb");
+  if ( out == NULL ) return 1;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, LSHMAGIC, 8);
+  header.version = LSHVERSION;
+  header.byteorder = LSHBYTEORDER;
+  header.treenum = treenum;
+  header.rows = rows;
+  header.bands = bands;
+  header.sketchpos = sizeof(header);
+  header.bucketpos = header.sketchpos + sizeof(uint32_t) * (uint64_t)size * treenum;
+  if ( fwrite(&header, sizeof(header), 1, out) != 1
+       || fwrite(sketches, sizeof(uint32_t) * size, treenum, out) != treenum ) result = 1;
+  pairs = (uint32_t*)malloc(sizeof(uint32_t) * 2 * (treenum + 1));
+  for ( j = 0; j < bands && result == 0; j++ ) {
+    for ( t = 0; t < treenum; t++ ) {
+      pairs[2 * t] = bandkey(sketches + (size_t)t * size, rows, j);
+      pairs[2 * t + 1] = t;
+    }
+    qsort(pairs, treenum, sizeof(uint32_t) * 2, comparepairs);
+    if ( fwrite(pairs, sizeof(uint32_t) * 2, treenum, out) != treenum ) result = 1;
+  }
+  free(pairs);
+  if ( fclose(out) != 0 ) result = 1;
+  return result;
+} /* writelshindex */
+
+/****************************************************************
+* openlshindex: map a .lsh file into memory, return 0 on success,
+*  1 if the file can not be opened, 2 if it is not a .lsh file
+*****************************************************************/
+int openlshindex(struct lshindex *index, char *filename) {
+  struct lshheader header;
+  struct stat st;
+  char *data;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if ( fd < 0 ) return 1;
+  if ( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ) {
+    close(fd);
+    return 2;
+  }
+  data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if ( data == MAP_FAILED ) return 1;
+  memcpy(&header, data, sizeof(header));
+  if ( memcmp(header.magic, LSHMAGIC, 8) != 0 || header.version != LSHVERSION
+       || header.byteorder != LSHBYTEORDER || header.rows == 0 || header.bands == 0
+       || header.bucketpos != header.sketchpos + sizeof(uint32_t) * (uint64_t)header.rows * header.bands * header.treenum
+       || header.bucketpos + sizeof(uint32_t) * 2 * (uint64_t)header.bands * header.treenum > (uint64_t)st.st_size ) {
+    munmap(data, st.st_size);
+    return 2;
+  }
+  index->data = data;
+  index->size = st.st_size;
+  index->treenum = header.treenum;
+  index->rows = header.rows;
+  index->bands = header.bands;
+  index->sketch = (const uint32_t*)(data + header.sketchpos);
+  index->bucket = (const uint32_t*)(data + header.bucketpos);
+  return 0;
+} /* openlshindex */
+
+void closelshindex(struct lshindex *index) {
+  munmap(index->data, index->size);
+  index->data = NULL;
+} /* closelshindex */
+
+/****************************************************************
+* lshcandidates: trees sharing a bucket with a sketch in any of
+*  the first bands bands, increasing, without repeats; returns
+*  a malloc() array and their number in *count
+*****************************************************************/
+unsigned *lshcandidates(struct lshindex *index, const uint32_t *sketch, unsigned bands, unsigned *count) {
+  const uint32_t *pairs;
+  unsigned *result;
+  unsigned j, low, high, mid, num, alloc, k;
+  uint32_t key;
+
+  if ( bands > index->bands ) bands = index->bands;
+  num = 0;
+  alloc = 64;
+  result = (unsigned*)malloc(sizeof(unsigned) * alloc);
+  for ( j = 0; j < bands; j++ ) {
+    pairs = index->bucket + (size_t)2 * index->treenum * j;
+    key = bandkey(sketch, index->rows, j);
+    low = 0;
+    high = index->treenum;
+    while ( low < high ) { /* the first pair with this key */
+      mid = low + (high - low) / 2;
+      if ( pairs[2 * mid] < key ) low = mid + 1;
+      else high = mid;
+    }
+    for ( ; low < index->treenum && pairs[2 * low] == key; low++ ) {
+      if ( num == alloc ) {
+        alloc *= 2;
+        result = (unsigned*)realloc(result, sizeof(unsigned) * alloc);
+      }
+      result[num++] = pairs[2 * low + 1];
+    }
+  }
+  qsort(result, num, sizeof(unsigned), compareunsigned);
+  for ( j = k = 0; j < num; j++ ) {
+    if ( k == 0 || result[j] != result[k - 1] ) result[k++] = result[j];
+  }
+  *count = k;
+  return result;
+} /* lshcandidates */
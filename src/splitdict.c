@@ -0,0 +1,219 @@
+/*  splitdict.c numbers the distinct splits of a collection of trees for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  In a collection of bootstrap trees most splits recur in many trees.
+    The splits of all trees (made in the leaf order of tree 0) are put
+    into one hash table, and every distinct split gets a number, so a
+    tree becomes an increasing list of numbers and two trees are
+    compared by merging two lists of integers instead of hashing and
+    comparing bitsets.
+
+    Splits present once in every tree (trivial ones at least) are common
+    to all pairs; they are counted once in coll->universal and are not
+    listed. Splits present in two trees or more get the numbers
+    0 ... sharednum - 1, splits of one tree only get the rest. If the
+    shared splits are few, every tree also gets a column of the
+    split-by-tree incidence matrix, a bitset of sharednum bits, and
+    the common splits of two trees are counted by popcount of the AND
+    of their columns.
+
+    branchdist() counts the splits of tree 1 present in tree 2, so a
+    split repeated in tree 1 is counted as many times as it is there.
+    A list keeps repeated numbers, and columns are not used for a tree
+    with repeated splits.
+*/
+
+#include "treedist.h"
+
+#define NOSPLIT 0xffffffffu
+
+/* A split of a collection: branch of a tree */
+struct splitref {
+  unsigned tree;
+  unsigned branch;
+};
+
+static int compareids(const void *x, const void *y) {
+  unsigned a = *(const unsigned*)x, b = *(const unsigned*)y;
+
+  return a < b ? -1 : (a > b);
+} /* compareids */
+
+/* 1 if split b of tree k equals the split of ref */
+static int samesplit(struct collection *coll, unsigned k, unsigned b, struct splitref *ref) {
+  struct splits *s1 = coll->splits + k, *s2 = coll->splits + ref->tree;
+
+  return s1->hash[b] == s2->hash[ref->branch] && s1->size[b] == s2->size[ref->branch]
+         && memcmp(s1->bits + (size_t)b * s1->words, s2->bits + (size_t)ref->branch * s2->words,
+                   sizeof(uint64_t) * s1->words) == 0;
+} /* samesplit */
+
+/****************************************************************
+* internsplits: number the distinct splits of a collection that
+*  has splits of all trees made in the same leaf order, and make
+*  the lists of numbers of every tree and, if they are not too
+*  big, the columns of the incidence matrix
+*****************************************************************/
+void internsplits(struct collection *coll) {
+  struct splitref *ref;
+  unsigned *table, *rawid, *treecount, *copies, *lasttree, *newid;
+  unsigned n, k, b, h, mask, id, distinct, shared;
+  size_t total, pos, p, tablesize, listed;
+
+  n = coll->treenum;
+  total = 0;
+  for ( k = 0; k < n; k++ ) total += coll->splits[k].branchnum;
+  if ( total >= NOSPLIT / 2 ) return; /* too many splits, the trees are compared by hashes */
+  tablesize = 2;
+  while ( tablesize < 2 * total ) tablesize *= 2;
+  mask = (unsigned)(tablesize - 1);
+  table = (unsigned*)malloc(sizeof(unsigned) * tablesize);
+  ref = (struct splitref*)malloc(sizeof(struct splitref) * (total + 1));
+  rawid = (unsigned*)malloc(sizeof(unsigned) * (total + 1));
+  treecount = (unsigned*)calloc(3 * total + 1, sizeof(unsigned));
+  if ( table == NULL || ref == NULL || rawid == NULL || treecount == NULL ) {
+    fprintf(stderr, "Not enough memory for splits of %u trees\n", n);
+    exit(1);
+  }
+  copies = treecount + total;
+  lasttree = copies + total;
+  memset(table, 0xff, sizeof(unsigned) * tablesize);
+
+  /* the table keeps the first occurrence of every distinct split */
+  distinct = 0;
+  pos = 0;
+  for ( k = 0; k < n; k++ ) {
+    for ( b = 0; b < coll->splits[k].branchnum; b++ ) {
+      h = (unsigned)coll->splits[k].hash[b] & mask;
+      while ( (id = table[h]) != NOSPLIT && !samesplit(coll, k, b, ref + id) ) h = (h + 1) & mask;
+      if ( id == NOSPLIT ) {
+        id = distinct++;
+        table[h] = id;
+        ref[id].tree = k;
+        ref[id].branch = b;
+        lasttree[id] = NOSPLIT;
+      }
+      if ( lasttree[id] != k ) {
+        treecount[id]++;
+        lasttree[id] = k;
+      }
+      copies[id]++;
+      rawid[pos++] = id;
+    }
+  }
+  free(table);
+  free(ref);
+
+  /* splits of every tree once are counted, shared ones are numbered first */
+  newid = lasttree;
+  coll->universal = 0;
+  shared = 0;
+  for ( id = 0; id < distinct; id++ ) {
+    if ( treecount[id] == n && copies[id] == n ) {
+      coll->universal++;
+      newid[id] = NOSPLIT;
+    }
+    else if ( treecount[id] > 1 ) newid[id] = shared++;
+  }
+  coll->sharednum = shared;
+  coll->splitsnum = distinct;
+  for ( id = 0; id < distinct; id++ ) {
+    if ( treecount[id] == 1 ) newid[id] = shared++;
+  }
+
+  /* increasing lists of numbers */
+  coll->idstart = (size_t*)malloc(sizeof(size_t) * (n + 1));
+  coll->id = (unsigned*)malloc(sizeof(unsigned) * (total + 1));
+  coll->repeatedsplits = (char*)calloc(n + 1, 1);
+  pos = 0;
+  listed = 0;
+  for ( k = 0; k < n; k++ ) {
+    coll->idstart[k] = listed;
+    for ( b = 0; b < coll->splits[k].branchnum; b++ ) {
+      id = newid[rawid[pos++]];
+      if ( id != NOSPLIT ) coll->id[listed++] = id;
+    }
+    qsort(coll->id + coll->idstart[k], listed - coll->idstart[k], sizeof(unsigned), compareids);
+    for ( p = coll->idstart[k] + 1; p < listed; p++ ) {
+      if ( coll->id[p] == coll->id[p - 1] ) coll->repeatedsplits[k] = 1;
+    }
+  }
+  coll->idstart[n] = listed;
+  free(rawid);
+  free(treecount);
+
+  /* columns, if a column is not longer than an average list */
+  coll->columnwords = (coll->sharednum + 63) / 64;
+  coll->column = NULL;
+  if ( coll->sharednum > 0 && (size_t)coll->columnwords * n <= listed ) {
+    coll->column = (uint64_t*)calloc((size_t)coll->columnwords * n, sizeof(uint64_t));
+  }
+  if ( coll->column != NULL ) {
+    for ( k = 0; k < n; k++ ) {
+      for ( p = coll->idstart[k]; p < coll->idstart[k + 1] && coll->id[p] < coll->sharednum; p++ ) {
+        id = coll->id[p];
+        coll->column[(size_t)k * coll->columnwords + id / 64] |= (uint64_t)1 << (id % 64);
+      }
+    }
+  }
+  else coll->columnwords = 0;
+} /* internsplits */
+
+/****************************************************************
+* paircommon: commonsplits() for the splits of trees i and j of
+*  a collection numbered by internsplits()
+*****************************************************************/
+unsigned paircommon(struct collection *coll, unsigned i, unsigned j) {
+  unsigned *a, *aend, *b, *bend;
+  unsigned common;
+
+  common = coll->universal;
+  if ( coll->column != NULL && !coll->repeatedsplits[i] ) {
+    return common + andbits(coll->column + (size_t)i * coll->columnwords,
+                            coll->column + (size_t)j * coll->columnwords, coll->columnwords);
+  }
+  a = coll->id + coll->idstart[i];
+  aend = coll->id + coll->idstart[i + 1];
+  b = coll->id + coll->idstart[j];
+  bend = coll->id + coll->idstart[j + 1];
+  while ( a < aend && b < bend && *a < coll->sharednum && *b < coll->sharednum ) {
+    if ( *a < *b ) a++;
+    else if ( *a > *b ) b++;
+    else { /* every copy in tree i is counted */
+      common++;
+      a++;
+      if ( a == aend || *a != a[-1] ) b++;
+    }
+  }
+  return common;
+} /* paircommon */
+
+void freesplitdict(struct collection *coll) {
+  free(coll->idstart);
+  free(coll->id);
+  free(coll->repeatedsplits);
+  free(coll->column);
+  coll->idstart = NULL;
+  coll->id = NULL;
+  coll->repeatedsplits = NULL;
+  coll->column = NULL;
+} /* freesplitdict */
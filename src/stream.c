@@ -0,0 +1,201 @@
+/*  stream.c compares a reference tree with a stream of trees for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  Three stages work at once on a ring of slots:
+    the reader thread parses the next tree into a free slot,
+    worker threads compare the trees of parsed slots with the reference,
+    the calling thread prints the slots in the order of the input
+    and frees them.
+    Tree q of the input uses slot q % slots, so the reader waits while
+    the row of tree q - slots is not printed, and memory is bounded
+    whatever the length of the input. All stages wait on one condition
+    variable; a tree costs much more than the signals about it.
+*/
+
+#include "treedist.h"
+#include <pthread.h>
+
+#define SLOTSPERTHREAD 8
+
+#define SLOTFREE 0
+#define SLOTPARSED 1
+#define SLOTDONE 2
+
+struct streamslot {
+  struct tree tree;
+  char state;
+  float value[METRICSNUM];
+};
+
+struct streamjob {
+  struct reference *ref;
+  struct treefile *infile;
+  unsigned *metrics;
+  unsigned metricsnum;
+  unsigned slotsnum;
+  struct streamslot *slot;
+  unsigned parsed; /* trees put into slots by the reader */
+  unsigned taken; /* trees taken by workers */
+  unsigned written; /* rows printed */
+  char finished; /* 1 if the reader found the end of the input */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+/****************************************************************
+* streamreader: parse trees into free slots until the input ends
+*****************************************************************/
+static void *streamreader(void *arg) {
+  struct streamjob *job = (struct streamjob*)arg;
+  struct tree intree;
+  unsigned q;
+  int more;
+
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    q = job->parsed;
+    while ( q - job->written >= job->slotsnum ) pthread_cond_wait(&job->changed, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+
+    more = readtree(job->infile, &intree);
+
+    pthread_mutex_lock(&job->lock);
+    if ( more ) {
+      job->slot[q % job->slotsnum].tree = intree;
+      job->slot[q % job->slotsnum].state = SLOTPARSED;
+      job->parsed++;
+    }
+    else job->finished = 1;
+    pthread_cond_broadcast(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+    if ( !more ) return NULL;
+  }
+} /* streamreader */
+
+/****************************************************************
+* streamworker: compare parsed trees with the reference until
+*  the reader finishes and all its trees are taken
+*****************************************************************/
+static void *streamworker(void *arg) {
+  struct streamjob *job = (struct streamjob*)arg;
+  struct streamslot *slot;
+  struct comparison comp;
+  unsigned m;
+
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    while ( job->taken == job->parsed && !job->finished ) pthread_cond_wait(&job->changed, &job->lock);
+    if ( job->taken == job->parsed ) { /* finished */
+      pthread_mutex_unlock(&job->lock);
+      return NULL;
+    }
+    slot = job->slot + job->taken % job->slotsnum;
+    job->taken++;
+    pthread_mutex_unlock(&job->lock);
+
+    startreference(&comp, job->ref, slot->tree);
+    for ( m = 0; m < job->metricsnum; m++ ) {
+      slot->value[m] = (float)metricvalue(&comp, job->metrics[m]);
+    }
+    finishcomparison(&comp);
+
+    pthread_mutex_lock(&job->lock);
+    slot->state = SLOTDONE;
+    pthread_cond_broadcast(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+  }
+} /* streamworker */
+
+/****************************************************************
+* comparestream: compare the reference with every tree of a file
+*  on a reader thread and threads workers and print a row for
+*  every tree in the order of the file. Every tree is compared on
+*  one thread. Returns the number of trees.
+*****************************************************************/
+unsigned comparestream(struct reference *ref, struct treefile *infile, unsigned *metrics,
+                       unsigned metricsnum, unsigned threads, FILE *out) {
+  struct streamjob job;
+  struct streamslot *slot;
+  pthread_t reader, *worker;
+  unsigned t, m, started;
+
+  if ( threads < 1 ) threads = 1;
+  job.ref = ref;
+  job.infile = infile;
+  job.metrics = metrics;
+  job.metricsnum = metricsnum;
+  job.slotsnum = SLOTSPERTHREAD * threads;
+  job.slot = (struct streamslot*)calloc(job.slotsnum, sizeof(struct streamslot));
+  job.parsed = job.taken = job.written = 0;
+  job.finished = 0;
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.changed, NULL);
+
+  fprintf(out, "tree");
+  for ( m = 0; m < metricsnum; m++ ) fprintf(out, "\t%s", metricnames[metrics[m]]);
+  fprintf(out, "\n");
+
+  worker = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+  if ( pthread_create(&reader, NULL, streamreader, &job) != 0 ) {
+    fprintf(stderr, "Can not start a thread\n");
+    exit(1);
+  }
+  started = 0;
+  for ( t = 0; t < threads; t++ ) {
+    if ( pthread_create(worker + t, NULL, streamworker, &job) != 0 ) break;
+    started++;
+  }
+  if ( started == 0 ) {
+    fprintf(stderr, "Can not start a thread\n");
+    exit(1);
+  }
+
+  /* the writer */
+  pthread_mutex_lock(&job.lock);
+  for (;;) {
+    slot = job.slot + job.written % job.slotsnum;
+    while ( slot->state != SLOTDONE && !(job.finished && job.written == job.parsed) ) {
+      pthread_cond_wait(&job.changed, &job.lock);
+    }
+    if ( slot->state != SLOTDONE ) break; /* all rows are printed */
+    pthread_mutex_unlock(&job.lock);
+
+    fprintf(out, "%u", job.written + 1);
+    for ( m = 0; m < metricsnum; m++ ) fprintf(out, "\t%.4f", slot->value[m]);
+    fprintf(out, "\n");
+    freetree(slot->tree);
+
+    pthread_mutex_lock(&job.lock);
+    slot->state = SLOTFREE;
+    job.written++;
+    pthread_cond_broadcast(&job.changed);
+  }
+  pthread_mutex_unlock(&job.lock);
+
+  pthread_join(reader, NULL);
+  for ( t = 0; t < started; t++ ) pthread_join(worker[t], NULL);
+  free(worker);
+  free(job.slot);
+  pthread_cond_destroy(&job.changed);
+  pthread_mutex_destroy(&job.lock);
+  return job.written;
+} /* comparestream */
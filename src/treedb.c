@@ -0,0 +1,311 @@
+/*  treedb.c reads and writes files of pre-parsed trees (.tdb) for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  Layout of a .tdb file (all numbers in the byte order of the machine
+    that wrote it, checked by the byteorder field):
+
+    file header     struct tdbheader
+    tree records    each starts at an offset divisible by 8 with
+                    struct tdbtree, followed by the body:
+                      leaf names, '\0'-terminated, padded to 8 bytes
+                      branch lengths (float), padded to 8 bytes
+                      branches as bitsets of leavesnum bits, 64-bit words,
+                      as they are kept in struct tree
+    directory       treenum pairs of 64-bit numbers: offset and size
+                    of every tree record
+
+    The checksum of a record is FNV-1a of its struct tdbtree, with the
+    checksum field 0, and of its body, so a single tree can be loaded
+    and checked without reading the rest of the file. Version 1 files
+    had the checksum of the body only and are not read.
+*/
+
+#include "treedist.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TDBMAGIC "TREEDB\r\n"
+#define TDBVERSION 2
+#define CHECKSUMSTART 14695981039346656037ull
+#define TDBBYTEORDER 0x01020304u
+#define TREEMAGIC 0x45455254u /* "TREE" */
+
+struct tdbheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint64_t treenum;
+  uint64_t dirpos; /* offset of the directory */
+};
+
+struct tdbtree {
+  uint32_t magic;
+  uint32_t leavesnum;
+  uint32_t branchnum;
+  uint32_t root;
+  uint64_t namesize; /* bytes of names without padding */
+  uint64_t lengthpos; /* offsets of lengths and branches from the record start */
+  uint64_t branchpos;
+  uint64_t checksum;
+  float rootlocation;
+  char rooted;
+  char phylogram;
+  char reserved[2];
+};
+
+/****************************************************************
+* checksum64: FNV-1a hash of a memory block, continuing hash h
+*  (CHECKSUMSTART for a new one)
+*****************************************************************/
+static uint64_t checksum64(uint64_t h, const char *data, size_t size) {
+  size_t i;
+
+  for ( i = 0; i < size; i++ ) {
+    h ^= (unsigned char)data[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+} /* checksum64 */
+
+/* checksum of a record: its header with the checksum field 0, then its body */
+static uint64_t recordchecksum(struct tdbtree header, const char *body, size_t bodysize) {
+  header.checksum = 0;
+  return checksum64(checksum64(CHECKSUMSTART, (const char*)&header, sizeof(header)), body, bodysize);
+} /* recordchecksum */
+
+static size_t pad8(size_t size) {
+  return (size + 7) & ~(size_t)7;
+} /* pad8 */
+
+/****************************************************************
+* istreedb: 1 if a memory block starts as a .tdb file
+*****************************************************************/
+int istreedb(const char *data, size_t size) {
+  return size >= sizeof(struct tdbheader) && memcmp(data, TDBMAGIC, 8) == 0;
+} /* istreedb */
+
+/****************************************************************
+* maptreedb: check the header and the directory of a .tdb file
+*  already in memory, return 0 on success
+*****************************************************************/
+int maptreedb(struct treedb *db, char *data, size_t size) {
+  struct tdbheader header;
+
+  db->data = data;
+  db->size = size;
+  db->treenum = 0;
+  db->dir = NULL;
+  db->mapped = 0;
+  if ( !istreedb(data, size) ) return 1;
+  memcpy(&header, data, sizeof(header));
+  if ( header.version != TDBVERSION || header.byteorder != TDBBYTEORDER ) return 1;
+  if ( header.dirpos % 8 || header.dirpos > size
+       || header.treenum > (size - header.dirpos) / (2 * sizeof(uint64_t)) ) return 1;
+  db->treenum = header.treenum;
+  db->dir = (uint64_t*)(data + header.dirpos);
+  return 0;
+} /* maptreedb */
+
+/****************************************************************
+* opentreedb: map a .tdb file into memory, return 0 on success,
+*  1 if the file can not be opened, 2 if it is not a .tdb file
+*****************************************************************/
+int opentreedb(struct treedb *db, char *filename) {
+  struct stat st;
+  char *data;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if ( fd < 0 ) return 1;
+  if ( fstat(fd, &st) != 0 || st.st_size == 0 ) {
+    close(fd);
+    return 2;
+  }
+  data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if ( data == MAP_FAILED ) return 1;
+  if ( maptreedb(db, data, st.st_size) ) {
+    munmap(data, st.st_size);
+    return 2;
+  }
+  db->mapped = 1;
+  return 0;
+} /* opentreedb */
+
+void closetreedb(struct treedb *db) {
+  if ( db->mapped ) munmap(db->data, db->size);
+  db->data = NULL;
+  db->mapped = 0;
+} /* closetreedb */
+
+/****************************************************************
+* loadtree: make tree number index (from 0) of a .tdb file,
+*  return 0 on success, 1 if the record is damaged
+*****************************************************************/
+int loadtree(struct treedb *db, unsigned index, struct tree *intree) {
+  struct tdbtree header;
+  uint64_t offset, size;
+  unsigned words, k;
+  char *record, *name;
+
+  if ( index >= db->treenum ) return 1;
+  offset = db->dir[2 * index];
+  size = db->dir[2 * index + 1];
+  if ( offset % 8 || offset > db->size || size > db->size - offset || size < sizeof(header) ) return 1;
+  record = db->data + offset;
+  memcpy(&header, record, sizeof(header));
+  if ( header.magic != TREEMAGIC ) return 1;
+  if ( recordchecksum(header, record + sizeof(header), size - sizeof(header)) != header.checksum ) return 1;
+  /* the offsets are compared with size first, so the sums below do not wrap */
+  words = (header.leavesnum + 63) / 64;
+  if ( header.namesize > size - sizeof(header) || header.lengthpos > size || header.branchpos > size
+       || header.lengthpos < sizeof(header) + header.namesize
+       || header.branchpos < header.lengthpos + sizeof(float) * (uint64_t)header.branchnum
+       || header.branchpos + sizeof(uint64_t) * (uint64_t)words * header.branchnum > size
+       || header.branchpos % 8 ) return 1;
+  if ( header.branchnum > 0 ? header.root >= header.branchnum : (header.root != 0 || header.rooted) ) return 1;
+  if ( header.namesize < header.leavesnum || record[sizeof(header) + header.namesize - 1] != '\0' ) {
+    if ( header.leavesnum > 0 ) return 1;
+  }
+
+  *intree = newtree(header.leavesnum, header.branchnum, header.namesize);
+  name = intree->leaf[0];
+  memcpy(name, record + sizeof(header), header.namesize);
+  for ( k = 0; k < header.leavesnum; k++ ) {
+    intree->leaf[k] = name;
+    name += strlen(name) + 1;
+    if ( name > intree->leaf[0] + header.namesize ) {
+      freetree(*intree);
+      return 1;
+    }
+  }
+  indexleaves(intree);
+  memcpy(intree->length, record + header.lengthpos, sizeof(float) * header.branchnum);
+  memcpy(intree->branch, record + header.branchpos, sizeof(uint64_t) * (size_t)words * header.branchnum);
+  intree->rooted = header.rooted;
+  intree->root = header.root;
+  intree->phylogram = header.phylogram;
+  intree->rootlocation = header.rootlocation;
+  return 0;
+} /* loadtree */
+
+/****************************************************************
+* createtreedb: start writing a .tdb file, return 0 on success
+*****************************************************************/
+int createtreedb(struct tdbwriter *writer, char *filename) {
+  struct tdbheader header;
+
+  writer->out = fopen(filename, "wb");
+  if ( writer->out == NULL ) return 1;
+  writer->treenum = 0;
+  writer->dirsize = 16;
+  writer->dir = (uint64_t*)malloc(sizeof(uint64_t) * 2 * writer->dirsize);
+  if ( writer->dir == NULL ) {
+    fclose(writer->out);
+    return 1;
+  }
+  writer->pos = sizeof(header);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TDBMAGIC, 8); /* the header is written again at the end */
+  if ( fwrite(&header, sizeof(header), 1, writer->out) != 1 ) return 1;
+  return 0;
+} /* createtreedb */
+
+/****************************************************************
+* writetreedb: append a tree to a .tdb file, return 0 on success
+*****************************************************************/
+int writetreedb(struct tdbwriter *writer, struct tree intree) {
+  struct tdbtree header;
+  size_t namesize, bodysize, pos;
+  unsigned words, k;
+  char *body;
+  uint64_t *dir;
+
+  namesize = 0;
+  for ( k = 0; k < intree.leavesnum; k++ ) namesize += strlen(intree.leaf[k]) + 1;
+  words = (intree.leavesnum + 63) / 64;
+  memset(&header, 0, sizeof(header));
+  header.magic = TREEMAGIC;
+  header.leavesnum = intree.leavesnum;
+  header.branchnum = intree.branchnum;
+  header.root = intree.root;
+  header.namesize = namesize;
+  header.lengthpos = sizeof(header) + pad8(namesize);
+  header.branchpos = header.lengthpos + pad8(sizeof(float) * intree.branchnum);
+  header.rootlocation = intree.rootlocation;
+  header.rooted = intree.rooted;
+  header.phylogram = intree.phylogram;
+
+  bodysize = header.branchpos + sizeof(uint64_t) * (size_t)words * intree.branchnum - sizeof(header);
+  body = (char*)calloc(bodysize + 1, 1);
+  if ( body == NULL ) return 1;
+  pos = 0;
+  for ( k = 0; k < intree.leavesnum; k++ ) {
+    strcpy(body + pos, intree.leaf[k]);
+    pos += strlen(intree.leaf[k]) + 1;
+  }
+  memcpy(body + header.lengthpos - sizeof(header), intree.length, sizeof(float) * intree.branchnum);
+  memcpy(body + header.branchpos - sizeof(header), intree.branch, sizeof(uint64_t) * (size_t)words * intree.branchnum);
+  header.checksum = recordchecksum(header, body, bodysize);
+
+  if ( writer->treenum == writer->dirsize ) { /* the old directory stays for finishtreedb() on failure */
+    dir = (uint64_t*)realloc(writer->dir, sizeof(uint64_t) * 4 * writer->dirsize);
+    if ( dir == NULL ) {
+      free(body);
+      return 1;
+    }
+    writer->dir = dir;
+    writer->dirsize *= 2;
+  }
+  writer->dir[2 * writer->treenum] = writer->pos;
+  writer->dir[2 * writer->treenum + 1] = sizeof(header) + bodysize;
+  writer->treenum++;
+  writer->pos += sizeof(header) + bodysize;
+  k = fwrite(&header, sizeof(header), 1, writer->out) != 1
+      || fwrite(body, 1, bodysize, writer->out) != bodysize;
+  free(body);
+  return k;
+} /* writetreedb */
+
+/****************************************************************
+* finishtreedb: write the directory and the header and close
+*  the file, return 0 on success
+*****************************************************************/
+int finishtreedb(struct tdbwriter *writer) {
+  struct tdbheader header;
+  int result = 0;
+
+  memcpy(header.magic, TDBMAGIC, 8);
+  header.version = TDBVERSION;
+  header.byteorder = TDBBYTEORDER;
+  header.treenum = writer->treenum;
+  header.dirpos = writer->pos;
+  if ( fwrite(writer->dir, sizeof(uint64_t) * 2, writer->treenum, writer->out) != writer->treenum
+       || fseek(writer->out, 0, SEEK_SET) != 0
+       || fwrite(&header, sizeof(header), 1, writer->out) != 1 ) result = 1;
+  if ( fclose(writer->out) != 0 ) result = 1;
+  free(writer->dir);
+  return result;
+} /* finishtreedb */
@@ -21,43 +21,317 @@
 */
 
 #include "treedist.h"
-#define MAXNAME 40
-#define MAXNUMLEN 25
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define X86KERNELS /* AVX2 and AVX-512 versions of andcount(), chosen by cpuid */
+#endif
+
+char naivealgorithms = 0; /* see treedist.h */
+unsigned threadsnum = 1;
 
 /****************************************************************
-* readbrackets: converting a string with Newick to a rooted tree 
+* piecesnum: into how many pieces work on count items is cut for
+*  runparallel(); 1 if only one thread is used. Results are summed
+*  by pieces in their order, so they do not depend on threads.
 *****************************************************************/
-struct tree readbrackets(char *brackets) {
+static unsigned piecesnum(unsigned count) {
+  unsigned result;
+
+  if ( threadsnum <= 1 ) return 1;
+  result = 8 * threadsnum;
+  return result < count ? result : (count > 0 ? count : 1);
+} /* piecesnum */
+
+/****************************************************************
+* popcount64: the number of 1 bits in a word
+*****************************************************************/
+unsigned popcount64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_popcountll(x);
+#else
+  unsigned result = 0;
+
+  while ( x ) {
+    x &= x - 1;
+    result++;
+  }
+  return result;
+#endif
+} /* popcount64 */
+
+/****************************************************************
+* lowbit64: the index of the lowest 1 bit of a nonzero word
+*****************************************************************/
+static unsigned lowbit64(uint64_t x) {
+#ifdef __GNUC__
+  return __builtin_ctzll(x);
+#else
+  unsigned result = 0;
+
+  while ( !(x & 1) ) {
+    x >>= 1;
+    result++;
+  }
+  return result;
+#endif
+} /* lowbit64 */
+
+/****************************************************************
+* hashsize: the size of a hash table of leaf names or splits,
+*  a power of two not less than twice the number of items
+*****************************************************************/
+static unsigned hashsize(unsigned itemsnum) {
+  unsigned size = 2;
+
+  while ( size < 2 * itemsnum ) size *= 2;
+  return size;
+} /* hashsize */
+
+/****************************************************************
+* hashsplit: hash of a split packed into 64-bit words
+*****************************************************************/
+uint64_t hashsplit(const uint64_t *bits, unsigned words) {
+  uint64_t h = 0;
+  unsigned w;
+
+  for ( w = 0; w < words; w++ ) {
+    h = (h ^ bits[w]) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+  }
+  return h;
+} /* hashsplit */
+
+/****************************************************************
+* hashname: FNV-1a hash of a leaf name
+*****************************************************************/
+static unsigned hashname(const char *name) {
+  unsigned h = 2166136261u;
+
+  while ( *name ) {
+    h ^= (unsigned char)*name++;
+    h *= 16777619u;
+  }
+  return h;
+} /* hashname */
+
+/****************************************************************
+* indexleaves: fill the hash table of leaf names of a tree,
+*  must be called when all names are set. For repeated names
+*  the first leaf is found, as a linear search would do.
+*****************************************************************/
+void indexleaves(struct tree *intree) {
+  unsigned mask, h, k;
+
+  mask = hashsize(intree->leavesnum) - 1;
+  for ( h = 0; h <= mask; h++ ) {
+    intree->leafindex[h] = intree->leavesnum;
+  }
+  for ( k = 0; k < intree->leavesnum; k++ ) {
+    h = hashname(intree->leaf[k]) & mask;
+    while ( intree->leafindex[h] < intree->leavesnum ) h = (h + 1) & mask;
+    intree->leafindex[h] = k;
+  }
+} /* indexleaves */
+
+/****************************************************************
+* findleaf: the index of the leaf with a given name,
+*  or intree.leavesnum if there is no such leaf
+*****************************************************************/
+unsigned findleaf(struct tree intree, const char *name) {
+  unsigned mask, h, k;
+
+  if ( intree.leafindex == NULL ) { /* no index, linear search */
+    for ( k = 0; k < intree.leavesnum; k++ ) {
+      if ( strcmp(intree.leaf[k], name) == 0 ) return k;
+    }
+    return intree.leavesnum;
+  }
+  mask = hashsize(intree.leavesnum) - 1;
+  h = hashname(name) & mask;
+  while ( (k = intree.leafindex[h]) < intree.leavesnum ) {
+    if ( strcmp(intree.leaf[k], name) == 0 ) return k;
+    h = (h + 1) & mask;
+  }
+  return intree.leavesnum;
+} /* findleaf */
+
+/****************************************************************
+* newtree: allocate a tree with all its arrays in one memory block.
+*  The block starts with the array of leaf names, so freetree()
+*  releases the whole tree. The memory for names (namesize bytes) 
+*  is given to the caller in leaf[0]. The branches are bitsets of
+*  one bit per leaf, all bits 0.
+*****************************************************************/
+struct tree newtree(unsigned leavesnum, unsigned branchnum, size_t namesize) {
   struct tree result;
-  char c;
-  char tmpstr[2];
-  char lenstr[MAXNUMLEN];
-  char flag;
-  unsigned i, j, k, s;
-  unsigned nname;
-  unsigned stacklen = 0, maxstacklen = 3;
-  unsigned leafi, branchi, stacki, rooti, rootj; 
-  char **newbranchstack;
-
-  result.leavesnum = 0;
-  result.branchnum = 0;
-  result.leaf = (char**)malloc(sizeof(char*));
-  result.branch = (char**)malloc(sizeof(char*));
-  result.length = (float*)malloc(sizeof(float));
-  newbranchstack = (char**)malloc(sizeof(char*) * maxstacklen);
+  char *block;
+  size_t size, bitsize;
 
+  result.words = (leavesnum + 63) / 64;
+  bitsize = sizeof(uint64_t) * (size_t)result.words * branchnum;
+  size = sizeof(char*) * (leavesnum + 1) + bitsize + sizeof(float) * branchnum
+         + sizeof(unsigned) * hashsize(leavesnum) + namesize;
+  block = (char*)malloc(size);
+  if ( block == NULL ) {
+    fprintf(stderr, "Not enough memory for a tree with %u leaves\n", leavesnum);
+    exit(1);
+  }
+  result.leaf = (char**)block;
+  result.branch = (uint64_t*)(result.leaf + leavesnum + 1);
+  memset(result.branch, 0, bitsize);
+  result.length = (float*)(result.branch + (size_t)result.words * branchnum);
+  result.leafindex = (unsigned*)(result.length + branchnum);
+  result.leaf[0] = (char*)(result.leafindex + hashsize(leavesnum));
+  result.leavesnum = leavesnum;
+  result.branchnum = branchnum;
   result.rooted = 0;
+  result.root = 0;
   result.phylogram = 0;
+  result.rootlocation = 1.0;
+  return result;
+} /* newtree */
+
+/****************************************************************
+* freetree: release a tree created by readbrackets() or subtree()
+*****************************************************************/
+void freetree(struct tree intree) {
+  free(intree.leaf);
+} /* freetree */
+
+/****************************************************************
+* quotedlabel: 1 if the quote text[i] opens a quoted label, that is
+*  it is the first symbol of the text but spaces or follows '(',
+*  ',' or ')'. A quote inside a name, as in O'Brien, is a usual
+*  symbol of the name.
+*****************************************************************/
+int quotedlabel(const char *text, size_t i) {
+  while ( i > 0 && isspace((unsigned char)text[i - 1]) ) i--;
+  return i == 0 || text[i - 1] == '(' || text[i - 1] == ',' || text[i - 1] == ')';
+} /* quotedlabel */
+
+/****************************************************************
+* skiplabel: for a quoted label or a comment starting at
+*  brackets[i] return the index of its closing ' or ], or of
+*  the terminating '\0'. A doubled quote inside a label ('')
+*  does not close it.
+*****************************************************************/
+static unsigned skiplabel(const char *brackets, unsigned i) {
+  char close = brackets[i] == '[' ? ']' : '\'';
+
+  for (;;) {
+    for ( i++; brackets[i] != close && brackets[i] != '\0'; i++ );
+    if ( close == ']' || brackets[i] == '\0' || brackets[i + 1] != '\'' ) return i;
+    i++;
+  }
+} /* skiplabel */
+
+/****************************************************************
+* copyname: copy a leaf name from brackets[start ... end - 1]
+*  to name and return the end of the copy. Spaces and comments
+*  are skipped, a quoted label is copied as it is with ''
+*  standing for one quote.
+*****************************************************************/
+static char *copyname(const char *brackets, size_t start, size_t end, char *name) {
+  size_t i;
+
+  for ( i = start; i < end; i++ ) {
+    if ( brackets[i] == '[' ) {
+      i = skiplabel(brackets, i);
+    }
+    else if ( brackets[i] == '\'' && quotedlabel(brackets, i) ) {
+      for ( i++; i < end; i++ ) {
+        if ( brackets[i] == '\'' ) {
+          if ( i + 1 < end && brackets[i + 1] == '\'' ) i++;
+          else break;
+        }
+        *name++ = brackets[i];
+      }
+    }
+    else if ( !isspace((unsigned char)brackets[i]) ) {
+      *name++ = brackets[i];
+    }
+  }
+  *name++ = '\0';
+  return name;
+} /* copyname */
+
+/* Result of one pass over a Newick string */
+struct newickscan {
+  unsigned leavesnum;
+  unsigned branchnum; /* the outermost bracket pair is not counted */
+  unsigned *first, *last; /* branch k contains leaves first[k] ... last[k] - 1 */
+  unsigned *parent; /* the branch containing branch k, branchnum is the outermost one */
+  float *length;
+  size_t *namestart, *nameend; /* leaf names in the string */
+  size_t namesize;
+  unsigned rooti, rootj; /* two complementary branches, or 0 and 0 */
+};
+
+/****************************************************************
+* scannewick: one pass over a Newick string. A cheap pre-scan
+*  counting commas and brackets bounds the numbers of leaves and
+*  branches. Then every branch is recorded as an interval of leaf
+*  indices (a clade is always a run of consecutive leaves in
+*  Newick order) together with the branch containing it.
+*  Quoted labels and comments in square brackets are skipped
+*  by all scans, so ',', ';' and brackets inside them are text.
+*****************************************************************/
+static void scannewick(char *brackets, struct newickscan *scan) {
+  char c;
+  char *end;
+  char flag;
+  double len;
+  unsigned i, j, k;
+  unsigned commas = 0, opens = 0, closes = 0;
+  unsigned maxleaves, maxbranches;
+  unsigned leavesnum = 0, branchnum = 0;
+  unsigned stacklen = 0, pendinglen = 0;
+  unsigned branchi = 0;
+  unsigned *first, *last, *parent;
+  unsigned *stack; /* first leaves of open branches */
+  unsigned *height; /* numbers of pending branches when they were opened */
+  unsigned *pending; /* closed branches whose parent is still open */
+  unsigned *prefix, *suffix; /* first branches with leaves 0 ... k - 1 and k ... leavesnum - 1 */
+  size_t *namestart, *nameend;
+  float *length;
+
+  /* pre-scan */
+  for ( i = 0; brackets[i] != ';' && brackets[i] != '\0'; i++ ) {
+    if ( (brackets[i] == '\'' && quotedlabel(brackets, i)) || brackets[i] == '[' ) {
+      i = skiplabel(brackets, i);
+      if ( brackets[i] == '\0' ) break;
+    }
+    else if ( brackets[i] == ',' ) commas++;
+    else if ( brackets[i] == '(' ) opens++;
+    else if ( brackets[i] == ')' ) closes++;
+  }
+  if ( brackets[i] == '\0' ) {
+    fprintf(stderr, "No \';\' at the end of Newick string!\n");
+    exit(1);
+  }
+  maxleaves = commas + 1;
+  maxbranches = maxleaves + closes;
+  first = (unsigned*)malloc(sizeof(unsigned) * (3 * maxbranches + 2 * opens + 1));
+  last = first + maxbranches;
+  parent = last + maxbranches;
+  stack = parent + maxbranches;
+  height = stack + opens;
+  pending = (unsigned*)malloc(sizeof(unsigned) * (maxbranches + 1));
+  namestart = (size_t*)malloc(sizeof(size_t) * 2 * maxleaves);
+  nameend = namestart + maxleaves;
+  length = (float*)malloc(sizeof(float) * maxbranches);
 
   i = 0;
   c = brackets[i];
   flag = 0;
-  while ( (c != ';') && (c != '\0') ) {
+  while ( c != ';' ) {
 
-    if ( c == ',' ) {
-      if ( flag == 2 && strlen(lenstr) > 0 ) { /* branch length is ready */
-        result.length[branchi] = atof(lenstr);
-      }
+    if ( c == '[' ) { /* comment */
+      i = skiplabel(brackets, i);
+    }
+
+    else if ( c == ',' ) {
+      if ( flag == 1 ) nameend[leavesnum - 1] = i;
       flag = 0; /* wait for a new leaf or new branch */
     }
 
@@ -66,38 +340,25 @@ struct tree readbrackets(char *brackets) {
         fprintf(stderr, "Wrong Newick format\n");
         exit(1);
       }
+      stack[stacklen] = leavesnum;
+      height[stacklen] = pendinglen;
       stacklen++;
-      if (stacklen > maxstacklen) {
-        maxstacklen = stacklen;
-        newbranchstack = (char**)realloc(newbranchstack, sizeof(char*) * maxstacklen);
-      }
-      stacki = stacklen - 1;
-      newbranchstack[stacki] = (char*)malloc(sizeof(char) * (result.leavesnum + 1));
-      for (k = 0; k < result.leavesnum; k++) {
-        newbranchstack[stacki][k] = 0;
-      }
     } /* if c == '(' */
 
     else if ( c == ')' ) { /* new branch is ready */
-      if ( flag == 2 && strlen(lenstr) > 0 ) { /* branch length is ready */
-        result.length[branchi] = atof(lenstr);
-      }
+      if ( flag == 1 ) nameend[leavesnum - 1] = i;
       flag = 3;
       if ( stacklen == 0 ) {
         fprintf(stderr, "Unbalanced brackets in Newick\n");
         exit(1);
       }
       stacklen--;
-      result.branchnum++;
-      branchi = result.branchnum - 1;
-      result.branch = (char**)realloc(result.branch, sizeof(char*) * result.branchnum);
-      result.branch[branchi] = (char*)malloc(sizeof(char) * result.leavesnum);
-      for (k = 0; k < result.leavesnum; k++) {
-        result.branch[branchi][k] = newbranchstack[stacklen][k];
-      } /* for */
-      free(newbranchstack[stacklen]);
-      result.length = (float*) realloc(result.length, sizeof(float) * result.branchnum);
-      result.length[branchi] = 1.0;
+      branchi = branchnum++;
+      first[branchi] = stack[stacklen];
+      last[branchi] = leavesnum;
+      length[branchi] = 1.0;
+      while ( pendinglen > height[stacklen] ) parent[pending[--pendinglen]] = branchi;
+      pending[pendinglen++] = branchi;
     }  /* if c == ')' */
 
     else if ( c == ':' ) {
@@ -105,117 +366,140 @@ struct tree readbrackets(char *brackets) {
         fprintf(stderr, "Wrong Newick format\n");
         exit(1);
       }
-      flag = 2; /* wait for a branch length */
-      strcpy(lenstr, "");
-    }
-
-    else if ( flag == 0 && !isspace(c) ) { /* regard c as the first symbol of a new leaf name */
-      result.leavesnum++;     /* new leaf */
-      result.branchnum++;     /* new trivial (one-leaf) branch */
-      leafi = result.leavesnum - 1; /* index of the current leaf */
-      branchi = result.branchnum - 1; /* index of the current branch */
-      result.leaf = (char **) realloc(result.leaf, sizeof(char *)*result.leavesnum);
-      result.leaf[leafi] = (char *) malloc(sizeof(char) * MAXNAME);  /* memory for the name of the current leaf */
-      result.leaf[leafi][0] = c;
-      result.leaf[leafi][1] = '\0';
-      
-      result.branch = (char**)realloc(result.branch, sizeof(char*) * result.branchnum);
-      result.length = (float*)realloc(result.length, sizeof(float) * result.branchnum);
-      result.branch[branchi] = (char*)malloc(sizeof(char) * result.leavesnum);
-      for (j = 0; j < branchi; j++) {
-        result.branch[j] = (char*)realloc(result.branch[j], sizeof(char) * result.leavesnum);
-        result.branch[j][leafi] = 0; /* increasing leaf array for all branches */
-      }
-      for ( k = 0; k < leafi; k++) {
-        result.branch[branchi][k] = 0; 
-      }
-      result.branch[branchi][leafi] = 1; /* new branch discriminate new leaf from all old leaves */
-      result.length = (float*)realloc (result.length, sizeof(float) * result.branchnum);
-      result.length[branchi] = 1.0; /* length is not read yet */
-
-      for (j = 0; j < stacklen; j++) {
-        newbranchstack[j] = (char*)realloc(newbranchstack[j], sizeof(char) * result.leavesnum);
-        newbranchstack[j][leafi] = 1;
+      if ( flag == 1 ) nameend[leavesnum - 1] = i;
+      flag = 2; /* in a branch length */
+      for ( j = i + 1; isspace((unsigned char)brackets[j]) || brackets[j] == '['; j++ ) {
+        if ( brackets[j] == '[' ) j = skiplabel(brackets, j); /* comment before the length */
+        if ( brackets[j] == '\0' ) break;
       }
+      len = strtod(brackets + j, &end);
+      if ( end > brackets + j ) length[branchi] = len;
+      i = j - 1;
+    }
 
+    else if ( flag == 0 && !isspace((unsigned char)c) ) { /* c is the first symbol of a new leaf name */
+      branchi = branchnum++;     /* new trivial (one-leaf) branch */
+      first[branchi] = leavesnum;
+      last[branchi] = leavesnum + 1;
+      length[branchi] = 1.0; /* length is not read yet */
+      pending[pendinglen++] = branchi;
+      namestart[leavesnum] = i;
+      nameend[leavesnum] = i + 1;
+      leavesnum++;
       flag = 1; /* in a leaf name */
-      nname = 1; /* name length */
+      if ( c == '\'' ) i = skiplabel(brackets, i);
     }  /* if c is the first symbol of new leaf name */
 
-    else if ( flag == 1 && !isspace(c) ) { /* continuation of leaf name */
-      nname++;
-      if (nname < MAXNAME) {
-        tmpstr[0] = c;
-        tmpstr[1] = '\0';
-        strcat (result.leaf[leafi], tmpstr);
-      } /* if */
-      else {
-        fprintf(stderr, "Warning: the name %s... is too long!\n", result.leaf[leafi]); 
-      }
-    } /* if c is a part of the name */
-
-    else if ( flag == 2 ) { /* branch length */
-      if ( c == '.' || isdigit(c) ) {
-        tmpstr[0] = c;
-        tmpstr[1] = '\0';
-        if (strlen(lenstr) + 2 < MAXNUMLEN) {
-          strcat(lenstr,tmpstr);
-        }
-        else {
-          fprintf(stderr, "Too long number: %s...!", lenstr);
-        }
-      } /* if c is a part of a number (is a digit or the decimal point) */
-    } /* if flag == 2 */
+    else if ( c == '\'' && quotedlabel(brackets, i) ) { /* quoted label elsewhere, e.g. of an inner node */
+      i = skiplabel(brackets, i);
+    }
 
     i++;
     c = brackets[i];
   } /* while */
-  if ( c == '\0' ) {
-    fprintf(stderr, "No \';\' at the end of Newick string!\n");
-    exit(1);
-  }
+  if ( flag == 1 ) nameend[leavesnum - 1] = i;
   if ( stacklen > 0 ) {
     fprintf(stderr, "Error: unbalanced brackets in Newick\n");
     exit(1);
   }
-
-  /* removing equal branches and the trivial branch */
-  s = 0;
-  i = result.branchnum - 1;
-  for (k = 0; k < result.leavesnum; k++) {
-    s += result.branch[i][k];
-  }
-  if (s == result.leavesnum) {
-    result.branchnum--;
-  }
-  else {
+  /* the last branch contains all leaves and is removed */
+  if ( branchnum == 0 || first[branchnum - 1] != 0 || last[branchnum - 1] != leavesnum ) {
     fprintf(stderr, "No outer bracket pair!\n");
     exit(1);
   }
-  rooti = 0;
-  rootj = 0;
-  for (i = 1; i < result.branchnum && rooti == 0; i++) {
-    for (j = 0; j < i && rooti == 0; j++) {
-      s = 0;
-      for (k = 0; k < result.leavesnum; k++) {
-        if ( result.branch[i][k] == result.branch[j][k] ) {
-          s++;
-        }
-      }
-      if (s == 0) { /* branches rooti and rootj are equal <=> coincide with the root */
-        rooti = i;
-        rootj = j;
-      }
+  branchnum--;
+  parent[branchnum] = branchnum + 1;
+
+  /* Looking for two complementary branches, they coincide with the root.
+     The complement of an interval is an interval only if it is a prefix
+     or a suffix of the leaf order (the empty branch is both), so it is
+     enough to remember the first branch for every prefix and suffix. */
+  prefix = (unsigned*)malloc(sizeof(unsigned) * 2 * (leavesnum + 1));
+  suffix = prefix + leavesnum + 1;
+  for ( k = 0; k <= leavesnum; k++ ) {
+    prefix[k] = suffix[k] = branchnum;
+  }
+  scan->rooti = 0;
+  scan->rootj = 0;
+  for ( i = 0; i < branchnum && scan->rooti == 0; i++ ) {
+    if ( first[i] == last[i] ) j = prefix[leavesnum]; /* empty branch */
+    else if ( first[i] == 0 ) j = suffix[last[i]];
+    else if ( last[i] == leavesnum ) j = prefix[first[i]];
+    else j = branchnum;
+    if ( j < branchnum ) { /* branches i and j are complementary */
+      scan->rooti = i;
+      scan->rootj = j;
+    }
+    if ( first[i] == last[i] ) {
+      if ( prefix[0] == branchnum ) prefix[0] = suffix[leavesnum] = i;
+    }
+    else {
+      if ( first[i] == 0 && prefix[last[i]] == branchnum ) prefix[last[i]] = i;
+      if ( last[i] == leavesnum && suffix[first[i]] == branchnum ) suffix[first[i]] = i;
     }
   }
+  free(prefix);
+  free(pending);
+
+  scan->leavesnum = leavesnum;
+  scan->branchnum = branchnum;
+  scan->first = first;
+  scan->last = last;
+  scan->parent = parent;
+  scan->length = length;
+  scan->namestart = namestart;
+  scan->nameend = nameend;
+  scan->namesize = 0;
+  for ( k = 0; k < leavesnum; k++ ) {
+    scan->namesize += nameend[k] - namestart[k] + 1;
+  }
+} /* scannewick */
+
+static void freescan(struct newickscan *scan) {
+  free(scan->first);
+  free(scan->namestart);
+  free(scan->length);
+} /* freescan */
+
+/****************************************************************
+* readbrackets: converting a string with Newick to a rooted tree,
+*  the whole tree is put into one block made by newtree()
+*****************************************************************/
+struct tree readbrackets(char *brackets) {
+  struct tree result;
+  struct newickscan scan;
+  unsigned j, k, rooti, rootj;
+  uint64_t *bits;
+  char *name;
+
+  scannewick(brackets, &scan);
+  result = newtree(scan.leavesnum, scan.branchnum, scan.namesize);
+  name = result.leaf[0];
+  for ( k = 0; k < scan.leavesnum; k++ ) {
+    result.leaf[k] = name;
+    name = copyname(brackets, scan.namestart[k], scan.nameend[k], name);
+  }
+  indexleaves(&result);
+  for ( j = 0; j < scan.branchnum; j++ ) { /* leaves first[j] ... last[j] - 1 are inside */
+    bits = BRANCHROW(result, j);
+    for ( k = scan.first[j]; k < scan.last[j] && k % 64 != 0; k++ ) bits[k / 64] |= (uint64_t)1 << (k % 64);
+    for ( ; k + 64 <= scan.last[j]; k += 64 ) bits[k / 64] = ~(uint64_t)0;
+    for ( ; k < scan.last[j]; k++ ) bits[k / 64] |= (uint64_t)1 << (k % 64);
+    result.length[j] = scan.length[j];
+  }
+  rooti = scan.rooti;
+  rootj = scan.rootj;
+  freescan(&scan);
+
   if (rooti != 0) { /* the root was found */
     result.rooted = 1;
     result.root = rooti;
     result.length[rooti] += result.length[rootj];
     result.rootlocation = result.length[rootj];
     result.branchnum--;
+    memmove(BRANCHROW(result, rootj), BRANCHROW(result, rootj + 1),
+            sizeof(uint64_t) * result.words * (result.branchnum - rootj));
     for (j = rootj; j < result.branchnum; j++) { /* elimination of the branch rootj */
-      result.branch[j] = result.branch[j + 1];
       result.length[j] = result.length[j + 1];
       if ( result.root == j + 1 ) result.root = j;
     }
@@ -224,6 +508,147 @@ struct tree readbrackets(char *brackets) {
   return result;
 } /* readbrackets */
 
+/****************************************************************
+* readskeleton: converting a string with Newick to a skeleton,
+*  a tree without the branch bitsets, in O(n) memory. Branches
+*  are nodes as in readbrackets(), the root is node branchnum.
+*  As readbrackets() removes one of the two branches at the
+*  root, this branch gets weight 0 and gives its length to the
+*  other one.
+*****************************************************************/
+struct skeleton readskeleton(char *brackets) {
+  struct skeleton result;
+  struct newickscan scan;
+  unsigned j, k, n;
+  char *name;
+
+  scannewick(brackets, &scan);
+  n = scan.branchnum + 1;
+  result.leavesnum = scan.leavesnum;
+  result.nodesnum = n;
+  result.root = n - 1;
+  result.names = newtree(scan.leavesnum, 0, scan.namesize);
+  name = result.names.leaf[0];
+  for ( k = 0; k < scan.leavesnum; k++ ) {
+    result.names.leaf[k] = name;
+    name = copyname(brackets, scan.namestart[k], scan.nameend[k], name);
+  }
+  indexleaves(&result.names);
+
+  result.parent = (unsigned*)malloc(sizeof(unsigned) * (2 * n + scan.leavesnum + 1));
+  result.weight = result.parent + n;
+  result.leafnode = result.weight + n;
+  result.length = (float*)malloc(sizeof(float) * n);
+  for ( j = 0; j < n; j++ ) {
+    result.parent[j] = scan.parent[j];
+    result.weight[j] = 1;
+    result.length[j] = j < scan.branchnum ? scan.length[j] : 0.0;
+  }
+  /* a leaf's own branch is the first one-leaf branch made for it,
+     others are brackets around it */
+  for ( j = scan.branchnum; j > 0; j-- ) {
+    if ( scan.last[j - 1] == scan.first[j - 1] + 1 ) result.leafnode[scan.first[j - 1]] = j - 1;
+  }
+  result.weight[n - 1] = 0;
+  result.length[n - 1] = 0.0;
+  if ( scan.rooti != 0 ) {
+    result.length[scan.rooti] += result.length[scan.rootj];
+    result.length[scan.rootj] = 0.0;
+    result.weight[scan.rootj] = 0;
+  }
+  freescan(&scan);
+  return result;
+} /* readskeleton */
+
+/****************************************************************
+* treeskeleton: the skeleton of a tree given by its branch bitsets.
+*  Branches are clades, so the parent of a branch is the smallest
+*  branch containing it; equal branches are put one above another.
+*  Leaves are extra nodes of weight 0 below the smallest branch
+*  containing them, the root is node branchnum, and the path
+*  between two leaves has the weight of the branches separating
+*  them.
+*****************************************************************/
+struct skeleton treeskeleton(struct tree intree) {
+  struct skeleton result;
+  unsigned b, n, i, k, s, r, w, running, tmp;
+  unsigned *size, *start, *sorted, *top;
+  size_t namesize = 0;
+  uint64_t *bits, word;
+  char *name;
+
+  b = intree.branchnum;
+  n = intree.leavesnum;
+  result.leavesnum = n;
+  result.nodesnum = b + 1 + n;
+  result.root = b;
+  for ( k = 0; k < n; k++ ) namesize += strlen(intree.leaf[k]) + 1;
+  result.names = newtree(n, 0, namesize);
+  name = result.names.leaf[0];
+  for ( k = 0; k < n; k++ ) {
+    result.names.leaf[k] = name;
+    strcpy(name, intree.leaf[k]);
+    name += strlen(name) + 1;
+  }
+  indexleaves(&result.names);
+  result.parent = (unsigned*)malloc(sizeof(unsigned) * (2 * result.nodesnum + n));
+  result.weight = result.parent + result.nodesnum;
+  result.leafnode = result.weight + result.nodesnum;
+  result.length = (float*)malloc(sizeof(float) * result.nodesnum);
+
+  /* branches sorted by size, the smallest first */
+  size = (unsigned*)calloc(b + 1, sizeof(unsigned));
+  start = (unsigned*)calloc(n + 2, sizeof(unsigned));
+  sorted = (unsigned*)malloc(sizeof(unsigned) * (b + 1));
+  top = (unsigned*)malloc(sizeof(unsigned) * (n + 1));
+  for ( i = 0; i < b; i++ ) {
+    bits = BRANCHROW(intree, i);
+    for ( w = 0; w < intree.words; w++ ) size[i] += popcount64(bits[w]);
+    start[size[i]]++;
+  }
+  running = 0;
+  for ( s = 0; s <= n; s++ ) {
+    tmp = start[s];
+    start[s] = running;
+    running += tmp;
+  }
+  for ( i = 0; i < b; i++ ) sorted[start[size[i]]++] = i;
+
+  for ( i = 0; i < result.nodesnum; i++ ) {
+    result.parent[i] = b;
+    result.weight[i] = i < b ? 1 : 0;
+    result.length[i] = i < b ? intree.length[i] : 0.0;
+  }
+  result.parent[b] = result.nodesnum;
+  for ( k = 0; k < n; k++ ) {
+    result.leafnode[k] = b + 1 + k;
+    top[k] = b + 1 + k;
+  }
+  /* top[k] is the biggest node with leaf k so far */
+  for ( i = 0; i < b; i++ ) {
+    r = sorted[i];
+    bits = BRANCHROW(intree, r);
+    for ( w = 0; w < intree.words; w++ ) {
+      for ( word = bits[w]; word != 0; word &= word - 1 ) { /* leaves of the branch */
+        k = 64 * w + lowbit64(word);
+        result.parent[top[k]] = r;
+        top[k] = r;
+      }
+    }
+  }
+  free(size);
+  free(start);
+  free(sorted);
+  free(top);
+  return result;
+} /* treeskeleton */
+
+void freeskeleton(struct skeleton inskeleton) {
+  freetree(inskeleton.names);
+  free(inskeleton.parent);
+  free(inskeleton.length);
+} /* freeskeleton */
+
 /*******************************************************************
 * combdistance: the number of branches (the combinatorial distance)
 * between two leaves of a tree 
@@ -235,7 +660,7 @@ unsigned combdistance(struct tree intree, unsigned leaf1, unsigned leaf2) {
   if ( leaf1 < intree.leavesnum && leaf2 < intree.leavesnum ) {
     result = 0;
     for ( j = 0; j < intree.branchnum; j++ ) {
-      if ( intree.branch[j][leaf1] != intree.branch[j][leaf2] ) {
+      if ( HASBIT(BRANCHROW(intree, j), leaf1) != HASBIT(BRANCHROW(intree, j), leaf2) ) {
         result++;
       }
     }
@@ -248,6 +673,259 @@ unsigned combdistance(struct tree intree, unsigned leaf1, unsigned leaf2) {
   return result;
 } /* combdistance */
 
+/* Skeleton of a tree renumbered in preorder, for distancesfrom() */
+struct preorder {
+  unsigned nodesnum;
+  unsigned *parent; /* parent[v] < v, node 0 is the root */
+  unsigned *weight;
+  unsigned *leafnode;
+  unsigned *mark; /* nodes on the path from the last source to the root */
+  unsigned *dist; /* distances from the last source */
+  unsigned maxdepth; /* the weight of the heaviest path from the root */
+};
+
+static struct preorder makepreorder(struct tree intree) {
+  struct preorder result;
+  struct skeleton s;
+  unsigned n, v, c, top, pos;
+  unsigned *childstart, *child, *next, *stack, *label;
+
+  s = treeskeleton(intree);
+  n = s.nodesnum;
+  result.nodesnum = n;
+  result.parent = (unsigned*)malloc(sizeof(unsigned) * (4 * n + s.leavesnum));
+  result.weight = result.parent + n;
+  result.mark = result.weight + n;
+  result.dist = result.mark + n;
+  result.leafnode = result.dist + n;
+
+  childstart = (unsigned*)calloc(n + 2, sizeof(unsigned));
+  child = (unsigned*)malloc(sizeof(unsigned) * 4 * n);
+  next = child + n;
+  stack = next + n;
+  label = stack + n;
+  for ( v = 0; v < n; v++ ) {
+    if ( v != s.root ) childstart[s.parent[v] + 2]++;
+  }
+  for ( v = 0; v < n; v++ ) childstart[v + 2] += childstart[v + 1];
+  for ( v = 0; v < n; v++ ) {
+    if ( v != s.root ) child[childstart[s.parent[v] + 1]++] = v;
+  }
+  for ( v = 0; v < n; v++ ) next[v] = childstart[v];
+
+  /* depth-first numbering without recursion */
+  stack[0] = s.root;
+  top = 0;
+  label[s.root] = 0;
+  result.parent[0] = n;
+  result.weight[0] = 0;
+  result.mark[0] = 0;
+  result.dist[0] = 0; /* depth while numbering */
+  result.maxdepth = 0;
+  pos = 1;
+  for (;;) {
+    v = stack[top];
+    if ( next[v] < childstart[v + 1] ) {
+      c = child[next[v]++];
+      label[c] = pos;
+      result.parent[pos] = label[v];
+      result.weight[pos] = s.weight[c];
+      result.mark[pos] = 0;
+      result.dist[pos] = result.dist[label[v]] + s.weight[c];
+      if ( result.dist[pos] > result.maxdepth ) result.maxdepth = result.dist[pos];
+      pos++;
+      stack[++top] = c;
+    }
+    else if ( top > 0 ) top--;
+    else break;
+  }
+  for ( v = 0; v < s.leavesnum; v++ ) result.leafnode[v] = label[s.leafnode[v]];
+  free(childstart);
+  free(child);
+  freeskeleton(s);
+  return result;
+} /* makepreorder */
+
+/****************************************************************
+* distancesfrom: combinatorial distances from a leaf to all nodes
+*  in t->dist. The path to the root is walked up, then every other
+*  node gets the distance of its parent plus its weight in one
+*  pass over the array. stamp must differ from the previous calls
+*  and from 0.
+*****************************************************************/
+static void distancesfrom(struct preorder *t, unsigned leaf, unsigned stamp) {
+  unsigned v, d = 0;
+
+  for ( v = t->leafnode[leaf]; v != 0; v = t->parent[v] ) {
+    t->dist[v] = d;
+    t->mark[v] = stamp;
+    d += t->weight[v];
+  }
+  t->dist[0] = d;
+  for ( v = 1; v < t->nodesnum; v++ ) {
+    if ( t->mark[v] != stamp ) t->dist[v] = t->dist[t->parent[v]] + t->weight[v];
+  }
+} /* distancesfrom */
+
+/****************************************************************
+* rowdiff: sum of absolute (p = 1) or squared (p = 2) differences
+*  of two rows; simple loops, so that the compiler vectorises them
+*****************************************************************/
+static unsigned long long rowdiff(const uint16_t *row1, const uint16_t *row2, unsigned len, char p) {
+  unsigned long long result = 0;
+  unsigned k;
+  int diff;
+
+  if ( p == 1 ) {
+    for ( k = 0; k < len; k++ ) {
+      diff = (int)row1[k] - (int)row2[k];
+      result += (unsigned)(diff < 0 ? -diff : diff);
+    }
+  }
+  else {
+    for ( k = 0; k < len; k++ ) {
+      diff = (int)row1[k] - (int)row2[k];
+      result += (uint32_t)diff * (uint32_t)diff; /* up to 65534^2, too big for int */
+    }
+  }
+  return result;
+} /* rowdiff */
+
+/* Rows of treedist2() shared by threads, see pathdiffs() */
+struct pathjob {
+  struct preorder *t1, *t2;
+  unsigned *corresp;
+  unsigned *node1, *node2; /* nodes of leaves in the leaf order of tree 1 */
+  unsigned n;
+  unsigned pieces;
+  unsigned long long *sum1, *sum2; /* sums by pieces for L1 and L2, or NULL */
+};
+
+/****************************************************************
+* pathpiece: rows a = piece, piece + pieces, ... of pathdiffs();
+*  every piece has its own arrays of distances. For every leaf a
+*  its distances to leaves b > a are computed in both trees by
+*  distancesfrom() and put into uint16 rows in the leaf order of
+*  tree 1. Trees so deep that a distance does not fit into 16 bits
+*  are compared from the full distance arrays.
+*****************************************************************/
+static void pathpiece(void *arg, unsigned piece) {
+  struct pathjob *job = (struct pathjob*)arg;
+  struct preorder t1, t2;
+  uint16_t *row1, *row2;
+  unsigned n, a, b;
+  unsigned long long result1 = 0, result2 = 0;
+  long long diff;
+
+  n = job->n;
+  t1 = *job->t1;
+  t2 = *job->t2;
+  t1.mark = (unsigned*)calloc(2 * (t1.nodesnum + t2.nodesnum), sizeof(unsigned));
+  t1.dist = t1.mark + t1.nodesnum;
+  t2.mark = t1.dist + t1.nodesnum;
+  t2.dist = t2.mark + t2.nodesnum;
+  row1 = (uint16_t*)malloc(sizeof(uint16_t) * 2 * n);
+  row2 = row1 + n;
+  for ( a = piece; a + 1 < n; a += job->pieces ) {
+    distancesfrom(&t1, a, a + 1);
+    distancesfrom(&t2, job->corresp[a], a + 1);
+    if ( t1.maxdepth <= 32767 && t2.maxdepth <= 32767 ) {
+      for ( b = a + 1; b < n; b++ ) {
+        row1[b] = t1.dist[job->node1[b]];
+        row2[b] = t2.dist[job->node2[b]];
+      }
+      if ( job->sum1 != NULL ) result1 += rowdiff(row1 + a + 1, row2 + a + 1, n - a - 1, 1);
+      if ( job->sum2 != NULL ) result2 += rowdiff(row1 + a + 1, row2 + a + 1, n - a - 1, 2);
+    }
+    else {
+      for ( b = a + 1; b < n; b++ ) {
+        diff = (long long)t1.dist[job->node1[b]] - t2.dist[job->node2[b]];
+        result1 += diff < 0 ? -diff : diff;
+        result2 += diff * diff;
+      }
+    }
+  }
+  if ( job->sum1 != NULL ) job->sum1[piece] = result1;
+  if ( job->sum2 != NULL ) job->sum2[piece] = result2;
+  free(t1.mark);
+  free(row1);
+} /* pathpiece */
+
+/****************************************************************
+* pathdiffs: the sums of treedist2() for p = 1 into *sum1 and
+*  for p = 2 into *sum2 in O(n^2) time and O(n) memory per thread.
+*  Either pointer may be NULL; if both are given, the distances
+*  are found once for both sums. The trees must have the same
+*  leaves, leaf i of tree 1 being leaf corresp[i] of tree 2.
+*****************************************************************/
+void pathdiffs(struct tree intree1, struct tree intree2, unsigned *corresp, long *sum1, long *sum2) {
+  struct preorder t1, t2;
+  struct pathjob job;
+  unsigned n, b, k;
+  unsigned long long result1 = 0, result2 = 0;
+  unsigned long long *sums;
+
+  n = intree1.leavesnum;
+  if ( n < 2 ) {
+    if ( sum1 != NULL ) *sum1 = 0;
+    if ( sum2 != NULL ) *sum2 = 0;
+    return;
+  }
+  t1 = makepreorder(intree1);
+  t2 = makepreorder(intree2);
+  job.t1 = &t1;
+  job.t2 = &t2;
+  job.corresp = corresp;
+  job.n = n;
+  job.pieces = piecesnum(n);
+  job.node1 = (unsigned*)malloc(sizeof(unsigned) * 2 * n);
+  job.node2 = job.node1 + n;
+  sums = (unsigned long long*)malloc(sizeof(unsigned long long) * 2 * job.pieces);
+  job.sum1 = sum1 != NULL ? sums : NULL;
+  job.sum2 = sum2 != NULL ? sums + job.pieces : NULL;
+  for ( b = 0; b < n; b++ ) {
+    job.node1[b] = t1.leafnode[b];
+    job.node2[b] = t2.leafnode[corresp[b]];
+  }
+  runparallel(threadsnum, job.pieces, pathpiece, &job);
+  for ( k = 0; k < job.pieces; k++ ) {
+    if ( sum1 != NULL ) result1 += job.sum1[k];
+    if ( sum2 != NULL ) result2 += job.sum2[k];
+  }
+  if ( sum1 != NULL ) *sum1 = (long)result1;
+  if ( sum2 != NULL ) *sum2 = (long)result2;
+  free(job.node1);
+  free(sums);
+  free(t1.parent);
+  free(t2.parent);
+} /* pathdiffs */
+
+/****************************************************************
+* leafpaths: combinatorial distances between all leaves of a tree
+*  into the n x n matrix path, leaf i of the tree being row and
+*  column order[i] (order may be NULL for the same leaf order).
+*  Returns 0 on success, 1 if the distances do not fit in 16 bits.
+*****************************************************************/
+int leafpaths(struct tree intree, unsigned *order, uint16_t *path) {
+  struct preorder t;
+  unsigned n, a, b;
+
+  n = intree.leavesnum;
+  t = makepreorder(intree);
+  if ( 2 * t.maxdepth > 65535 ) {
+    free(t.parent);
+    return 1;
+  }
+  for ( a = 0; a < n; a++ ) {
+    distancesfrom(&t, a, a + 1);
+    for ( b = 0; b < n; b++ ) {
+      path[(size_t)(order ? order[a] : a) * n + (order ? order[b] : b)] = (uint16_t)t.dist[t.leafnode[b]];
+    }
+  }
+  free(t.parent);
+  return 0;
+} /* leafpaths */
+
 /*************************************************************
 *  treedist2 returns the sum of square differences, if p is 2,
 *  and the sum of absulute differences, if p is 1, 
@@ -257,21 +935,19 @@ long treedist2 (struct tree intree1, struct tree intree2, char p) {
   long result = -1;
   unsigned *corresp;
   unsigned cd1, cd2, diff;
-  unsigned i, j;
+  unsigned i;
   unsigned a, b;
-  char flag;
 
   if (intree1.leavesnum == intree2.leavesnum) {
     corresp = (unsigned*)malloc(sizeof(unsigned) * intree1.leavesnum);
     for ( i = 0; i < intree1.leavesnum; i++ ) {
-      flag = 1;
-      for ( j = 0; j < intree2.leavesnum && flag; j++ ) {
-        if ( strcmp(intree2.leaf[j], intree1.leaf[i]) == 0 ) {
-          flag = 0;
-          corresp[i] = j;
-        }
-      }
-      if ( flag ) return -1;
+      corresp[i] = findleaf(intree2, intree1.leaf[i]);
+      if ( corresp[i] == intree2.leavesnum ) return -1;
+    }
+    if ( !naivealgorithms && intree1.leavesnum > 1 ) {
+      pathdiffs(intree1, intree2, corresp, p == 1 ? &result : NULL, p == 1 ? NULL : &result);
+      free(corresp);
+      return result;
     }
     result = 0;
     for ( a = 0; a < intree1.leavesnum - 1; a++ )
@@ -294,7 +970,8 @@ long treedist2 (struct tree intree1, struct tree intree2, char p) {
 ********************************************************************************/
 char whichsplittree(unsigned a, unsigned b, unsigned c, unsigned d, struct tree intree) {
   char result = 0;
-  unsigned i;
+  unsigned i, ina, inb, inc, ind;
+  const uint64_t *bits;
 
   if ( a >= intree.leavesnum ) {
     fprintf(stderr, "whichsplittree: a is out of range");
@@ -314,19 +991,18 @@ char whichsplittree(unsigned a, unsigned b, unsigned c, unsigned d, struct tree
   }
 
   for ( i = 0; i < intree.branchnum && result == 0; i++ ) {
-    if ( intree.branch[i][a] == intree.branch[i][b] 
-      && intree.branch[i][a] != intree.branch[i][c] 
-      && intree.branch[i][c] == intree.branch[i][d] ) {
+    bits = BRANCHROW(intree, i);
+    ina = HASBIT(bits, a);
+    inb = HASBIT(bits, b);
+    inc = HASBIT(bits, c);
+    ind = HASBIT(bits, d);
+    if ( ina == inb && ina != inc && inc == ind ) {
       result = 2;
     }
-    else if ( intree.branch[i][a] == intree.branch[i][c] 
-           && intree.branch[i][a] != intree.branch[i][b] 
-           && intree.branch[i][b] == intree.branch[i][d] ) {
+    else if ( ina == inc && ina != inb && inb == ind ) {
       result = 3;
     }
-    else if ( intree.branch[i][a] == intree.branch[i][d] 
-           && intree.branch[i][a] != intree.branch[i][b] 
-           && intree.branch[i][b] == intree.branch[i][c] ) {
+    else if ( ina == ind && ina != inb && inb == inc ) {
       result = 4;
     }
   }
@@ -335,39 +1011,17 @@ char whichsplittree(unsigned a, unsigned b, unsigned c, unsigned d, struct tree
 } /* whichsplittree */
 
 /*************************************************
-*  treedist4 returns the number of common fourths  
+*  treedist4 returns the number of common fourths,
+*  i.e. quartets resolved by both trees in the same
+*  way or by neither of them
 **************************************************/
 long treedist4 (struct tree intree1, struct tree intree2) {
   long result;
-  unsigned *corresp;
-  unsigned i, j;
-  unsigned a, b, c, d;
-  char flag;
+  struct quartets counts;
 
   if ( (intree1.leavesnum == intree2.leavesnum) && (intree1.leavesnum > 3) ) {
-    corresp = (unsigned*)malloc(sizeof(unsigned) * intree1.leavesnum);
-    for ( i = 0; i < intree1.leavesnum; i++ ) {
-      flag = 1;
-      for ( j = 0; j < intree2.leavesnum && flag; j++ ) {
-        if ( strcmp(intree2.leaf[j], intree1.leaf[i]) == 0 ) {
-          flag = 0;
-          corresp[i] = j;
-        }
-      }
-      if ( flag ) {
-        fprintf(stderr, "Warning: no leaf with name \"%s\" in tree #2\n", intree1.leaf[i]);
-        return -1;
-      }
-    }
-    result = 0;
-    for ( a = 0; a < intree1.leavesnum - 3; a++ )
-    for ( b = a + 1; b < intree1.leavesnum - 2; b++ )
-    for ( c = b + 1; c < intree1.leavesnum - 1; c++ )
-    for ( d = c + 1; d < intree1.leavesnum; d++ ) { /* for all 4-ths of species */
-      if ( whichsplittree(a, b, c, d, intree1) 
-           == whichsplittree(corresp[a], corresp[b], corresp[c],  corresp[d], intree2) ) 
-        result++;
-    } /* for all 4-ths */
+    if ( quartetcounts(intree1, intree2, &counts) ) return -1;
+    result = counts.same + counts.unresolved;
   } /* if */
   else {
     if (intree1.leavesnum <= 3) result = 0;
@@ -376,6 +1030,550 @@ long treedist4 (struct tree intree1, struct tree intree2) {
   return result;
 } /* treedist4 */
 
+/* the quartet distance of trees of n > 3 leaves with number common fourths, see treedist4() */
+double quartetdistance(long long number, unsigned n) {
+  return 1.0 - (float)((double)number * 24)/(float)((double)n * (n - 1) * (n - 2) * (n - 3));
+} /* quartetdistance */
+
+/****************************************************************
+* maketopology: the tree given by its splits as nested clades.
+*  Every split is taken from the side without leaf 0; equal and
+*  trivial splits are skipped. Node 0 is the node next to leaf 0
+*  and holds all other leaves, a parent has a smaller index than
+*  its children. Leaves are put in an order where every clade is
+*  a run of consecutive leaves.
+*****************************************************************/
+struct topology maketopology(struct splits *insplits) {
+  struct topology result;
+  unsigned n, m, i, v, w, x, s, running, tmp;
+  unsigned *clade, *start, *top, *cursor;
+  uint64_t *bits, word;
+
+  n = insplits->leavesnum;
+  indexsplits(insplits);
+
+  /* distinct nontrivial splits sorted by size, the biggest first */
+  start = (unsigned*)calloc(n + 1, sizeof(unsigned));
+  clade = (unsigned*)malloc(sizeof(unsigned) * (insplits->branchnum + 1));
+  for ( i = 0; i < insplits->branchnum; i++ ) {
+    s = insplits->size[i];
+    if ( s >= 2 && s + 2 <= n && findsplit(insplits, insplits, i) == i ) start[s]++;
+  }
+  running = 0;
+  for ( s = n + 1; s > 0; s-- ) {
+    tmp = start[s - 1];
+    start[s - 1] = running;
+    running += tmp;
+  }
+  m = running;
+  for ( i = 0; i < insplits->branchnum; i++ ) {
+    s = insplits->size[i];
+    if ( s >= 2 && s + 2 <= n && findsplit(insplits, insplits, i) == i ) clade[start[s]++] = i;
+  }
+  free(start);
+
+  result.leavesnum = n;
+  result.nodesnum = m + 1;
+  result.parent = (unsigned*)malloc(sizeof(unsigned) * (6 * m + 6 + 3 * n));
+  result.size = result.parent + m + 1;
+  result.first = result.size + m + 1;
+  result.leafchildren = result.first + m + 1;
+  result.childstart = result.leafchildren + m + 1;
+  result.child = result.childstart + m + 2;
+  result.leafparent = result.child + m;
+  result.order = result.leafparent + n;
+  result.position = result.order + n;
+  top = (unsigned*)calloc(n + 1, sizeof(unsigned));
+  cursor = (unsigned*)malloc(sizeof(unsigned) * (m + 1));
+
+  result.parent[0] = m + 1;
+  result.size[0] = n - 1;
+  for ( v = 1; v <= m; v++ ) {
+    result.parent[v] = 0;
+    result.size[v] = insplits->size[clade[v - 1]];
+  }
+  for ( x = 0; x < n; x++ ) result.leafparent[x] = 0;
+
+  /* from small clades to big ones, top[x] is the biggest clade with leaf x so far */
+  for ( v = m; v >= 1; v-- ) {
+    bits = insplits->bits + (size_t)clade[v - 1] * insplits->words;
+    for ( w = 0; w < insplits->words; w++ ) {
+      for ( word = bits[w]; word; word &= word - 1 ) {
+        x = 64 * w + lowbit64(word);
+        if ( top[x] ) result.parent[top[x]] = v;
+        else result.leafparent[x] = v;
+        top[x] = v;
+      }
+    }
+  }
+
+  /* children lists and the leaf order */
+  memset(result.leafchildren, 0, sizeof(unsigned) * (m + 1));
+  memset(result.childstart, 0, sizeof(unsigned) * (m + 2));
+  for ( v = 1; v <= m; v++ ) result.childstart[result.parent[v] + 1]++;
+  for ( v = 0; v <= m; v++ ) result.childstart[v + 1] += result.childstart[v];
+  for ( v = 0; v <= m; v++ ) cursor[v] = result.childstart[v];
+  for ( v = 1; v <= m; v++ ) result.child[cursor[result.parent[v]]++] = v;
+  result.first[0] = 0;
+  cursor[0] = 0;
+  for ( v = 1; v <= m; v++ ) {
+    result.first[v] = cursor[result.parent[v]];
+    cursor[result.parent[v]] += result.size[v];
+    cursor[v] = result.first[v];
+  }
+  for ( x = 1; x < n; x++ ) {
+    v = result.leafparent[x];
+    result.leafchildren[v]++;
+    result.order[cursor[v]++] = x;
+  }
+  result.order[n - 1] = 0;
+  for ( i = 0; i < n; i++ ) result.position[result.order[i]] = i;
+
+  free(top);
+  free(cursor);
+  free(clade);
+  return result;
+} /* maketopology */
+
+void freetopology(struct topology intopology) {
+  free(intopology.parent);
+} /* freetopology */
+
+static long long choose2(long long k) {
+  return k * (k - 1) / 2;
+} /* choose2 */
+
+/* all quartets of n leaves; 4 * C(n, 4) passes LLONG_MAX near 86k leaves, C(n, 4) near 121k */
+static long long allquartets(long long n) {
+  return (long long)((__int128)n * (n - 1) * (n - 2) * (n - 3) / 24);
+} /* allquartets */
+
+/****************************************************************
+* resolvedquartets: the number of quartets resolved by a tree.
+*  A quartet ab|cd is counted at the node where the path between
+*  a and b meets the rest: a and b are in two different subtrees
+*  of the node, c and d are in a third one. Every quartet is
+*  counted from both sides, so the sum is kept in 128 bits.
+*****************************************************************/
+static long long resolvedquartets(struct topology *t) {
+  long long n, sumsq, up, xs;
+  __int128 twice = 0;
+  unsigned v, c;
+
+  n = t->leavesnum;
+  for ( v = 0; v < t->nodesnum; v++ ) {
+    up = n - t->size[v];
+    sumsq = t->leafchildren[v] + up * up;
+    for ( c = t->childstart[v]; c < t->childstart[v + 1]; c++ ) {
+      xs = t->size[t->child[c]];
+      sumsq += xs * xs;
+    }
+    for ( c = t->childstart[v]; c <= t->childstart[v + 1]; c++ ) {
+      xs = c < t->childstart[v + 1] ? t->size[t->child[c]] : up;
+      if ( xs < 2 ) continue;
+      twice += (__int128)(((n - xs) * (n - xs) - (sumsq - xs * xs)) / 2) * choose2(xs);
+    }
+  }
+  return (long long)(twice / 2);
+} /* resolvedquartets */
+
+/* Nodes of tree 1 shared by threads, see sharedquartets() */
+struct quartetjob {
+  struct topology *t1, *t2;
+  unsigned kmax1, kmax2; /* maximal numbers of subtrees around a node */
+  unsigned pieces;
+  __int128 *twice, *fourtimes; /* sums by pieces, up to 4 C(n, 4) */
+};
+
+/****************************************************************
+* quartetpiece: nodes u = piece, piece + pieces, ... of tree 1
+*  for sharedquartets(), with their own M and other arrays
+*****************************************************************/
+static void quartetpiece(void *arg, unsigned piece) {
+  struct quartetjob *job = (struct quartetjob*)arg;
+  struct topology *t1 = job->t1, *t2 = job->t2;
+  __int128 twice = 0, fourtimes = 0;
+  long long n, m, tt, a, b, pairs, g, h, kr, kfull;
+  long long *M, *W, *rowsz, *colsz, *aq, *hq, *ccol, *sqcol, *bp, *gp, *crow, *sqrow, call;
+  unsigned *label, *cnt;
+  unsigned k1, k2, kmax1, kmax2, u, u2, v, c, i, j, p, q, x, pos, none;
+
+  n = t1->leavesnum;
+  kmax1 = job->kmax1;
+  kmax2 = job->kmax2;
+  M = (long long*)malloc(sizeof(long long) * (kmax1 * kmax2 + kmax1 * kmax1 + 6 * kmax1 + 6 * kmax2));
+  W = M + kmax1 * kmax2;
+  rowsz = W + kmax1 * kmax1;
+  bp = rowsz + kmax1;
+  gp = bp + kmax1;
+  crow = gp + kmax1;
+  sqrow = crow + kmax1;
+  colsz = sqrow + kmax1;
+  aq = colsz + kmax2;
+  hq = aq + kmax2;
+  ccol = hq + kmax2;
+  sqcol = ccol + kmax2;
+  label = (unsigned*)malloc(sizeof(unsigned) * n);
+  cnt = (unsigned*)malloc(sizeof(unsigned) * t2->nodesnum * kmax1);
+
+  for ( u = piece; u < t1->nodesnum; u += job->pieces ) {
+    /* rows: subtrees of more than one leaf around u, labels of their leaves */
+    k1 = t1->childstart[u + 1] - t1->childstart[u];
+    none = kmax1;
+    for ( pos = 0; pos < n; pos++ ) label[t1->order[pos]] = none;
+    for ( i = 0; i < k1; i++ ) {
+      c = t1->child[t1->childstart[u] + i];
+      rowsz[i] = t1->size[c];
+      for ( pos = t1->first[c]; pos < t1->first[c] + t1->size[c]; pos++ ) label[t1->order[pos]] = i;
+    }
+    if ( n - t1->size[u] >= 2 ) { /* the subtree above u */
+      rowsz[k1] = n - t1->size[u];
+      for ( pos = 0; pos < t1->first[u]; pos++ ) label[t1->order[pos]] = k1;
+      for ( pos = t1->first[u] + t1->size[u]; pos < n; pos++ ) label[t1->order[pos]] = k1;
+      k1++;
+    }
+
+    /* cnt[v * k1 + i]: common leaves of clade v of tree 2 and row i */
+    memset(cnt, 0, sizeof(unsigned) * t2->nodesnum * k1);
+    for ( x = 1; x < n; x++ ) {
+      if ( label[x] != none ) cnt[t2->leafparent[x] * k1 + label[x]]++;
+    }
+    for ( v = t2->nodesnum - 1; v > 0; v-- ) {
+      for ( i = 0; i < k1; i++ ) cnt[t2->parent[v] * k1 + i] += cnt[v * k1 + i];
+    }
+
+    for ( u2 = 0; u2 < t2->nodesnum; u2++ ) {
+      k2 = t2->childstart[u2 + 1] - t2->childstart[u2];
+      for ( j = 0; j < k2; j++ ) {
+        c = t2->child[t2->childstart[u2] + j];
+        colsz[j] = t2->size[c];
+        for ( i = 0; i < k1; i++ ) M[i * kmax2 + j] = cnt[c * k1 + i];
+      }
+      if ( n - t2->size[u2] >= 2 ) {
+        colsz[k2] = n - t2->size[u2];
+        for ( i = 0; i < k1; i++ ) M[i * kmax2 + k2] = rowsz[i] - cnt[u2 * k1 + i];
+        k2++;
+      }
+
+      /* sums over rows and columns */
+      call = 0;
+      for ( i = 0; i < k1; i++ ) bp[i] = gp[i] = crow[i] = sqrow[i] = 0;
+      for ( j = 0; j < k2; j++ ) aq[j] = hq[j] = ccol[j] = sqcol[j] = 0;
+      for ( i = 0; i < k1; i++ ) {
+        for ( j = 0; j < k2; j++ ) {
+          m = M[i * kmax2 + j];
+          aq[j] += choose2(rowsz[i] - m);
+          hq[j] += m * (rowsz[i] - m);
+          ccol[j] += choose2(m);
+          sqcol[j] += m * m;
+          bp[i] += choose2(colsz[j] - m);
+          gp[i] += m * (colsz[j] - m);
+          crow[i] += choose2(m);
+          sqrow[i] += m * m;
+          call += choose2(m);
+        }
+      }
+      for ( i = 0; i < k1; i++ ) {
+        for ( p = 0; p < k1; p++ ) {
+          W[i * kmax1 + p] = 0;
+          for ( j = 0; j < k2; j++ ) W[i * kmax1 + p] += M[i * kmax2 + j] * M[p * kmax2 + j];
+        }
+      }
+
+      for ( p = 0; p < k1; p++ ) {
+        for ( q = 0; q < k2; q++ ) {
+          m = M[p * kmax2 + q];
+          if ( m == 0 ) continue;
+          tt = n - rowsz[p] - colsz[q] + m; /* leaves out of both subtrees */
+          if ( m >= 2 ) {
+            pairs = choose2(tt) - (aq[q] - choose2(rowsz[p] - m)) - (bp[p] - choose2(colsz[q] - m))
+                    + (call - crow[p] - ccol[q] + choose2(m));
+            twice += (__int128)pairs * choose2(m);
+          }
+          a = colsz[q] - m;
+          b = rowsz[p] - m;
+          g = gp[p] - m * (colsz[q] - m);
+          h = hq[q] - m * (rowsz[p] - m);
+          kfull = 0;
+          for ( i = 0; i < k1; i++ ) kfull += M[i * kmax2 + q] * W[i * kmax1 + p];
+          kr = kfull - m * sqrow[p] - m * sqcol[q] + m * m * m;
+          fourtimes += (__int128)m * (a * b * tt - a * g - b * h + kr);
+        }
+      }
+    } /* for u2 */
+  } /* for u */
+
+  free(M);
+  free(label);
+  free(cnt);
+  job->twice[piece] = twice;
+  job->fourtimes[piece] = fourtimes;
+} /* quartetpiece */
+
+/****************************************************************
+* sharedquartets: the numbers of quartets resolved by both trees
+*  in the same way (*same) and in different ways (*different).
+*  For a node u of tree 1 and a node u2 of tree 2, M[i][j] is
+*  the number of common leaves of subtree i around u and subtree
+*  j around u2. A quartet ab|cd resolved by both trees is counted
+*  by the pair (u, u2) and subtrees p, q holding c and d, as
+*  in resolvedquartets(), that is twice; a quartet resolved as
+*  ab|cd and ac|bd, four times. Subtrees of one leaf are left
+*  out of M as they add nothing but the total numbers of leaves.
+*  O(n^2 d) for the maximal degree d of a node. Nodes u are
+*  shared by threadsnum threads; the counts are integers, so
+*  they do not depend on the threads. The sums reach 4 C(n, 4)
+*  and are kept in 128 bits.
+*****************************************************************/
+static void sharedquartets(struct topology *t1, struct topology *t2, 
+                           long long *same, long long *different) {
+  struct quartetjob job;
+  __int128 twice = 0, fourtimes = 0;
+  unsigned u, k;
+
+  job.t1 = t1;
+  job.t2 = t2;
+  job.kmax1 = 1;
+  job.kmax2 = 1;
+  for ( u = 0; u < t1->nodesnum; u++ ) {
+    if ( t1->childstart[u + 1] - t1->childstart[u] + 1 > job.kmax1 ) job.kmax1 = t1->childstart[u + 1] - t1->childstart[u] + 1;
+  }
+  for ( u = 0; u < t2->nodesnum; u++ ) {
+    if ( t2->childstart[u + 1] - t2->childstart[u] + 1 > job.kmax2 ) job.kmax2 = t2->childstart[u + 1] - t2->childstart[u] + 1;
+  }
+  job.pieces = piecesnum(t1->nodesnum);
+  job.twice = (__int128*)malloc(sizeof(__int128) * 2 * job.pieces);
+  job.fourtimes = job.twice + job.pieces;
+  runparallel(threadsnum, job.pieces, quartetpiece, &job);
+  for ( k = 0; k < job.pieces; k++ ) {
+    twice += job.twice[k];
+    fourtimes += job.fourtimes[k];
+  }
+  free(job.twice);
+  *same = (long long)(twice / 2);
+  *different = (long long)(fourtimes / 4);
+} /* sharedquartets */
+
+/****************************************************************
+* quartetcounts: classify all quartets of leaves of two trees
+*  with the same leaves, return 1 if the leaves differ. With
+*  naivealgorithms set, or with repeated leaf names, every
+*  quartet is checked by whichsplittree().
+*****************************************************************/
+int quartetcounts(struct tree intree1, struct tree intree2, struct quartets *counts) {
+  unsigned *corresp;
+  char *used;
+  unsigned i, n;
+  unsigned a, b, c, d;
+  char w1, w2, repeated = 0;
+  struct splits splits1, splits2;
+
+  memset(counts, 0, sizeof(struct quartets));
+  n = intree1.leavesnum;
+  if ( n != intree2.leavesnum ) return 1;
+  corresp = (unsigned*)malloc(sizeof(unsigned) * (n + 1));
+  used = (char*)calloc(n + 1, 1);
+  for ( i = 0; i < n; i++ ) {
+    corresp[i] = findleaf(intree2, intree1.leaf[i]);
+    if ( corresp[i] == n ) {
+      fprintf(stderr, "Warning: no leaf with name \"%s\" in tree #2\n", intree1.leaf[i]);
+      free(corresp);
+      free(used);
+      return 1;
+    }
+    if ( used[corresp[i]] ) repeated = 1;
+    used[corresp[i]] = 1;
+  }
+  free(used);
+  if ( n < 4 ) {
+    free(corresp);
+    return 0;
+  }
+  counts->total = allquartets(n);
+
+  if ( naivealgorithms || repeated ) {
+    for ( a = 0; a < n - 3; a++ )
+    for ( b = a + 1; b < n - 2; b++ )
+    for ( c = b + 1; c < n - 1; c++ )
+    for ( d = c + 1; d < n; d++ ) { /* for all 4-ths of species */
+      w1 = whichsplittree(a, b, c, d, intree1);
+      w2 = whichsplittree(corresp[a], corresp[b], corresp[c], corresp[d], intree2);
+      if ( w1 && w2 ) {
+        if ( w1 == w2 ) counts->same++;
+        else counts->different++;
+      }
+      else if ( w1 ) counts->only1++;
+      else if ( w2 ) counts->only2++;
+      else counts->unresolved++;
+    } /* for all 4-ths */
+    free(corresp);
+    return 0;
+  }
+
+  splits1 = makesplits(intree1, NULL, n);
+  splits2 = makesplits(intree2, corresp, n);
+  splitquartets(&splits1, &splits2, counts);
+  freesplits(splits1);
+  freesplits(splits2);
+  free(corresp);
+  return 0;
+} /* quartetcounts */
+
+/****************************************************************
+* splitquartets: quartetcounts() for the splits of two trees made
+*  with the same leaf order, the leaves of the trees being unique
+*****************************************************************/
+void splitquartets(struct splits *splits1, struct splits *splits2, struct quartets *counts) {
+  struct topology t1, t2;
+  long long r1, r2;
+  unsigned n;
+
+  memset(counts, 0, sizeof(struct quartets));
+  n = splits1->leavesnum;
+  if ( n < 4 ) return;
+  counts->total = allquartets(n);
+  t1 = maketopology(splits1);
+  t2 = maketopology(splits2);
+  r1 = resolvedquartets(&t1);
+  r2 = resolvedquartets(&t2);
+  sharedquartets(&t1, &t2, &counts->same, &counts->different);
+  counts->only1 = r1 - counts->same - counts->different;
+  counts->only2 = r2 - counts->same - counts->different;
+  counts->unresolved = counts->total - r1 - r2 + counts->same + counts->different;
+  freetopology(t1);
+  freetopology(t2);
+} /* splitquartets */
+
+/****************************************************************
+* makesplits: the branches of a tree as splits.
+*  Bit k of a split is the side of leaf leaforder[k] (of leaf k,
+*  if leaforder is NULL), k < leavesnum, so the leaves of two trees
+*  can be put into the same order once; without a new order the
+*  branch is copied word by word. Every split is turned so that
+*  bit 0 is zero, then equal splits have equal words.
+*****************************************************************/
+struct splits makesplits(struct tree intree, unsigned *leaforder, unsigned leavesnum) {
+  struct splits result;
+  unsigned i, k, w;
+  uint64_t *bits;
+  uint64_t last;
+  const uint64_t *row;
+
+  result.leavesnum = leavesnum;
+  result.branchnum = intree.branchnum;
+  result.words = (leavesnum + 63) / 64;
+  result.bits = (uint64_t*)calloc((size_t)result.words * intree.branchnum + 1, sizeof(uint64_t));
+  result.size = (unsigned*)malloc(sizeof(unsigned) * (intree.branchnum + 1));
+  result.hash = (uint64_t*)malloc(sizeof(uint64_t) * (intree.branchnum + 1));
+  result.table = NULL;
+  if ( result.bits == NULL || result.size == NULL || result.hash == NULL ) {
+    fprintf(stderr, "Not enough memory for splits of %u leaves\n", leavesnum);
+    exit(1);
+  }
+  last = leavesnum % 64 ? ((uint64_t)1 << (leavesnum % 64)) - 1 : ~(uint64_t)0;
+
+  for ( i = 0; i < intree.branchnum; i++ ) {
+    row = BRANCHROW(intree, i);
+    bits = result.bits + (size_t)i * result.words;
+    if ( leaforder == NULL && leavesnum == intree.leavesnum ) memcpy(bits, row, sizeof(uint64_t) * result.words);
+    else {
+      for ( k = 0; k < leavesnum; k++ ) {
+        if ( HASBIT(row, leaforder ? leaforder[k] : k) ) bits[k / 64] |= (uint64_t)1 << (k % 64);
+      }
+    }
+    if ( leavesnum > 0 && (bits[0] & 1) ) {
+      for ( w = 0; w < result.words; w++ ) bits[w] = ~bits[w];
+      bits[result.words - 1] &= last;
+    }
+    result.size[i] = 0;
+    for ( w = 0; w < result.words; w++ ) result.size[i] += popcount64(bits[w]);
+    result.hash[i] = hashsplit(bits, result.words);
+  }
+  return result;
+} /* makesplits */
+
+void freesplits(struct splits insplits) {
+  free(insplits.bits);
+  free(insplits.size);
+  free(insplits.hash);
+  free(insplits.table);
+} /* freesplits */
+
+/****************************************************************
+* indexsplits: fill the hash table of splits, used by findsplit().
+*  Splits do not change after makesplits(), so a table is made
+*  once, and indexed splits can be shared by threads.
+*****************************************************************/
+void indexsplits(struct splits *insplits) {
+  unsigned mask, h, i;
+
+  if ( insplits->table != NULL ) return;
+  insplits->tablesize = hashsize(insplits->branchnum);
+  mask = insplits->tablesize - 1;
+  insplits->table = (unsigned*)malloc(sizeof(unsigned) * insplits->tablesize);
+  for ( h = 0; h <= mask; h++ ) {
+    insplits->table[h] = insplits->branchnum;
+  }
+  for ( i = 0; i < insplits->branchnum; i++ ) {
+    h = insplits->hash[i] & mask;
+    while ( insplits->table[h] < insplits->branchnum ) h = (h + 1) & mask;
+    insplits->table[h] = i;
+  }
+} /* indexsplits */
+
+/****************************************************************
+* findsplit: the first split of insplits equal to split i
+*  of another, or insplits->branchnum if there is no such split.
+*  Hashes are checked by comparing the splits themselves.
+*****************************************************************/
+unsigned findsplit(struct splits *insplits, struct splits *other, unsigned i) {
+  unsigned mask, h, j, words;
+  uint64_t *bits;
+
+  words = insplits->words;
+  bits = other->bits + (size_t)i * words;
+  mask = insplits->tablesize - 1;
+  h = other->hash[i] & mask;
+  while ( (j = insplits->table[h]) < insplits->branchnum ) {
+    if ( insplits->hash[j] == other->hash[i] && insplits->size[j] == other->size[i]
+         && memcmp(bits, insplits->bits + (size_t)j * words, sizeof(uint64_t) * words) == 0 ) return j;
+    h = (h + 1) & mask;
+  }
+  return insplits->branchnum;
+} /* findsplit */
+
+/****************************************************************
+* commonsplits: the number of splits of splits1 which
+*  are present in splits2, both made with the same leaf order.
+*  Splits of splits1 are looked up in the hash table of splits2,
+*  or compared with all splits of splits2 if naivealgorithms is set.
+*****************************************************************/
+unsigned commonsplits(struct splits *splits1, struct splits *splits2) {
+  unsigned common = 0;
+  unsigned i, j, words;
+  uint64_t *bits1;
+
+  if ( !naivealgorithms ) {
+    indexsplits(splits2);
+    for ( i = 0; i < splits1->branchnum; i++ ) {
+      if ( findsplit(splits2, splits1, i) < splits2->branchnum ) common++;
+    }
+    return common;
+  }
+  words = splits1->words;
+  for ( i = 0; i < splits1->branchnum; i++ ) {
+    bits1 = splits1->bits + (size_t)i * words;
+    for ( j = 0; j < splits2->branchnum; j++ ) {
+      if ( splits1->size[i] == splits2->size[j] 
+           && memcmp(bits1, splits2->bits + (size_t)j * words, sizeof(uint64_t) * words) == 0 ) {
+        common++;
+        break;
+      }
+    }
+  }
+  return common;
+} /* commonsplits */
+
 /****************************************************************
 *  branchdist returns the number of different branches (splits)  
 *****************************************************************/
@@ -383,48 +1581,25 @@ unsigned branchdist (struct tree tree1, struct tree tree2) {
   unsigned result;
   unsigned common = 0;
   unsigned *corresp;
-  unsigned i, j, k;
-  char flag, iflag;
+  unsigned i;
+  struct splits splits1, splits2;
 
   if ( tree1.leavesnum == tree2.leavesnum ) {
     corresp = (unsigned*)malloc(sizeof(unsigned) * tree1.leavesnum);
     for ( i = 0; i < tree1.leavesnum; i++ ) {
-      flag = 1;
-      for ( j = 0; j < tree1.leavesnum && flag; j++ ) {
-        if ( strcmp(tree1.leaf[i], tree2.leaf[j]) == 0 ) {
-          flag = 0;
-          corresp[i] = j;
-        }
-      }
-      if ( flag ) {
+      corresp[i] = findleaf(tree2, tree1.leaf[i]);
+      if ( corresp[i] == tree2.leavesnum ) {
         fprintf(stderr, "The leaf %s has no correspondence in the tree 2\n", 
                 tree1.leaf[i]);
         return tree1.branchnum + tree2.branchnum - tree1.leavesnum - tree2.leavesnum;
       }
     }
  
-    for ( i = 0; i < tree1.branchnum; i++ ) {
-      iflag = 0;
-      for ( j = 0; j < tree2.branchnum && (!iflag); j++ ) {
-        flag = 0;
-        for ( k = 0; k < tree1.leavesnum && flag == 0; k++ ) {
-          if ( tree1.branch[i][k] != tree2.branch[j][corresp[k]] ) {
-            flag = 1; /* branches are either different or of opposite orientation */
-          }
-        }
-        if (flag == 1) { /* equal branches mean opposite orientation = completely different values of .branch[i][k] */
-          for ( k = 0; k < tree1.leavesnum && flag == 1; k++ ) {
-            if ( tree1.branch[i][k] == tree2.branch[j][corresp[k]] ) {
-              flag = 2; /* branches are definetely different */
-            }
-          }
-        }
-        if ( flag < 2 ) { /* i and j are equal branches */
-          common++;
-          iflag = 1;
-        }
-      }
-    }
+    splits1 = makesplits(tree1, NULL, tree1.leavesnum);
+    splits2 = makesplits(tree2, corresp, tree1.leavesnum);
+    common = commonsplits(&splits1, &splits2);
+    freesplits(splits1);
+    freesplits(splits2);
     free(corresp);
     result = tree1.branchnum + tree2.branchnum - 2 * common; 
   } /* if */
@@ -442,48 +1617,25 @@ unsigned branchdist_n (struct tree tree1, struct tree tree2) {
   unsigned result;
   unsigned common = 0;
   unsigned *corresp;
-  unsigned i, j, k, n;
-  char flag, iflag;
+  unsigned i, n;
+  struct splits splits1, splits2;
 
   if ( tree1.leavesnum == tree2.leavesnum ) {
     corresp = (unsigned*)malloc(sizeof(unsigned) * tree1.leavesnum);
     for ( i = 0; i < tree1.leavesnum; i++ ) {
-      flag = 1;
-      for ( j = 0; j < tree1.leavesnum && flag; j++ ) {
-        if ( strcmp(tree1.leaf[i], tree2.leaf[j]) == 0 ) {
-          flag = 0;
-          corresp[i] = j;
-        }
-      }
-      if ( flag ) {
+      corresp[i] = findleaf(tree2, tree1.leaf[i]);
+      if ( corresp[i] == tree2.leavesnum ) {
         fprintf(stderr, "The leaf %s has no correspondence in the tree 2\n", 
                 tree1.leaf[i]);
         return tree1.branchnum + tree2.branchnum - tree1.leavesnum - tree2.leavesnum;
       }
     }
  
-    for ( i = 0; i < tree1.branchnum; i++ ) {
-      iflag = 0;
-      for ( j = 0; j < tree2.branchnum && (!iflag); j++ ) {
-        flag = 0;
-        for ( k = 0; k < tree1.leavesnum && flag == 0; k++ ) {
-          if ( tree1.branch[i][k] != tree2.branch[j][corresp[k]] ) {
-            flag = 1; /* branches are either different or of opposite orientation */
-          }
-        }
-        if (flag == 1) { /* equal branches mean opposite orientation = completely different values of .branch[i][k] */
-          for ( k = 0; k < tree1.leavesnum && flag == 1; k++ ) {
-            if ( tree1.branch[i][k] == tree2.branch[j][corresp[k]] ) {
-              flag = 2; /* branches are definetely different */
-            }
-          }
-        }
-        if ( flag < 2 ) { /* i and j are equal branches */
-          common++;
-          iflag = 1;
-        }
-      }
-    }
+    splits1 = makesplits(tree1, NULL, tree1.leavesnum);
+    splits2 = makesplits(tree2, corresp, tree1.leavesnum);
+    common = commonsplits(&splits1, &splits2);
+    freesplits(splits1);
+    freesplits(splits2);
     free(corresp);
     if(tree1.branchnum < tree2.branchnum) n = tree1.branchnum; else n = tree2.branchnum;
     result = n - common; 
@@ -493,9 +1645,457 @@ unsigned branchdist_n (struct tree tree1, struct tree tree2) {
   return result;
 } /* branchdist_n */
 
+/****************************************************************
+* andcount: the number of common 1 bits of two bitsets of words
+*  64-bit words. The kernel is chosen by chooseandcount() for the
+*  processor the program runs on before main() starts, so threads
+*  only read the pointer; all of them give the same counts.
+*****************************************************************/
+static unsigned andcountscalar(const uint64_t *a, const uint64_t *b, unsigned words) {
+  unsigned result = 0, w;
+
+  for ( w = 0; w < words; w++ ) result += popcount64(a[w] & b[w]);
+  return result;
+} /* andcountscalar */
+
+#ifdef X86KERNELS
+__attribute__((target("popcnt")))
+static unsigned andcountpopcnt(const uint64_t *a, const uint64_t *b, unsigned words) {
+  unsigned result = 0, w;
+
+  for ( w = 0; w < words; w++ ) result += __builtin_popcountll(a[w] & b[w]);
+  return result;
+} /* andcountpopcnt */
+
+/* popcount of 4 words at once by a table of nibbles (Mula's method) */
+__attribute__((target("avx2,popcnt")))
+static unsigned andcountavx2(const uint64_t *a, const uint64_t *b, unsigned words) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i sum = _mm256_setzero_si256();
+  __m256i v, count;
+  uint64_t lanes[4];
+  unsigned result, w;
+
+  for ( w = 0; w + 4 <= words; w += 4 ) {
+    v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(a + w)),
+                         _mm256_loadu_si256((const __m256i*)(b + w)));
+    count = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+                            _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(count, _mm256_setzero_si256()));
+  }
+  _mm256_storeu_si256((__m256i*)lanes, sum);
+  result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for ( ; w < words; w++ ) result += __builtin_popcountll(a[w] & b[w]);
+  return result;
+} /* andcountavx2 */
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static unsigned andcountavx512(const uint64_t *a, const uint64_t *b, unsigned words) {
+  __m512i sum = _mm512_setzero_si512();
+  __mmask8 mask;
+  unsigned w;
+
+  for ( w = 0; w < words; w += 8 ) {
+    mask = words - w >= 8 ? 0xff : (__mmask8)((1u << (words - w)) - 1);
+    sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_and_si512(_mm512_maskz_loadu_epi64(mask, a + w),
+                                                                     _mm512_maskz_loadu_epi64(mask, b + w))));
+  }
+  return (unsigned)_mm512_reduce_add_epi64(sum);
+} /* andcountavx512 */
+#endif
+
+static unsigned (*andcount)(const uint64_t *a, const uint64_t *b, unsigned words) = andcountscalar;
+
+#ifdef X86KERNELS
+/* the kernels the processor supports, the best last */
+static unsigned x86kernels(unsigned (**kernel)(const uint64_t*, const uint64_t*, unsigned), const char **name) {
+  unsigned count = 0;
+
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("popcnt") ) {
+    kernel[count] = andcountpopcnt;
+    name[count++] = "popcnt";
+  }
+  if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") ) {
+    kernel[count] = andcountavx2;
+    name[count++] = "AVX2";
+  }
+  if ( __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq") ) {
+    kernel[count] = andcountavx512;
+    name[count++] = "AVX-512";
+  }
+  return count;
+} /* x86kernels */
+
+__attribute__((constructor))
+static void chooseandcount(void) {
+  unsigned (*kernel[3])(const uint64_t*, const uint64_t*, unsigned);
+  const char *name[3];
+  unsigned count;
+
+  count = x86kernels(kernel, name);
+  if ( count > 0 ) andcount = kernel[count - 1];
+} /* chooseandcount */
+#endif
+
+/****************************************************************
+* andbits: the number of common 1 bits of two bitsets by the
+*  kernel of andcount()
+*****************************************************************/
+unsigned andbits(const uint64_t *a, const uint64_t *b, unsigned words) {
+  return andcount(a, b, words);
+} /* andbits */
+
+/****************************************************************
+* checkandcount: every kernel of andcount() the processor supports
+*  is compared with the portable one on random bitsets of 0 to 300
+*  words, at all offsets of a 64-byte line. Returns 0 if all counts
+*  are equal, otherwise prints the first difference and returns 1.
+*****************************************************************/
+int checkandcount(void) {
+  unsigned (*kernel[3])(const uint64_t*, const uint64_t*, unsigned);
+  const char *name[3];
+  uint64_t *a, *b, x = 88172645463325252ULL;
+  unsigned count = 0, k, words, shift, w, expected, found;
+
+#ifdef X86KERNELS
+  count = x86kernels(kernel, name);
+#endif
+  a = (uint64_t*)malloc(sizeof(uint64_t) * 2 * (300 + 8));
+  b = a + 300 + 8;
+  for ( words = 0; words <= 300; words++ ) {
+    for ( shift = 0; shift < 8; shift++ ) {
+      for ( w = 0; w < words; w++ ) { /* xorshift, sparse and dense words alike */
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        a[shift + w] = x;
+        b[shift + w] = w % 3 == 0 ? x >> (w % 64) : ~x;
+      }
+      expected = andcountscalar(a + shift, b + shift, words);
+      for ( k = 0; k < count; k++ ) {
+        found = kernel[k](a + shift, b + shift, words);
+        if ( found != expected ) {
+          fprintf(stderr, "The %s kernel counts %u common bits of %u words, %u in fact\n",
+                  name[k], found, words, expected);
+          free(a);
+          return 1;
+        }
+      }
+    }
+  }
+  free(a);
+  return 0;
+} /* checkandcount */
+
+/****************************************************************
+* jaccardbound: an upper bound of jaccardsplits() for splits with
+*  a and c leaves on the 1 side (both not 0) out of n. An
+*  intersection is not bigger than the smaller set and a union is
+*  not smaller than the bigger one; rounding of float division is
+*  monotonic, so the bound holds for the computed values too.
+*****************************************************************/
+static float jaccardbound(unsigned a, unsigned c, unsigned n) {
+  float ub00, ub01, ub10, ub11;
+
+  ub11 = a < c ? ((float)a)/c : ((float)c)/a;
+  ub00 = n - a < n - c ? ((float)(n - a))/(n - c) : ((float)(n - c))/(n - a);
+  ub01 = n - a < c ? ((float)(n - a))/c : ((float)c)/(n - a);
+  ub10 = a < n - c ? ((float)a)/(n - c) : ((float)(n - c))/a;
+  return ffmaxf(ffminf(ub00, ub11), ffminf(ub01, ub10));
+} /* jaccardbound */
+
+/* Growing array of numbers */
+struct hits {
+  unsigned *item;
+  size_t num;
+  size_t size;
+};
+
+static void addhit(struct hits *list, unsigned item) {
+  if ( list->num == list->size ) {
+    list->size = list->size ? 2 * list->size : 1024;
+    list->item = (unsigned*)realloc(list->item, sizeof(unsigned) * list->size);
+  }
+  list->item[list->num++] = item;
+} /* addhit */
+
+/* Splits of one tree grouped by size */
+struct sizegroups {
+  unsigned *start; /* splits of size c are split[start[c] ... start[c + 1] - 1] */
+  unsigned *split;
+  unsigned *sizes; /* sizes present, increasing */
+  unsigned sizesnum;
+};
+
+static struct sizegroups groupsizes(struct splits *insplits) {
+  struct sizegroups result;
+  unsigned n, c, k;
+
+  n = insplits->leavesnum;
+  result.start = (unsigned*)calloc(n + 2, sizeof(unsigned));
+  result.split = (unsigned*)malloc(sizeof(unsigned) * (insplits->branchnum + n + 1));
+  result.sizes = result.split + insplits->branchnum;
+  for ( k = 0; k < insplits->branchnum; k++ ) result.start[insplits->size[k] + 2]++;
+  result.sizesnum = 0;
+  for ( c = 0; c < n; c++ ) {
+    if ( result.start[c + 2] > 0 ) result.sizes[result.sizesnum++] = c;
+    result.start[c + 2] += result.start[c + 1];
+  }
+  for ( k = 0; k < insplits->branchnum; k++ ) result.split[result.start[insplits->size[k] + 1]++] = k;
+  return result;
+} /* groupsizes */
+
+/****************************************************************
+* samesplits: for every split the next equal split of the same
+*  set, or branchnum; the splits must be indexed
+*****************************************************************/
+static unsigned *samesplits(struct splits *insplits) {
+  unsigned *next, *last;
+  unsigned b, k, first;
+
+  b = insplits->branchnum;
+  next = (unsigned*)malloc(sizeof(unsigned) * 2 * (b + 1));
+  last = next + b;
+  for ( k = 0; k < b; k++ ) {
+    next[k] = b;
+    last[k] = k;
+  }
+  for ( k = 0; k < b; k++ ) {
+    first = findsplit(insplits, insplits, k);
+    if ( first < k ) {
+      next[last[first]] = k;
+      last[first] = k;
+    }
+  }
+  return next;
+} /* samesplits */
+
+/* A group of splits and the bound of their Jaccard measure */
+struct sizebound {
+  float bound;
+  unsigned size;
+};
+
+static int comparebounds(const void *x, const void *y) {
+  const struct sizebound *a = (const struct sizebound*)x, *b = (const struct sizebound*)y;
+
+  if ( a->bound != b->bound ) return a->bound > b->bound ? -1 : 1;
+  return a->size < b->size ? -1 : (a->size > b->size);
+} /* comparebounds */
+
+static int compareunsigned(const void *x, const void *y) {
+  unsigned a = *(const unsigned*)x, b = *(const unsigned*)y;
+
+  return a < b ? -1 : (a > b);
+} /* compareunsigned */
+
+/****************************************************************
+* sweephits: the best hits of split k among the splits of the
+*  other tree, that is all splits with the maximal Jaccard measure,
+*  appended to list in the order they are met. k is a split of
+*  splits2 if column is 1, of splits1 otherwise. The groups of
+*  other splits are visited by decreasing jaccardbound() until
+*  the bound is less than the best measure found. Returns the
+*  maximal measure.
+*****************************************************************/
+static float sweephits(struct splits *splits1, struct splits *splits2, unsigned k, char column,
+                       struct sizegroups *groups, struct sizebound *order, struct hits *list) {
+  unsigned n, a, c, g, t, other;
+  size_t first;
+  float best = 0.0, curr;
+
+  n = splits1->leavesnum;
+  a = column ? splits2->size[k] : splits1->size[k];
+  for ( g = 0; g < groups->sizesnum; g++ ) {
+    c = groups->sizes[g];
+    order[g].size = c;
+    if ( a == 0 || c == 0 ) order[g].bound = 1.0; /* no bound for empty splits */
+    else order[g].bound = column ? jaccardbound(c, a, n) : jaccardbound(a, c, n);
+  }
+  qsort(order, groups->sizesnum, sizeof(struct sizebound), comparebounds);
+  first = list->num;
+  for ( g = 0; g < groups->sizesnum && order[g].bound >= best; g++ ) {
+    c = order[g].size;
+    for ( t = groups->start[c]; t < groups->start[c + 1]; t++ ) {
+      other = groups->split[t];
+      if ( column ) curr = jaccardsplits(splits1, other, splits2, k);
+      else curr = jaccardsplits(splits1, k, splits2, other);
+      if ( curr > best ) {
+        best = curr;
+        list->num = first;
+      }
+      if ( curr == best ) addhit(list, other);
+    }
+  }
+  return best;
+} /* sweephits */
+
+/* Best hits of rows or columns found by threads, see alignhits() */
+struct alignjob {
+  struct splits *splits1, *splits2;
+  unsigned *next; /* samesplits() of the other tree */
+  struct sizegroups *groups; /* splits of the other tree by size */
+  char column; /* 1 for splits of tree 2 */
+  unsigned pieces;
+  float *best; /* the maximal measures */
+  unsigned *start; /* starts of hits of every split in its piece */
+  struct hits *piecehits;
+};
+
+/****************************************************************
+* alignpiece: the best hits of a range of splits of one tree.
+*  A split equal to a split of the other tree has the measure 1
+*  with it and with its copies only; the hits of any other split
+*  are found by sweephits(). Hits of a column are put in the
+*  increasing order.
+*****************************************************************/
+static void alignpiece(void *arg, unsigned piece) {
+  struct alignjob *job = (struct alignjob*)arg;
+  struct splits *own, *other;
+  struct hits *list;
+  struct sizebound *order;
+  unsigned count, k, first, h;
+
+  own = job->column ? job->splits2 : job->splits1;
+  other = job->column ? job->splits1 : job->splits2;
+  count = own->branchnum;
+  list = job->piecehits + piece;
+  order = (struct sizebound*)malloc(sizeof(struct sizebound) * (own->leavesnum + 1));
+  for ( k = (unsigned)((unsigned long long)count * piece / job->pieces);
+        k < (unsigned long long)count * (piece + 1) / job->pieces; k++ ) {
+    first = list->num;
+    job->start[k] = first;
+    h = own->size[k] > 0 ? findsplit(other, own, k) : other->branchnum;
+    if ( h < other->branchnum ) {
+      job->best[k] = 1.0;
+      for ( ; h < other->branchnum; h = job->next[h] ) addhit(list, h);
+    }
+    else {
+      job->best[k] = sweephits(job->splits1, job->splits2, k, job->column, job->groups, order, list);
+      if ( job->column ) qsort(list->item + first, list->num - first, sizeof(unsigned), compareunsigned);
+    }
+  }
+  free(order);
+} /* alignpiece */
+
+/****************************************************************
+* besthits: the best hits of all splits of one tree (of tree 2
+*  if column is 1), in one array with starts of every split,
+*  made by pieces on threadsnum threads
+*****************************************************************/
+static struct hits besthits(struct alignjob *job, char column, unsigned *next,
+                            struct sizegroups *groups, float *best, unsigned *start) {
+  struct hits result = {NULL, 0, 0};
+  unsigned count, k, piece, to;
+  size_t offset;
+
+  count = column ? job->splits2->branchnum : job->splits1->branchnum;
+  job->column = column;
+  job->next = next;
+  job->groups = groups;
+  job->best = best;
+  job->start = start;
+  job->pieces = piecesnum(count);
+  job->piecehits = (struct hits*)calloc(job->pieces, sizeof(struct hits));
+  runparallel(threadsnum, job->pieces, alignpiece, job);
+  if ( job->pieces == 1 ) {
+    result = job->piecehits[0];
+  }
+  else {
+    for ( piece = 0; piece < job->pieces; piece++ ) result.num += job->piecehits[piece].num;
+    result.size = result.num;
+    result.item = (unsigned*)malloc(sizeof(unsigned) * (result.size + 1));
+    offset = 0;
+    k = 0;
+    for ( piece = 0; piece < job->pieces; piece++ ) {
+      to = (unsigned)((unsigned long long)count * (piece + 1) / job->pieces);
+      for ( ; k < to; k++ ) start[k] += offset;
+      memcpy(result.item + offset, job->piecehits[piece].item, sizeof(unsigned) * job->piecehits[piece].num);
+      offset += job->piecehits[piece].num;
+      free(job->piecehits[piece].item);
+    }
+  }
+  start[count] = result.num;
+  free(job->piecehits);
+  return result;
+} /* besthits */
+
+/****************************************************************
+* alignhits: the sum of Jaccard measures for all BBH of two sets
+*  of splits, the same as aligndist() finds by scoring all pairs.
+*  A split equal to a split of the other tree has the measure 1
+*  with it and with its copies only. The best hits of any other
+*  split are found by sweephits(), which does not score pairs
+*  whose bound is below the best measure, so for similar trees
+*  few pairs are scored at all. Splits are shared by threads, and
+*  the sum is taken in one thread in the same order always.
+*****************************************************************/
+float alignhits(struct splits *splits1, struct splits *splits2) {
+  unsigned b1, b2, i, j, k, m;
+  float *rowbest, *colbest;
+  float common;
+  unsigned *rowstart, *colstart, *next1, *next2;
+  struct hits rowhits, colhits;
+  struct sizegroups groups1, groups2;
+  struct alignjob job;
+  char *chosen, found;
+
+  b1 = splits1->branchnum;
+  b2 = splits2->branchnum;
+  rowbest = (float*)malloc(sizeof(float) * (b1 + b2));
+  colbest = rowbest + b1;
+  rowstart = (unsigned*)malloc(sizeof(unsigned) * (b1 + b2 + 2));
+  colstart = rowstart + b1 + 1;
+  indexsplits(splits1);
+  indexsplits(splits2);
+  next1 = samesplits(splits1);
+  next2 = samesplits(splits2);
+  groups1 = groupsizes(splits1);
+  groups2 = groupsizes(splits2);
+
+  job.splits1 = splits1;
+  job.splits2 = splits2;
+  rowhits = besthits(&job, 0, next2, &groups2, rowbest, rowstart);
+  colhits = besthits(&job, 1, next1, &groups1, colbest, colstart);
+
+  chosen = (char*)calloc(b1 + 1, sizeof(char));
+  common = 0.0;
+  for ( j = 0; j < b2; j++ ) {
+    found = 0;
+    for ( k = colstart[j]; k < colstart[j + 1] && !found; k++ ) {
+      i = colhits.item[k];
+      if ( !chosen[i] ) {
+        for ( m = rowstart[i]; m < rowstart[i + 1] && !found; m++ ) {
+          if ( j == rowhits.item[m] ) {
+            found = 1;
+            chosen[i] = 1; /* BBH for i is found */
+            common += colbest[j];
+          }
+        }
+      }
+    }
+  }
+  free(rowbest);
+  free(rowstart);
+  free(next1);
+  free(next2);
+  free(groups1.start);
+  free(groups1.split);
+  free(groups2.start);
+  free(groups2.split);
+  free(rowhits.item);
+  free(colhits.item);
+  free(chosen);
+  return common;
+} /* alignhits */
+
 /************************************************************************
 *  aligndist: find best bidirectional hits between branches of two trees,
-*  return the sum of Jaccard measures for all BBH
+*  return the sum of Jaccard measures for all BBH. Unless naivealgorithms
+*  is set, the hits are found by alignhits() without scoring most pairs.
 *************************************************************************/ 
 float aligndist (struct tree tree1, struct tree tree2) {
   float result;
@@ -508,25 +2108,29 @@ float aligndist (struct tree tree1, struct tree tree2) {
   unsigned *numcorrbr2; 
   float *maxjacc;
   char *chosen;
+  struct splits splits1, splits2;
   unsigned i, j, k, m;
   char flag;
 
   if ( tree1.leavesnum == tree2.leavesnum ) {
     corresp = (unsigned*)malloc(sizeof(unsigned) * tree1.leavesnum);
     for ( i = 0; i < tree1.leavesnum; i++ ) {
-      flag = 1;
-      for ( j = 0; j < tree1.leavesnum && flag; j++ ) {
-        if ( strcmp(tree1.leaf[i], tree2.leaf[j]) == 0 ) {
-          corresp[i] = j;   /* leaf i in tree 1 corresponds to leaf j in tree 2 */
-          flag = 0;
-        }
-      }
-      if ( flag ) {
+      corresp[i] = findleaf(tree2, tree1.leaf[i]); /* leaf i in tree 1 corresponds to leaf corresp[i] in tree 2 */
+      if ( corresp[i] == tree2.leavesnum ) {
         fprintf(stderr, "The leaf \"%s\" of tree #1 has no correspondence in the tree #2\n", tree1.leaf[i]);
         return 1.0;
       }
     }
 
+    splits1 = makesplits(tree1, NULL, tree1.leavesnum);
+    splits2 = makesplits(tree2, corresp, tree1.leavesnum);
+    if ( !naivealgorithms ) {
+      common = alignhits(&splits1, &splits2);
+      free(corresp);
+      freesplits(splits1);
+      freesplits(splits2);
+      return tree1.branchnum + tree2.branchnum - 2 * common;
+    }
     numcorrbr1 = (unsigned*)calloc(tree1.branchnum, sizeof(unsigned));
     numcorrbr2 = (unsigned*)calloc(tree2.branchnum, sizeof(unsigned));
     correspbranches1 = (unsigned**)malloc(sizeof(unsigned*) * tree1.branchnum);
@@ -542,7 +2146,7 @@ float aligndist (struct tree tree1, struct tree tree2) {
     for ( i = 0; i < tree1.branchnum; i++ ) {
       best = 0.0;
       for ( j = 0; j < tree2.branchnum; j++ ) {
-        curr =  jaccard(tree1.branch[i], tree2.branch[j], corresp, tree1.leavesnum);
+        curr = jaccardsplits(&splits1, i, &splits2, j);
         if ( curr > best) {
           best = curr;
           numcorrbr1[i] = 1;
@@ -584,10 +2188,12 @@ float aligndist (struct tree tree1, struct tree tree2) {
       }
     }
     free(corresp);
+    freesplits(splits1);
+    freesplits(splits2);
     free(numcorrbr1); 
     free(numcorrbr2);
     for ( i = 0; i < tree1.branchnum; i++ ) free(correspbranches1[i]);
-    for ( j = 0; j < tree1.branchnum; j++ ) free(correspbranches2[j]);
+    for ( j = 0; j < tree2.branchnum; j++ ) free(correspbranches2[j]);
     free(correspbranches1); 
     free(correspbranches2); 
     free(maxjacc);
@@ -613,22 +2219,23 @@ float ffmaxf(float a, float b) {
 /*********************************************************
 * jaccard: return the Jaccard measure of two splits
 **********************************************************/
-float jaccard(char *br1, char *br2, unsigned *corresp, unsigned n) {
+float jaccard(const uint64_t *br1, const uint64_t *br2, unsigned *corresp, unsigned n) {
   float res00, res01, res10, res11;
   unsigned is00 = 0, is01 = 0, is10 = 0, is11 = 0;
   unsigned un00 = 0, un01 = 0, un10 = 0, un11 = 0;
-  unsigned i, j;
+  unsigned i, b1, b2;
 
   for ( i = 0; i < n; i++ ) {
-    j = corresp[i];
-    if ( br1[i] == 0 && br2[j] == 0) is00++;
-    if ( br1[i] == 0 && br2[j] == 1) is01++;
-    if ( br1[i] == 1 && br2[j] == 0) is10++;
-    if ( br1[i] == 1 && br2[j] == 1) is11++;
-    if ( br1[i] == 0 || br2[j] == 0) un00++;
-    if ( br1[i] == 0 || br2[j] == 1) un01++;
-    if ( br1[i] == 1 || br2[j] == 0) un10++;
-    if ( br1[i] == 1 || br2[j] == 1) un11++;
+    b1 = HASBIT(br1, i);
+    b2 = HASBIT(br2, corresp[i]);
+    if ( b1 == 0 && b2 == 0) is00++;
+    if ( b1 == 0 && b2 == 1) is01++;
+    if ( b1 == 1 && b2 == 0) is10++;
+    if ( b1 == 1 && b2 == 1) is11++;
+    if ( b1 == 0 || b2 == 0) un00++;
+    if ( b1 == 0 || b2 == 1) un01++;
+    if ( b1 == 1 || b2 == 0) un10++;
+    if ( b1 == 1 || b2 == 1) un11++;
   }
   res00 = ((float)is00)/un00;
   res01 = ((float)is01)/un01;
@@ -638,6 +2245,38 @@ float jaccard(char *br1, char *br2, unsigned *corresp, unsigned n) {
   return ffmaxf(ffminf(res00, res11), ffminf(res01, res10));
 } /* jaccard */
 
+/*********************************************************
+* jaccardsplits: the Jaccard measure of split i of splits1
+*  and split j of splits2. Only the intersection of 1 sides
+*  is counted, the other seven numbers follow from the sizes.
+**********************************************************/
+float jaccardsplits(struct splits *splits1, unsigned i, struct splits *splits2, unsigned j) {
+  float res00, res01, res10, res11;
+  unsigned is00, is01, is10, is11;
+  unsigned un00, un01, un10, un11;
+  unsigned n, words;
+  uint64_t *bits1, *bits2;
+
+  n = splits1->leavesnum;
+  words = splits1->words;
+  bits1 = splits1->bits + (size_t)i * words;
+  bits2 = splits2->bits + (size_t)j * words;
+  is11 = andcount(bits1, bits2, words);
+  is10 = splits1->size[i] - is11;
+  is01 = splits2->size[j] - is11;
+  is00 = n - is11 - is10 - is01;
+  un00 = n - is11;
+  un01 = n - is10;
+  un10 = n - is01;
+  un11 = n - is00;
+  res00 = ((float)is00)/un00;
+  res01 = ((float)is01)/un01;
+  res10 = ((float)is10)/un10;
+  res11 = ((float)is11)/un11;
+
+  return ffmaxf(ffminf(res00, res11), ffminf(res01, res10));
+} /* jaccardsplits */
+
 /*************************************************************
 * subtree:
 *  for a given tree and a list of names create the subtree
@@ -645,66 +2284,51 @@ float jaccard(char *br1, char *br2, unsigned *corresp, unsigned n) {
 **************************************************************/
 struct tree subtree(struct tree intree, char **leaflist, unsigned int listlen) {
   unsigned i, j, k;
-  char flag;
   char *newbranches;
-  char *newleaves;
-  unsigned newbranchnum, countleaf;
+  char *name;
+  unsigned newbranchnum;
+  unsigned leavesnum;
+  size_t namesize;
   unsigned *correspleaf;
   unsigned *correspbranch;
+  struct splits restricted;
   struct tree result;
+  const uint64_t *row;
+  uint64_t *bits;
 
-  result.rooted = intree.rooted;
-  result.leavesnum = 0;
-  result.leaf = (char**)malloc(sizeof(char*) * listlen);
+  leavesnum = 0;
+  namesize = 0;
   correspleaf = (unsigned*)malloc(sizeof(unsigned) * listlen);
   correspbranch = (unsigned*)malloc(sizeof(unsigned) * intree.branchnum);
-  newleaves = (char*)calloc(intree.leavesnum, sizeof(char));
   i = j = 0;
   while ( i < listlen) {
-    flag = 0;
-    for ( k = 0; k < intree.leavesnum && flag == 0; k++) {
-      if ( strcmp(intree.leaf[k], leaflist[i]) == 0 ) {
-        flag = 1;
-        newleaves[k] = 1;
-        result.leavesnum++;
-        result.leaf[j] = (char*)malloc(sizeof(char) * (strlen(leaflist[i]) + 1));
-        strcpy(result.leaf[j], leaflist[i]);
-        correspleaf[j] = k;
-        j++;
-      } /* if */
-    } /* for k */
+    k = findleaf(intree, leaflist[i]);
+    if ( k < intree.leavesnum ) {
+      leavesnum++;
+      namesize += strlen(leaflist[i]) + 1;
+      correspleaf[j] = k;
+      j++;
+    } /* if */
     i++;
   } /* while i < listlen */
 
   fprintf(stderr, "Restricting tree from %u to %u leafs\n", intree.leavesnum, listlen);
 
+  /* branches restricted to the new leaves; a branch is kept
+     if it is not trivial and differs from all previous ones,
+     the first equal previous branch is found by the hash table */
+  restricted = makesplits(intree, correspleaf, leavesnum);
+  indexsplits(&restricted);
   newbranches = (char*)calloc(intree.branchnum, sizeof(char));
   newbranchnum = 0;
   for ( i = 0; i < intree.branchnum; i++ ) {
     newbranches[i] = 1; 
-    countleaf = 0;
-    for ( k = 0; k < intree.leavesnum; k++ ) {
-      if ( newleaves[k] ) countleaf += intree.branch[i][k];
-    }
-    if ( countleaf > 0 && countleaf < result.leavesnum ) {
-      flag = 3;
-      for ( j = 0; j < i && flag == 3; j++ ) {
-        if ( newbranches[j] ) {
-          flag = 0;
-          for ( k = 0; k < intree.leavesnum && flag < 3; k++ ) {
-            if ( newleaves[k] ) {
-              if ( flag == 0 && intree.branch[i][k] == intree.branch[j][k] ) flag = 1;
-              else if ( flag == 0 && intree.branch[i][k] != intree.branch[j][k] ) flag = 2;
-              else if ( flag == 1 && intree.branch[i][k] != intree.branch[j][k] ) flag = 3;
-              else if ( flag == 2 && intree.branch[i][k] == intree.branch[j][k] ) flag = 3;
-            } /* if */
-          } /* for k */
-          if ( flag < 3 ) {
-            newbranches[i] = 0;
-            correspbranch[i] = correspbranch[j];
-          }
-        } /* if newbranches[j] == 1 */
-      } /* for j */
+    if ( restricted.size[i] > 0 ) {
+      j = findsplit(&restricted, &restricted, i);
+      if ( j < i ) {
+        newbranches[i] = 0;
+        correspbranch[i] = correspbranch[j];
+      }
     } /* if */
     else { 
       newbranches[i] = 0;
@@ -715,15 +2339,24 @@ struct tree subtree(struct tree intree, char **leaflist, unsigned int listlen) {
       newbranchnum++;
     }
   }
-  result.branchnum = newbranchnum;
-  result.branch = (char**)malloc(sizeof(char*) * newbranchnum);
+  freesplits(restricted);
+  result = newtree(leavesnum, newbranchnum, namesize);
+  result.rooted = intree.rooted;
+  name = result.leaf[0];
+  for ( k = 0; k < leavesnum; k++ ) {
+    result.leaf[k] = name;
+    strcpy(name, intree.leaf[correspleaf[k]]);
+    name += strlen(name) + 1;
+  }
+  indexleaves(&result);
 
   i = j = 0;
   while ( i < newbranchnum ) {
     if ( newbranches[j] ) {
-      result.branch[i] = (char*)calloc(result.leavesnum, sizeof(char));
+      row = BRANCHROW(intree, j);
+      bits = BRANCHROW(result, i);
       for ( k = 0; k < result.leavesnum; k++ ) {
-        result.branch[i][k] = intree.branch[j][correspleaf[k]];
+        if ( HASBIT(row, correspleaf[k]) ) bits[k / 64] |= (uint64_t)1 << (k % 64);
       }
       i++;
     }
@@ -740,8 +2373,8 @@ struct tree subtree(struct tree intree, char **leaflist, unsigned int listlen) {
   }
 
   result.phylogram = intree.phylogram;
-  result.length = (float*)calloc(result.branchnum, sizeof(float));
   if ( intree.phylogram ) {
+    memset(result.length, 0, sizeof(float) * result.branchnum);
     for ( j = 0; j < intree.branchnum; j++ ) {
       if ( correspbranch[j] < intree.branchnum ) result.length[correspbranch[j]] += intree.length[j];
     }
@@ -755,6 +2388,9 @@ struct tree subtree(struct tree intree, char **leaflist, unsigned int listlen) {
     }
     result.rootlocation = 1.0;
   }
+  free(correspleaf);
+  free(correspbranch);
+  free(newbranches);
 
   return result;
 } /* subtree */
@@ -27,38 +27,448 @@
 */
 #include <math.h>
 #include <ctype.h>
+#include <stdint.h>
 
 /* Structure for tree */
 struct tree {
   unsigned leavesnum; /* number of leaves */
   unsigned branchnum; /* number of branches, including trivial ones */
   char **leaf; /* leaves' names */
-  char **branch; /* branches as strings of 0 and 1 of length leavesnum */
+  unsigned words; /* 64-bit words of a branch, (leavesnum + 63) / 64 */
+  uint64_t *branch; /* branches as bitsets of leavesnum bits, see BRANCHROW() and HASBIT() */
   char rooted; /* 1 if rooted, 0 if unrooted */
   unsigned root; /* index of the root branch */
   char phylogram; /* 1 if lengths are really lengths, 0 otherwise */
   float *length; /* branch lengths */
   float rootlocation; /* distance from the root to the node from the side of leaf #1 (index 0) */
+  unsigned *leafindex; /* hash table of leaves' names, see findleaf() */
 };
 
+/* branch i of a tree: bit k is 1 if leaf k is inside the branch */
+#define BRANCHROW(intree, i) ((intree).branch + (size_t)(i) * (intree).words)
+#define HASBIT(bits, k) ((unsigned)((bits)[(k) / 64] >> ((k) % 64)) & 1u)
+
+extern char naivealgorithms; 
+/* 1 to compute distances by the original straightforward algorithms, for checks */
+extern unsigned threadsnum;
+/* threads computing one distance between two trees, 1 by default */
+
+/* File of pre-parsed trees (.tdb), see treedb.c */
+struct treedb {
+  char *data; /* the whole file */
+  size_t size;
+  unsigned treenum; /* number of trees */
+  uint64_t *dir; /* offsets and sizes of tree records */
+  char mapped; /* 1 if opened by opentreedb() */
+};
+
+/* Writer of a .tdb file */
+struct tdbwriter {
+  FILE *out;
+  unsigned treenum; /* trees written */
+  unsigned dirsize; /* allocated directory entries */
+  uint64_t *dir;
+  uint64_t pos; /* end of the last record */
+};
+
+struct skeleton;
+
+/* File of trees, either mapped into memory or read from a stream */
+struct treefile {
+  char *name; /* file name, "-" for the stdin */
+  FILE *stream; /* NULL for a mapped file */
+  char *data; /* the mapping or the buffer */
+  size_t size; /* number of bytes in data */
+  size_t pos; /* start of the next tree in data */
+  size_t bufsize; /* size of the buffer */
+  char mapped; /* 1 if data is a mapping of the file */
+  char isdb; /* 1 if the file is a .tdb one, its trees are taken from db */
+  struct treedb db;
+  unsigned treeindex; /* next tree of db */
+  struct unpacker *unpack; /* decompression of a gzip or zstd file, see unpack.c */
+};
+
+int opentrees(struct treefile *infile, char *filename); /* returns 0 on success */
+char *nexttree(struct treefile *infile, size_t *len); /* next ';'-terminated tree or NULL */
+int readtree(struct treefile *infile, struct tree *intree); /* returns 0 if no more trees */
+int readtreeskeleton(struct treefile *infile, struct skeleton *inskeleton); /* the same */
+void closetrees(struct treefile *infile);
+int startunpack(struct treefile *infile); /* returns 0 on success */
+void stopunpack(struct treefile *infile);
+
+unsigned readtrees(struct treefile *infile, struct tree *trees, unsigned maxtrees, unsigned threads);
+/* parsing up to maxtrees next trees in parallel, returns their number */
+
+unsigned cpucount(void);
+unsigned long cachesize(void); /* bytes of the L2 cache */
+unsigned long residentmemory(void); /* bytes of the process in RAM */
+int parsememory(const char *text, unsigned long *bytes);
+/* "512M" and the like as bytes, returns 0 on success */
+void runparallel(unsigned threads, unsigned count, void (*work)(void *arg, unsigned index), void *arg);
+/* work(arg, 0) ... work(arg, count - 1) on several threads */
+
+int istreedb(const char *data, size_t size);
+int maptreedb(struct treedb *db, char *data, size_t size); /* returns 0 on success */
+int opentreedb(struct treedb *db, char *filename); /* returns 0 on success */
+int loadtree(struct treedb *db, unsigned index, struct tree *intree); /* returns 0 on success */
+void closetreedb(struct treedb *db);
+int createtreedb(struct tdbwriter *writer, char *filename); /* all three return 0 on success */
+int writetreedb(struct tdbwriter *writer, struct tree intree);
+int finishtreedb(struct tdbwriter *writer);
+
 struct tree readbrackets(char *brackets); /* converting string with Newick to rooted tree */
+int quotedlabel(const char *text, size_t i); /* 1 if the quote text[i] opens a quoted label */
+
+/* Tree as it is written in Newick, without the branch bitsets */
+struct skeleton {
+  unsigned leavesnum;
+  unsigned nodesnum; /* nodes below branches and the root */
+  unsigned root;
+  struct tree names; /* leaves' names, a tree without branches */
+  unsigned *parent; /* parent node, nodesnum for the root */
+  unsigned *leafnode; /* the node of every leaf */
+  unsigned *weight; /* 1 for branches, 0 for the root and for nodes that are not branches */
+  float *length; /* branch lengths */
+};
+
+struct skeleton readskeleton(char *brackets); /* memory O(n) even for huge trees */
+struct skeleton treeskeleton(struct tree intree); /* skeleton of a tree made by readbrackets() */
+void freeskeleton(struct skeleton inskeleton);
+struct tree newtree(unsigned leavesnum, unsigned branchnum, size_t namesize);
+/* allocating a tree in one memory block */
+void freetree(struct tree intree);
+void indexleaves(struct tree *intree); /* filling the hash table of leaves' names */
+unsigned findleaf(struct tree intree, const char *name); 
+/* index of the leaf with a given name, intree.leavesnum if there is no such leaf */
 
 unsigned combdistance(struct tree intree, unsigned leaf1, unsigned leaf2); 
 /* combinatorial distance (number of branches in path) between two leaves  */
 long treedist2 (struct tree intree1, struct tree intree2, char p);
+void pathdiffs(struct tree intree1, struct tree intree2, unsigned *corresp, long *sum1, long *sum2);
+/* sums of treedist2() for p = 1 and p = 2 of trees with the same leaves,
+   leaf i of tree 1 being leaf corresp[i] of tree 2; NULL for a sum not needed */
+int leafpaths(struct tree intree, unsigned *order, uint16_t *path);
+/* combinatorial distances between all leaves into an n x n matrix, leaf i at order[i] */
+
+/* Branches of a tree packed into bitsets */
+struct splits {
+  unsigned leavesnum; /* number of bits in a split */
+  unsigned branchnum; /* number of splits */
+  unsigned words; /* number of 64-bit words in a split */
+  uint64_t *bits; /* splits one after another, bit 0 of every split is 0 */
+  unsigned *size; /* numbers of 1 bits */
+  uint64_t *hash; /* hashes of splits */
+  unsigned *table; /* hash table made by indexsplits(), or NULL */
+  unsigned tablesize;
+};
+
+
+struct splits makesplits(struct tree intree, unsigned *leaforder, unsigned leavesnum);
+void freesplits(struct splits insplits);
+void indexsplits(struct splits *insplits);
+unsigned findsplit(struct splits *insplits, struct splits *other, unsigned i);
+/* the first split of insplits equal to split i of other, insplits->branchnum if none */
+unsigned popcount64(uint64_t x);
+uint64_t hashsplit(const uint64_t *bits, unsigned words); /* the hash kept in struct splits */
+unsigned commonsplits(struct splits *splits1, struct splits *splits2);
+/* number of splits of splits1 present in splits2 */
+unsigned andbits(const uint64_t *a, const uint64_t *b, unsigned words);
+/* number of common 1 bits of two bitsets */
+int checkandcount(void); /* 0 if all kernels of andbits() give the same counts, see -naive of rfa_dist */
 
 unsigned branchdist(struct tree tree1, struct tree tree2);
 unsigned branchdist_n(struct tree tree1, struct tree tree2);
 
 float aligndist(struct tree tree1, struct tree tree2);
+float alignhits(struct splits *splits1, struct splits *splits2);
+/* sum of Jaccard measures of best bidirectional hits of splits made with the same leaf order */
 float ffminf(float a, float b);
 float ffmaxf(float a, float b);
-float jaccard(char *br1, char *br2, unsigned *corresp, unsigned n);
+float jaccard(const uint64_t *br1, const uint64_t *br2, unsigned *corresp, unsigned n);
+float jaccardsplits(struct splits *splits1, unsigned i, struct splits *splits2, unsigned j);
+
+/* Unrooted tree as clades without leaf 0, made from its splits */
+struct topology {
+  unsigned leavesnum;
+  unsigned nodesnum; /* inner nodes, node 0 is next to leaf 0 */
+  unsigned *parent; /* parent[v] < v, parent[0] = nodesnum */
+  unsigned *size; /* number of leaves in the clade of a node */
+  unsigned *first; /* the clade of node v is order[first[v] ... first[v] + size[v] - 1] */
+  unsigned *childstart; /* inner children of v are child[childstart[v] ... childstart[v + 1] - 1] */
+  unsigned *child;
+  unsigned *leafchildren; /* number of leaves hanging on a node */
+  unsigned *leafparent; /* the node a leaf hangs on */
+  unsigned *order; /* leaves in the order of clades, leaf 0 is the last */
+  unsigned *position; /* position of a leaf in order */
+};
+
+struct topology maketopology(struct splits *insplits);
+void freetopology(struct topology intopology);
+
+/* Quartets of leaves of two trees by their resolution */
+struct quartets {
+  long long total; /* all quartets */
+  long long same; /* resolved by both trees in the same way */
+  long long different; /* resolved by both trees in different ways */
+  long long only1; /* resolved by tree 1 only */
+  long long only2; /* resolved by tree 2 only */
+  long long unresolved; /* resolved by neither tree */
+};
 
 char whichsplittree(unsigned a, unsigned b, unsigned c, unsigned d, 
                         struct tree intree);
 long treedist4 (struct tree intree1, struct tree intree2);
+double quartetdistance(long long number, unsigned n);
+/* 1 - number / C(n, 4) for number common fourths of n > 3 leaves */
+int quartetcounts(struct tree intree1, struct tree intree2, struct quartets *counts);
+/* returns 1 if the trees have different leaves */
+void splitquartets(struct splits *splits1, struct splits *splits2, struct quartets *counts);
+/* the same by splits made with the same leaf order, leaves must be unique */
 
 struct tree subtree(struct tree intree, char **leaflist, unsigned listlen);
 
+/* Index of lowest common ancestors of nodes of a skeleton, see lca.c */
+struct lcaindex {
+  unsigned nodesnum;
+  unsigned tourlength; /* positions of the Euler tour */
+  unsigned *tour; /* nodes in the order of the tour */
+  unsigned *level; /* numbers of edges from the root to the nodes of the tour */
+  unsigned *visit; /* the first position of every node in the tour */
+  unsigned *depth; /* weight of the path from the root to a node */
+  double *length; /* length of the path from the root to a node */
+  unsigned blocks; /* blocks of the tour */
+  unsigned levels; /* rows of the sparse table */
+  unsigned *table; /* row j: positions of minimal levels in runs of 2^j blocks */
+};
+
+/* Quartet distance estimated by random quartets */
+struct quartetestimate {
+  double distance;
+  double low; /* 95% confidence interval */
+  double high;
+  unsigned long long samples; /* number of quartets checked */
+};
+
+/* L1 or L2 distance estimated by random pairs of leaves */
+struct pathestimate {
+  double distance;
+  double error; /* standard error */
+  unsigned long long samples; /* number of pairs checked */
+};
+
+struct lcaindex makelcaindex(struct skeleton *inskeleton);
+void freelcaindex(struct lcaindex index);
+unsigned lca(struct lcaindex *index, unsigned u, unsigned v);
+unsigned pathweight(struct lcaindex *index, unsigned u, unsigned v); /* number of branches between nodes */
+double pathlength(struct lcaindex *index, unsigned u, unsigned v);
+int samplequartets(struct skeleton *skeleton1, struct skeleton *skeleton2, double bound,
+                   unsigned long long maxsamples, uint64_t seed, struct quartetestimate *estimate);
+/* returns 1 if the trees have different leaves */
+int samplepaths(struct skeleton *skeleton1, struct skeleton *skeleton2, char p, double bound,
+                unsigned long long maxsamples, uint64_t seed, struct pathestimate *estimate);
+/* the same */
+
+/* Distances computed by the treedist program, see metrics.c */
+#define METRICRF 0
+#define METRICRFN 1
+#define METRICRFA 2
+#define METRICL1 3
+#define METRICL2 4
+#define METRICQUARTET 5
+#define METRICSNUM 6
+
+extern const char *metricnames[METRICSNUM]; /* "rf", "rfn", "rfa", "l1", "l2", "quartet" */
+
+/* Two trees restricted to common leaves once, compared by several
+   metrics; the leaf map, splits and path sums are made when a metric
+   needs them first and are shared by all metrics */
+struct comparison {
+  struct tree tree1, tree2; /* the trees restricted to common leaves */
+  unsigned leavesnum; /* the smaller number of leaves before restriction */
+  char restricted; /* 1 if the trees had different numbers of leaves */
+  char own1, own2; /* 1 if a tree is made by subtree() */
+  unsigned wanted; /* bit m is set if metric m will be asked for */
+  int leaves; /* 0 before mapleaves(), 1 if the leaves are the same,
+                 -1 if the numbers of leaves differ, -2 if names differ */
+  char repeated; /* 1 if a leaf name is repeated */
+  unsigned *corresp; /* leaf i of tree1 is leaf corresp[i] of tree2 */
+  char havesplits, havecommon, havesum1, havesum2;
+  struct splits *given1, *given2; /* splits made beforehand and not freed, or NULL */
+  struct splits splits1, splits2;
+  unsigned common; /* splits present in both trees */
+  long sum1, sum2; /* results of treedist2() for p = 1 and p = 2 */
+};
+
+int parsemetrics(char *list, unsigned *metrics, unsigned *count);
+/* metrics of a comma-separated list in its order, returns 1 for an unknown name */
+void startcomparison(struct comparison *c, struct tree intree1, struct tree intree2, unsigned wanted);
+double metricvalue(struct comparison *c, unsigned metric);
+/* the value computed by the program of the metric for the same trees */
+unsigned splitdistance(struct comparison *c);
+/* branches of the restricted trees without an equal split in the other tree, rf before normalizing */
+void finishcomparison(struct comparison *c);
+
+/* A tree compared with many others, see metrics.c */
+struct reference {
+  struct tree tree;
+  unsigned wanted; /* as in struct comparison */
+  struct splits *splits; /* indexed splits of the tree in its leaf order, or NULL */
+  struct splits stored;
+};
+
+void makereference(struct reference *ref, struct tree intree, unsigned wanted);
+void startreference(struct comparison *c, struct reference *ref, struct tree intree);
+/* startcomparison() of the reference and a tree sharing the splits of the reference */
+void freereference(struct reference *ref);
+
+/* Trees compared with each other, see metrics.c */
+struct collection {
+  unsigned treenum;
+  struct tree *trees;
+  unsigned wanted; /* as in struct comparison */
+  char sameleaves; /* 1 if every tree has the leaves of tree 0, each once */
+  struct splits *splits; /* splits of every tree in the leaf order of tree 0, or NULL */
+  size_t splitbytes; /* memory of splits (or of their numbers) of all trees */
+  /* numbers of distinct splits made by internsplits(), see splitdict.c */
+  unsigned splitsnum; /* distinct splits */
+  unsigned universal; /* splits present once in every tree, not listed */
+  unsigned sharednum; /* splits of two trees or more, numbered first */
+  size_t *idstart; /* numbers of splits of tree k are id[idstart[k] ... idstart[k + 1] - 1], */
+  unsigned *id; /* increasing, or NULL if the splits are not numbered */
+  char *repeatedsplits; /* 1 if a tree has equal splits */
+  unsigned columnwords; /* words of a column of the incidence matrix */
+  uint64_t *column; /* bit s of column k is 1 if tree k has shared split s, or NULL */
+};
+
+void startcollection(struct collection *coll, struct tree *trees, unsigned treenum,
+                     unsigned wanted, unsigned threads);
+void startpair(struct comparison *c, struct collection *coll, unsigned i, unsigned j);
+/* startcomparison() of trees i and j sharing the splits of the collection */
+void finishcollection(struct collection *coll);
+void internsplits(struct collection *coll);
+unsigned paircommon(struct collection *coll, unsigned i, unsigned j);
+/* commonsplits() of the splits of trees i and j numbered by internsplits() */
+void freesplitdict(struct collection *coll);
+
+/* Distances between all pairs of trees of a collection, see matrix.c */
+struct distmatrix {
+  unsigned treenum;
+  unsigned metricsnum;
+  unsigned metrics[METRICSNUM];
+  float *value; /* pairs i < j in the order of rows, metrics of a pair together */
+};
+
+void computematrix(struct collection *coll, struct distmatrix *matrix, unsigned threads);
+int computeshard(struct collection *coll, struct distmatrix *matrix, unsigned shard, unsigned shards,
+                 unsigned threads, char *filename);
+/* the distances of shard number shard (from 1) of shards into a part file */
+int readpart(struct distmatrix *matrix, char *filename, unsigned *shards, char **seen);
+/* the distances of a part file into the matrix, see treedist_merge.c */
+int checkparts(struct distmatrix *matrix, char **parts, unsigned partsnum, unsigned *shards, unsigned *bad);
+/* the trees and metrics of the matrix of all parts, or which part is wrong or missing */
+int mergemapped(struct distmatrix *matrix, char **parts, unsigned partsnum, char *filename,
+                char quantize, unsigned long memorylimit, unsigned *bad);
+/* the distances of the parts into a binary matrix file through windows of memory maps */
+int computemapped(struct collection *coll, struct distmatrix *matrix, unsigned threads, char *filename,
+                  char quantize, unsigned long memorylimit);
+/* the distances into a binary matrix file written through memory maps, see matrix.c */
+float matrixvalue(struct distmatrix *matrix, unsigned i, unsigned j, unsigned k);
+/* distance of metric number k of the matrix between trees i and j */
+void writephylip(FILE *out, struct distmatrix *matrix);
+void writetsv(FILE *out, struct distmatrix *matrix);
+void freematrix(struct distmatrix *matrix);
+
+/* MinHash sketches of trees and their LSH index (.lsh), see sketch.c */
+struct lshindex {
+  char *data; /* the whole file */
+  size_t size;
+  unsigned treenum;
+  unsigned rows, bands; /* a sketch is bands bands of rows numbers */
+  const uint32_t *sketch; /* rows * bands numbers of every tree */
+  const uint32_t *bucket; /* for every band treenum pairs (key, tree) sorted by key */
+};
+
+void sketchtree(struct tree intree, unsigned size, uint32_t *sketch);
+/* minima of size hash functions over nontrivial splits named by their leaves */
+double sketchsimilarity(const uint32_t *a, const uint32_t *b, unsigned size);
+/* estimate of the Jaccard similarity of the splits of two trees */
+int writelshindex(char *filename, const uint32_t *sketches, unsigned treenum, unsigned rows, unsigned bands);
+int openlshindex(struct lshindex *index, char *filename); /* both return 0 on success */
+void closelshindex(struct lshindex *index);
+unsigned *lshcandidates(struct lshindex *index, const uint32_t *sketch, unsigned bands, unsigned *count);
+/* trees sharing a bucket of the first bands bands with a sketch, a malloc() array */
+
+/* Vantage-point tree of a collection (.vpt) for exact searches, see vptree.c */
+#define VPNONE 0xffffffffu
+
+struct vpmember {
+  uint32_t tree;
+  float distance; /* to the vantage point of its node */
+};
+
+struct vpnode {
+  uint32_t tree; /* the vantage point */
+  uint32_t child[2]; /* inner and outer subtrees, or VPNONE */
+  uint32_t first, count; /* the bucket of a node without children */
+  float low[2], high[2]; /* distances from the vantage point to the trees of the children */
+};
+
+struct vptree {
+  unsigned treenum;
+  unsigned leavesnum;
+  unsigned metric;
+  unsigned maxinner; /* the most inner branches of a tree, for rf */
+  unsigned nodesnum, membersnum;
+  struct vpnode *node;
+  struct vpmember *member;
+};
+
+void makevptree(struct vptree *vp, struct collection *coll, unsigned metric, unsigned threads);
+int writevptree(struct vptree *vp, char *filename);
+int readvptree(struct vptree *vp, char *filename); /* both return 0 on success */
+void freevptree(struct vptree *vp);
+double vpdistance(struct comparison *c, unsigned metric); /* the distance kept by the index */
+struct vpmember *searchvptree(struct vptree *vp, unsigned nearest, double radius, double scale,
+                              double (*distance)(void *arg, unsigned tree, double *value), void *arg,
+                              unsigned *count, unsigned *computed);
+/* the nearest trees to a query or the trees within radius if nearest is 0, a malloc() array */
+
+/* A query tree changed by SPR and NNI moves compared with a fixed reference, see moves.c */
+#define MOVENONE 0xffffffffu
+
+struct movecomparison {
+  unsigned leavesnum;
+  unsigned nodesnum; /* leaves in the order of the reference, then inner nodes */
+  unsigned *parent; /* MOVENONE for leaf 0, from which the query hangs */
+  unsigned *child; /* two for every inner node, one for leaf 0 */
+  struct tree names; /* leaves' names, a tree without branches */
+  size_t namesize;
+  struct splits splits; /* the split of the branch above every node but leaf 0 */
+  struct splits refsplits; /* of the reference, indexed */
+  char *present; /* 1 if the split of a node is a split of the reference */
+  uint64_t *moved; /* leaves of the moved subtree */
+  unsigned branchnum, refbranchnum;
+  unsigned common; /* branches of the query with a split of the reference */
+  uint16_t *path, *refpath; /* distances between all leaves, or NULL if not kept */
+  long sum1, sum2; /* results of treedist2() for p = 1 and p = 2 */
+  unsigned *stack, *dist, *mark, *lose, *gain, *list, *other; /* work space */
+  unsigned stamp;
+};
+
+int startmoves(struct movecomparison *m, struct tree reference, struct tree query, char paths);
+/* returns 0 on success; the sums of path differences are kept if paths is 1 */
+int sprmove(struct movecomparison *m, unsigned subtree, unsigned target);
+/* the subtree of a node grafted on the branch above target, 0 on success */
+int nnimove(struct movecomparison *m, unsigned v, unsigned which);
+/* a child of an inner node swapped with the sibling of the node, 0 on success */
+double movevalue(struct movecomparison *m, unsigned metric); /* as metricvalue() for rf, l1, l2 */
+char *movednewick(struct movecomparison *m); /* the query in Newick, a malloc() string */
+struct tree movedtree(struct movecomparison *m);
+void finishmoves(struct movecomparison *m);
+
+unsigned comparestream(struct reference *ref, struct treefile *infile, unsigned *metrics,
+                       unsigned metricsnum, unsigned threads, FILE *out);
+/* rows of distances between the reference and every tree of a file, see stream.c;
+   returns the number of trees */
+
 #endif
@@ -0,0 +1,296 @@
+/*  The program "treedist-lsh" finds trees of a big collection close to given trees
+    by the Robinson-Foulds distance. First it makes an index of the collection:
+    a MinHash sketch of the splits of every tree and buckets of locality-sensitive
+    hashing (LSH) of the sketches (see sketch.c). Then for every query tree
+    the trees sharing a bucket with it are taken as candidates, the candidates
+    most similar by sketches are compared with the query by rf (as rf_dist),
+    and the closest of them are printed.
+    The result is approximate: a tree that shares no bucket with the query is not
+    found. A tree of Jaccard similarity J of splits shares a bucket with
+    probability 1 - (1 - J^r)^b for b bands of r rows, and option -recall chooses
+    how many bands of the index are used. Option -similarity takes s = 1 - rf:
+    binary trees of m inner splits with c common ones have s = c / m and
+    J = c / (2m - c) = s / (2 - s).
+
+    For compilation, treedist-lsh requires this file, sketch.c, metrics.c, splitdict.c,
+    treedist.c, treeread.c, treedb.c, parallel.c, unpack.c, lca.c and treedist.h.
+
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of TreeDist.
+
+    TreeDist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TreeDist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TreeDist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+
+/* Sketches of a batch of trees made in parallel */
+struct sketchjob {
+  struct tree *trees;
+  uint32_t *sketches;
+  unsigned size;
+};
+
+/* A candidate tree of a query */
+struct neighbour {
+  unsigned tree;
+  double similarity; /* by sketches */
+  double distance; /* rf */
+};
+
+static void sketchone(void *arg, unsigned k) {
+  struct sketchjob *job = (struct sketchjob*)arg;
+
+  sketchtree(job->trees[k], job->size, job->sketches + (size_t)k * job->size);
+} /* sketchone */
+
+static int comparesimilarity(const void *x, const void *y) {
+  const struct neighbour *a = (const struct neighbour*)x, *b = (const struct neighbour*)y;
+
+  if ( a->similarity != b->similarity ) return a->similarity > b->similarity ? -1 : 1;
+  return a->tree < b->tree ? -1 : (a->tree > b->tree);
+} /* comparesimilarity */
+
+static int comparedistance(const void *x, const void *y) {
+  const struct neighbour *a = (const struct neighbour*)x, *b = (const struct neighbour*)y;
+
+  if ( a->distance != b->distance ) return a->distance < b->distance ? -1 : 1;
+  return a->tree < b->tree ? -1 : (a->tree > b->tree);
+} /* comparedistance */
+
+/****************************************************************
+* buildindex: sketch all trees of a file and write the index
+*****************************************************************/
+static int buildindex(char *treefile, char *indexfile, unsigned rows, unsigned bands) {
+  struct treefile infile;
+  struct sketchjob job;
+  struct tree *trees;
+  uint32_t *sketches;
+  unsigned threads, batch, num, treenum, alloc, k;
+
+  if ( opentrees(&infile, treefile) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", treefile);
+    exit(1);
+  }
+  threads = cpucount();
+  batch = 64 * threads;
+  trees = (struct tree*)malloc(sizeof(struct tree) * batch);
+  job.size = rows * bands;
+  treenum = 0;
+  alloc = batch;
+  sketches = (uint32_t*)malloc(sizeof(uint32_t) * job.size * alloc);
+  while ( (num = readtrees(&infile, trees, batch, threads)) > 0 ) {
+    if ( treenum + num > alloc ) {
+      alloc *= 2;
+      sketches = (uint32_t*)realloc(sketches, sizeof(uint32_t) * job.size * (size_t)alloc);
+      if ( sketches == NULL ) {
+        fprintf(stderr, "Not enough memory for sketches of %u trees\n", treenum);
+        exit(1);
+      }
+    }
+    job.trees = trees;
+    job.sketches = sketches + (size_t)treenum * job.size;
+    runparallel(threads, num, sketchone, &job);
+    for ( k = 0; k < num; k++ ) freetree(trees[k]);
+    treenum += num;
+  }
+  free(trees);
+  closetrees(&infile);
+  if ( writelshindex(indexfile, sketches, treenum, rows, bands) ) {
+    fprintf(stderr, "Can not write to \"%s\"!\n", indexfile);
+    exit(1);
+  }
+  free(sketches);
+  fprintf(stderr, "%u trees indexed in \"%s\"\n", treenum, indexfile);
+  return 0;
+} /* buildindex */
+
+int main (int argc, char *argv[])
+{
+  struct treefile infile, queryfile;
+  struct lshindex index;
+  struct tree *trees = NULL, query, candidate;
+  struct reference ref;
+  struct comparison comp;
+  struct neighbour *found;
+  uint32_t *sketch;
+  unsigned *candidates;
+  unsigned rows = 4, bands = 32, nearest = 10, maxcandidates = 0;
+  unsigned count, checked, usebands, treenum, querynum, k;
+  unsigned long long allcandidates = 0;
+  double recall = 0.0, similarity = 0.5;
+  char build = 0;
+
+  /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-build") == 0) build = 1;
+    else if (strcmp(argv[1], "-naive") == 0) naivealgorithms = 1; /* rf by the original algorithm */
+    else if (strcmp(argv[1], "-rows") == 0 && argc > 3) {
+      rows = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : rows;
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-bands") == 0 && argc > 3) {
+      bands = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : bands;
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-k") == 0 && argc > 3) {
+      nearest = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : nearest;
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-candidates") == 0 && argc > 3) {
+      maxcandidates = (unsigned)atoi(argv[2]);
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-recall") == 0 && argc > 3) {
+      recall = atof(argv[2]);
+      if ( recall <= 0.0 || recall >= 1.0 ) {
+        fprintf(stderr, "Wrong recall \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-similarity") == 0 && argc > 3) {
+      similarity = atof(argv[2]);
+      if ( similarity <= 0.0 || similarity >= 1.0 ) {
+        fprintf(stderr, "Wrong similarity \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else break;
+    argv++;
+    argc--;
+  }
+  if (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
+                    strcmp(argv[1], "-help") == 0 ||
+                    strcmp(argv[1], "--help") == 0) ) {
+    fprintf(stderr, "treedist-lsh finds trees of a collection close to query trees ");
+    fprintf(stderr, "by the Robinson-Foulds distance.\n");
+    fprintf(stderr, "Option -build makes an index of sketches of the trees of a file (Newick or .tdb);\n");
+    fprintf(stderr, "a sketch has -bands <b> bands of -rows <r> numbers (32 and 4 by default).\n");
+    fprintf(stderr, "Without -build, for every tree of the query file the trees of the indexed\n");
+    fprintf(stderr, "file sharing a bucket with it are candidates; the -candidates <m> of them most\n");
+    fprintf(stderr, "similar by sketches (all by default) are compared by rf, and the -k <n> closest\n");
+    fprintf(stderr, "(10 by default) are printed. Option -recall <R> uses only as many bands as needed\n");
+    fprintf(stderr, "to find a tree of -similarity <s> = 1 - rf (0.5 by default) with probability R;\n");
+    fprintf(stderr, "for binary trees the Jaccard similarity of their splits is s / (2 - s).\n");
+    fprintf(stderr, "The indexed file should be a .tdb file (see treedist-pack) to load candidates only.\n");
+    fprintf(stderr, "Usage: %s -build [-rows <r>] [-bands <b>] <trees> <index>\n", argv[0]);
+    fprintf(stderr, "       %s [-k <n>] [-candidates <m>] [-recall <R>] [-similarity <s>] <index> <trees> <queries>\n", argv[0]);
+    fprintf(stderr, "Example: %s -build genetrees.tdb genetrees.lsh\n", argv[0]);
+    fprintf(stderr, "Example: %s -k 5 -recall 0.99 genetrees.lsh genetrees.tdb query.tre\n", argv[0]);
+    return 0;
+  }
+  if ( (build && argc < 3) || (!build && argc < 4) ) {
+    fprintf(stderr, "Usage: %s -build [-rows <r>] [-bands <b>] <trees> <index>\n", argv[0]);
+    fprintf(stderr, "       %s [-k <n>] [-candidates <m>] [-recall <R>] [-similarity <s>] <index> <trees> <queries>\n", argv[0]);
+    return 1;
+  }
+  if ( build ) return buildindex(argv[1], argv[2], rows, bands);
+
+  k = openlshindex(&index, argv[1]);
+  if ( k ) {
+    fprintf(stderr, k == 1 ? "Can not open input file \"%s\"!\n" : "Wrong index file \"%s\"!\n", argv[1]);
+    exit(1);
+  }
+  if ( opentrees(&infile, argv[2]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
+    exit(1);
+  }
+  if ( infile.isdb ) treenum = infile.db.treenum; /* candidates are loaded by loadtree() */
+  else { /* all trees are parsed */
+    trees = (struct tree*)malloc(sizeof(struct tree) * (index.treenum + 1));
+    treenum = readtrees(&infile, trees, index.treenum + 1, cpucount());
+  }
+  if ( treenum != index.treenum ) {
+    fprintf(stderr, "The index \"%s\" is not made of \"%s\"!\n", argv[1], argv[2]);
+    exit(1);
+  }
+  if ( opentrees(&queryfile, argv[3]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[3]);
+    exit(1);
+  }
+
+  usebands = index.bands;
+  if ( recall > 0.0 ) { /* 1 - (1 - J^r)^b >= recall for J = s / (2 - s) of s = 1 - rf */
+    usebands = (unsigned)ceil(log(1.0 - recall) / log(1.0 - pow(similarity / (2.0 - similarity), index.rows)));
+    if ( usebands < 1 ) usebands = 1;
+    if ( usebands > index.bands ) {
+      fprintf(stderr, "The index has %u bands, recall %.4f needs %u\n", index.bands, recall, usebands);
+      usebands = index.bands;
+    }
+  }
+  sketch = (uint32_t*)malloc(sizeof(uint32_t) * index.rows * index.bands);
+  found = (struct neighbour*)malloc(sizeof(struct neighbour) * (index.treenum + 1));
+  printf("query\trank\ttree\trf\n");
+  querynum = 0;
+  while ( readtree(&queryfile, &query) ) {
+    querynum++;
+    sketchtree(query, index.rows * index.bands, sketch);
+    candidates = lshcandidates(&index, sketch, usebands, &count);
+    allcandidates += count;
+    for ( k = 0; k < count; k++ ) {
+      found[k].tree = candidates[k];
+      found[k].similarity = sketchsimilarity(sketch, index.sketch + (size_t)candidates[k] * index.rows * index.bands,
+                                             index.rows * index.bands);
+    }
+    free(candidates);
+    qsort(found, count, sizeof(struct neighbour), comparesimilarity);
+    checked = maxcandidates > 0 && maxcandidates < count ? maxcandidates : count;
+
+    makereference(&ref, query, 1u << METRICRF);
+    for ( k = 0; k < checked; k++ ) {
+      if ( infile.isdb ) {
+        if ( loadtree(&infile.db, found[k].tree, &candidate) ) {
+          fprintf(stderr, "Damaged tree #%u in \"%s\"\n", found[k].tree + 1, argv[2]);
+          exit(1);
+        }
+      }
+      else candidate = trees[found[k].tree];
+      startreference(&comp, &ref, candidate);
+      found[k].distance = metricvalue(&comp, METRICRF);
+      finishcomparison(&comp);
+      if ( infile.isdb ) freetree(candidate);
+    }
+    freereference(&ref);
+    freetree(query);
+    qsort(found, checked, sizeof(struct neighbour), comparedistance);
+    for ( k = 0; k < checked && k < nearest; k++ ) {
+      printf("%u\t%u\t%u\t%.4f\n", querynum, k + 1, found[k].tree + 1, found[k].distance);
+    }
+  }
+  if ( querynum > 0 ) {
+    fprintf(stderr, "%u queries, %.1f candidates of %u trees per query in %u of %u bands\n",
+            querynum, (double)allcandidates / querynum, index.treenum, usebands, index.bands);
+  }
+  closetrees(&queryfile);
+  if ( trees != NULL ) {
+    for ( k = 0; k < treenum; k++ ) freetree(trees[k]);
+    free(trees);
+  }
+  closetrees(&infile);
+  closelshindex(&index);
+  free(sketch);
+  free(found);
+  return 0;
+} /* main */
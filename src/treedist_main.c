@@ -0,0 +1,345 @@
+/*  The program "treedist" compares two phylogenetic trees by several distances
+    at once and prints them as one tab-separated row to the stdout:
+    rf (as rf_dist), rfn (as rf_dist_n), rfa (as rfa_dist), l1 (as l1_dist),
+    l2 (as l2_dist) and quartet (as quartet_dist). The trees are read and
+    restricted to common leaves once, the leaf map, the splits and the path
+    differences are made once for all distances that need them.
+    The sets of leaf labels of two trees must either coincide or be embedded
+    into each other, as for the other programs of the package.
+    If there is one input file, the distances between two first trees in this file are calculated.
+    Otherwise, the distances between the first trees from two input files are calculated.
+    With option --matrix all trees of all input files are read at once and the distances
+    between all pairs of them are printed as PHYLIP matrices or as TSV rows (see matrix.c).
+    With --format binary or binary16 and --output the matrix is written to a binary file as it
+    is computed, with --memory-limit keeping the process within a given size of memory.
+    With option --shard i/k only part i of k of the pairs is computed and written to a
+    file for the program treedist-merge, so the parts can be computed by separate processes.
+    With option --reference the first tree of a file is compared with every tree of the input
+    file while it is read, and a row is printed for every tree (see stream.c).
+
+    For compilation, treedist requires this file, metrics.c, matrix.c, stream.c, splitdict.c, treedist.c, treeread.c,
+    treedb.c, parallel.c, unpack.c, lca.c and treedist.h.
+
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of TreeDist.
+
+    TreeDist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TreeDist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TreeDist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+
+#define FORMATPHYLIP 0
+#define FORMATTSV 1
+#define FORMATBINARY 2
+#define FORMATBINARY16 3
+
+/****************************************************************
+* matrixmain: read all trees of the files and print the distances
+*  between all pairs of them
+*****************************************************************/
+static int matrixmain(unsigned filesnum, char **filename, unsigned *metrics, unsigned metricsnum,
+                      unsigned wanted, unsigned threads, char format,
+                      unsigned shard, unsigned shards, char *outfile, unsigned long memorylimit) {
+  struct treefile infile;
+  struct tree *trees;
+  struct collection coll;
+  struct distmatrix matrix;
+  unsigned treenum, treealloc, f, k;
+
+  treenum = 0;
+  treealloc = 64 * threads;
+  trees = (struct tree*)malloc(sizeof(struct tree) * treealloc);
+  for ( f = 0; f < filesnum; f++ ) {
+    if ( opentrees(&infile, filename[f]) ) {
+      fprintf(stderr, "Can not open input file \"%s\"!\n", filename[f]);
+      exit(1);
+    }
+    for (;;) {
+      if ( treenum + 64 * threads > treealloc ) {
+        treealloc *= 2;
+        trees = (struct tree*)realloc(trees, sizeof(struct tree) * treealloc);
+        if ( trees == NULL ) {
+          fprintf(stderr, "Not enough memory to read \"%s\"\n", filename[f]);
+          exit(1);
+        }
+      }
+      k = readtrees(&infile, trees + treenum, 64 * threads, threads);
+      if ( k == 0 ) break;
+      treenum += k;
+    }
+    closetrees(&infile);
+  }
+  if ( treenum < 2 ) {
+    fprintf(stderr, "Less than two trees in the input!\n");
+    exit(1);
+  }
+
+  threadsnum = 1; /* pairs are shared by threads instead */
+  startcollection(&coll, trees, treenum, wanted, threads);
+  matrix.metricsnum = metricsnum;
+  for ( k = 0; k < metricsnum; k++ ) matrix.metrics[k] = metrics[k];
+  if ( shards > 0 ) {
+    if ( computeshard(&coll, &matrix, shard, shards, threads, outfile) ) {
+      fprintf(stderr, "Can not write output file \"%s\"!\n", outfile);
+      exit(1);
+    }
+  }
+  else if ( format == FORMATBINARY || format == FORMATBINARY16 ) {
+    k = computemapped(&coll, &matrix, threads, outfile, format == FORMATBINARY16, memorylimit);
+    if ( k == 1 ) {
+      fprintf(stderr, "Can not write output file \"%s\"!\n", outfile);
+      exit(1);
+    }
+    if ( k == 2 ) {
+      fprintf(stderr, "Memory limit %lu is too small for %u trees!\n", memorylimit, treenum);
+      exit(1);
+    }
+  }
+  else {
+    computematrix(&coll, &matrix, threads);
+    if ( format == FORMATPHYLIP ) writephylip(stdout, &matrix);
+    else writetsv(stdout, &matrix);
+    freematrix(&matrix);
+  }
+  finishcollection(&coll);
+  for ( k = 0; k < treenum; k++ ) freetree(trees[k]);
+  free(trees);
+  return 0;
+} /* matrixmain */
+
+/****************************************************************
+* referencemain: compare the first tree of reffile with every tree
+*  of filename as they are read
+*****************************************************************/
+static int referencemain(char *reffile, char *filename, unsigned *metrics, unsigned metricsnum,
+                         unsigned wanted, unsigned threads) {
+  struct treefile infile;
+  struct tree reftree;
+  struct reference ref;
+
+  if ( opentrees(&infile, reffile) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", reffile);
+    exit(1);
+  }
+  if ( !readtree(&infile, &reftree) ) {
+    fprintf(stderr, "Wrong tree format in \"%s\"!\n", reffile);
+    exit(1);
+  }
+  closetrees(&infile);
+  if ( opentrees(&infile, filename) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", filename);
+    exit(1);
+  }
+
+  threadsnum = 1; /* trees are shared by threads instead */
+  makereference(&ref, reftree, wanted);
+  if ( comparestream(&ref, &infile, metrics, metricsnum, threads, stdout) == 0 ) {
+    fprintf(stderr, "No trees in \"%s\"!\n", filename);
+    exit(1);
+  }
+  closetrees(&infile);
+  freereference(&ref);
+  freetree(reftree);
+  return 0;
+} /* referencemain */
+
+int main (int argc, char *argv[])
+{
+  struct treefile infile;
+  struct tree intree1, intree2;
+  struct comparison comp;
+  unsigned metrics[METRICSNUM];
+  unsigned metricsnum, wanted, k;
+  char matrixmode = 0, format = FORMATPHYLIP;
+  char *reffile = NULL, *outfile = NULL;
+  unsigned threads = 1, shard = 0, shards = 0;
+  unsigned long memorylimit = 0;
+
+  for ( k = 0; k < METRICSNUM; k++ ) metrics[k] = k;
+  metricsnum = METRICSNUM;
+
+  /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-naive") == 0) naivealgorithms = 1; /* the original algorithms, for checks */
+    else if (strcmp(argv[1], "-t") == 0 && argc > 3) {
+      threads = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : cpucount();
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "--matrix") == 0 || strcmp(argv[1], "-matrix") == 0) matrixmode = 1;
+    else if ((strcmp(argv[1], "--reference") == 0 || strcmp(argv[1], "-reference") == 0) && argc > 3) {
+      reffile = argv[2];
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--shard") == 0 || strcmp(argv[1], "-shard") == 0) && argc > 3) {
+      if ( sscanf(argv[2], "%u/%u", &shard, &shards) != 2 || shard < 1 || shard > shards ) {
+        fprintf(stderr, "Wrong shard \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--output") == 0 || strcmp(argv[1], "-output") == 0) && argc > 3) {
+      outfile = argv[2];
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--memory-limit") == 0 || strcmp(argv[1], "-memory-limit") == 0) && argc > 3) {
+      if ( parsememory(argv[2], &memorylimit) ) {
+        fprintf(stderr, "Wrong memory limit \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--format") == 0 || strcmp(argv[1], "-format") == 0) && argc > 3) {
+      if (strcmp(argv[2], "phylip") == 0) format = FORMATPHYLIP;
+      else if (strcmp(argv[2], "tsv") == 0) format = FORMATTSV;
+      else if (strcmp(argv[2], "binary") == 0) format = FORMATBINARY;
+      else if (strcmp(argv[2], "binary16") == 0) format = FORMATBINARY16;
+      else {
+        fprintf(stderr, "Wrong output format \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--metrics") == 0 || strcmp(argv[1], "-metrics") == 0) && argc > 3) {
+      if ( parsemetrics(argv[2], metrics, &metricsnum) ) {
+        fprintf(stderr, "Wrong list of metrics \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else break;
+    argv++;
+    argc--;
+  }
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s [--metrics <list>] [-naive] [-t <n>] <input tree 1> [<input tree 2>]\n", argv[0]);
+    fprintf(stderr, "       %s --matrix [--format phylip|tsv] [--metrics <list>] [-naive] [-t <n>] <input file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --matrix --format binary|binary16 --output <file> [--memory-limit <size>] [--metrics <list>] [-naive] [-t <n>] <input file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --matrix --shard <i>/<k> --output <part file> [--metrics <list>] [-naive] [-t <n>] <input file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --reference <reference file> [--metrics <list>] [-naive] [-t <n>] <input file>\n", argv[0]);
+    fprintf(stderr, "Example: %s --metrics rf,l2 tree1.tre tree2.tre\n", argv[0]);
+    return 1;
+  }
+  if (strcmp(argv[1], "-h") == 0 ||
+      strcmp(argv[1], "-help") == 0 ||
+      strcmp(argv[1], "--help") == 0 ) {
+    fprintf(stderr, "treedist is a program computing several distances ");
+    fprintf(stderr, "between two phylogenetic trees at once.\n");
+    fprintf(stderr, "Trees should be in Newick format.\n");
+    fprintf(stderr, "Both trees can be in one file or in separate files.\n");
+    fprintf(stderr, "Use \"-\" as a file name to read trees from the standard input.\n");
+    fprintf(stderr, "Option --metrics <list> chooses the distances and their order, a comma-separated\n");
+    fprintf(stderr, "list of rf, rfn, rfa, l1, l2 and quartet (all of them by default). Every distance\n");
+    fprintf(stderr, "is the value computed by the program rf_dist, rf_dist_n, rfa_dist, l1_dist,\n");
+    fprintf(stderr, "l2_dist or quartet_dist, printed with four decimals (quartet_dist prints 0.0\n");
+    fprintf(stderr, "and 1.0 for trees of at most 3 common leaves or of different leaves).\n");
+    fprintf(stderr, "Option -naive uses the original straightforward algorithms (slow, for checks).\n");
+    fprintf(stderr, "Option -t <n> computes every distance on n threads (0 for all processors).\n");
+    fprintf(stderr, "Option --matrix compares all pairs of trees of all input files; with -t <n>\n");
+    fprintf(stderr, "the pairs are shared by n threads. The distances are printed as a square matrix\n");
+    fprintf(stderr, "in the PHYLIP format for every metric (--format phylip, the default) or as one\n");
+    fprintf(stderr, "row for every pair (--format tsv). Trees are named by their numbers.\n");
+    fprintf(stderr, "With --format binary (floats) or binary16 (fixed-point uint16) and --output <file>\n");
+    fprintf(stderr, "the distances are written to a binary file as they are computed (see matrix.c),\n");
+    fprintf(stderr, "and --memory-limit <bytes>[K|M|G] keeps the process within this size of memory.\n");
+    fprintf(stderr, "Option --shard <i>/<k> with --matrix computes only part i of k of the pairs\n");
+    fprintf(stderr, "(parts of about equal work, the same in every run) and writes it to the file\n");
+    fprintf(stderr, "of option --output <part file>; treedist-merge joins the k parts into the matrix.\n");
+    fprintf(stderr, "Option --reference <file> compares the first tree of the file with every tree\n");
+    fprintf(stderr, "of the input file as it is read and prints a row for every tree in their order;\n");
+    fprintf(stderr, "with -t <n> the trees are shared by n threads while another thread reads them.\n");
+    fprintf(stderr, "Usage: %s [--metrics <list>] [-naive] [-t <n>] <input file> [<input file 2>]\n", argv[0]);
+    fprintf(stderr, "       %s --matrix [--format phylip|tsv] [--metrics <list>] [-naive] [-t <n>] <input file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --matrix --format binary|binary16 --output <file> [--memory-limit <size>] [--metrics <list>] [-naive] [-t <n>] <input file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --matrix --shard <i>/<k> --output <part file> [--metrics <list>] [-naive] [-t <n>] <input file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --reference <reference file> [--metrics <list>] [-naive] [-t <n>] <input file>\n", argv[0]);
+    fprintf(stderr, "Example: %s tree1.tre tree2.tre\n", argv[0]);
+    fprintf(stderr, "Example: %s --metrics rf,quartet twotrees.tre\n", argv[0]);
+    fprintf(stderr, "Example: %s --matrix -t 0 --metrics rf bootstrap.tre\n", argv[0]);
+    fprintf(stderr, "Example: %s --matrix -t 0 --metrics rfn --format binary16 --output rfn.bin --memory-limit 4G trees.tdb\n", argv[0]);
+    fprintf(stderr, "Example: %s --matrix --shard 2/8 --output part2.bin bootstrap.tre\n", argv[0]);
+    fprintf(stderr, "Example: gunzip -c genetrees.tre.gz | %s --reference species.tre -t 0 -\n", argv[0]);
+    return 0;
+  }
+
+  wanted = 0;
+  for ( k = 0; k < metricsnum; k++ ) wanted |= 1u << metrics[k];
+  if ( shards > 0 && (!matrixmode || outfile == NULL) ) {
+    fprintf(stderr, "Option --shard needs --matrix and --output!\n");
+    return 1;
+  }
+  if ( (format == FORMATBINARY || format == FORMATBINARY16) && (!matrixmode || outfile == NULL || shards > 0) ) {
+    fprintf(stderr, "A binary format needs --matrix and --output and can not be used with --shard!\n");
+    return 1;
+  }
+  if ( memorylimit > 0 && format != FORMATBINARY && format != FORMATBINARY16 ) {
+    fprintf(stderr, "Option --memory-limit needs a binary format!\n");
+    return 1;
+  }
+  if ( matrixmode ) {
+    return matrixmain(argc - 1, argv + 1, metrics, metricsnum, wanted, threads, format, shard, shards, outfile,
+                      memorylimit);
+  }
+  if ( reffile != NULL ) return referencemain(reffile, argv[1], metrics, metricsnum, wanted, threads);
+  threadsnum = threads;
+
+  if ( opentrees(&infile, argv[1]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+    exit(1);
+  }
+  if ( !readtree(&infile, &intree1) ) {
+    fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[1]);
+    exit(1);
+  }
+
+  if (argc > 2) { /* second tree is in separate file */
+    closetrees(&infile);
+    if ( opentrees(&infile, argv[2]) ) {
+      fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
+      exit(1);
+    }
+  }
+  if ( !readtree(&infile, &intree2) ) {
+    if (argc > 2) {
+      fprintf(stderr, "Wrong tree format in \"%s\"!\n", argv[2]);
+    }
+    else {
+      fprintf(stderr, "Only one tree in \"%s\"!\n", argv[1]);
+    }
+    exit(1);
+  }
+  closetrees(&infile);
+
+  startcomparison(&comp, intree1, intree2, wanted);
+  printf("tree1\ttree2");
+  for ( k = 0; k < metricsnum; k++ ) printf("\t%s", metricnames[metrics[k]]);
+  printf("\n%u\t%u", 1, argc > 2 ? 1 : 2);
+  for ( k = 0; k < metricsnum; k++ ) printf("\t%.4f", metricvalue(&comp, metrics[k]));
+  printf("\n");
+  finishcomparison(&comp);
+  freetree(intree1);
+  freetree(intree2);
+  return 0;
+} /* main */
@@ -0,0 +1,179 @@
+/*  The program "treedist-merge" joins the parts of a matrix of distances computed
+    by "treedist --matrix --shard i/k". With --format binary or binary16 and --output
+    the parts are streamed into the same binary matrix file as "treedist --matrix"
+    writes in these formats, through windows of memory maps, so the matrix is never
+    in RAM as a whole. A small matrix, of at most MAXTEXTTREES trees, can instead be
+    printed as PHYLIP matrices or TSV rows. The parts can be given in any order; all
+    k parts of the same trees and metrics are needed.
+
+    For compilation, treedist-merge requires this file, matrix.c, metrics.c, splitdict.c,
+    treedist.c, treeread.c, treedb.c, parallel.c, unpack.c, lca.c and treedist.h.
+
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of TreeDist.
+
+    TreeDist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TreeDist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TreeDist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+
+#define MAXTEXTTREES 10000 /* trees of a matrix printed as text, held in RAM */
+
+#define FORMATPHYLIP 0
+#define FORMATTSV 1
+#define FORMATBINARY 2
+#define FORMATBINARY16 3
+
+int main (int argc, char *argv[])
+{
+  struct distmatrix matrix;
+  unsigned shards, k, bad;
+  char *seen = NULL, *outfile = NULL;
+  char format = FORMATPHYLIP;
+  unsigned long memorylimit = 0;
+  FILE *out;
+  int result;
+
+  /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if ((strcmp(argv[1], "--format") == 0 || strcmp(argv[1], "-format") == 0) && argc > 3) {
+      if (strcmp(argv[2], "phylip") == 0) format = FORMATPHYLIP;
+      else if (strcmp(argv[2], "tsv") == 0) format = FORMATTSV;
+      else if (strcmp(argv[2], "binary") == 0) format = FORMATBINARY;
+      else if (strcmp(argv[2], "binary16") == 0) format = FORMATBINARY16;
+      else {
+        fprintf(stderr, "Wrong output format \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--output") == 0 || strcmp(argv[1], "-output") == 0) && argc > 3) {
+      outfile = argv[2];
+      argv++;
+      argc--;
+    }
+    else if ((strcmp(argv[1], "--memory-limit") == 0 || strcmp(argv[1], "-memory-limit") == 0) && argc > 3) {
+      if ( parsememory(argv[2], &memorylimit) ) {
+        fprintf(stderr, "Wrong memory limit \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else break;
+    argv++;
+    argc--;
+  }
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s [--format phylip|tsv] [--output <file>] <part file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --format binary|binary16 --output <file> [--memory-limit <size>] <part file> ...\n", argv[0]);
+    fprintf(stderr, "Example: %s --format binary16 --output matrix.bin part*.bin\n", argv[0]);
+    return 1;
+  }
+  if (strcmp(argv[1], "-h") == 0 ||
+      strcmp(argv[1], "-help") == 0 ||
+      strcmp(argv[1], "--help") == 0 ) {
+    fprintf(stderr, "treedist-merge is a program joining the parts of a matrix of distances\n");
+    fprintf(stderr, "between trees computed by \"treedist --matrix --shard <i>/<k> --output <part file>\".\n");
+    fprintf(stderr, "All k parts are needed, in any order. With --format binary (floats) or binary16\n");
+    fprintf(stderr, "(fixed-point uint16) and --output <file> the parts are streamed into the binary\n");
+    fprintf(stderr, "matrix file of treedist --matrix in these formats, a window of the file in memory\n");
+    fprintf(stderr, "at a time; --memory-limit <bytes>[K|M|G] keeps the process within this size.\n");
+    fprintf(stderr, "A matrix of at most %u trees can instead be printed as by treedist --matrix:\n", MAXTEXTTREES);
+    fprintf(stderr, "a square matrix in the PHYLIP format for every metric (--format phylip, the default)\n");
+    fprintf(stderr, "or one row for every pair (--format tsv), to --output <file> or the standard output.\n");
+    fprintf(stderr, "Usage: %s [--format phylip|tsv] [--output <file>] <part file> ...\n", argv[0]);
+    fprintf(stderr, "       %s --format binary|binary16 --output <file> [--memory-limit <size>] <part file> ...\n", argv[0]);
+    fprintf(stderr, "Example: %s --format binary16 --output matrix.bin part*.bin\n", argv[0]);
+    return 0;
+  }
+  if ( (format == FORMATBINARY || format == FORMATBINARY16) && outfile == NULL ) {
+    fprintf(stderr, "A binary format needs --output!\n");
+    return 1;
+  }
+  if ( memorylimit > 0 && format != FORMATBINARY && format != FORMATBINARY16 ) {
+    fprintf(stderr, "Option --memory-limit needs a binary format!\n");
+    return 1;
+  }
+
+  result = checkparts(&matrix, argv + 1, (unsigned)argc - 1, &shards, &bad);
+  if ( result == 1 ) {
+    fprintf(stderr, "Can not read part file \"%s\"!\n", argv[bad + 1]);
+    exit(1);
+  }
+  if ( result == 2 ) {
+    fprintf(stderr, "\"%s\" is not a part of the same matrix or is repeated!\n", argv[bad + 1]);
+    exit(1);
+  }
+  if ( result == 3 ) {
+    fprintf(stderr, "Part %u/%u is missing!\n", bad, shards);
+    exit(1);
+  }
+
+  if ( format == FORMATBINARY || format == FORMATBINARY16 ) {
+    result = mergemapped(&matrix, argv + 1, (unsigned)argc - 1, outfile, format == FORMATBINARY16,
+                         memorylimit, &bad);
+    if ( result == 1 ) {
+      fprintf(stderr, "Can not write binary matrix file \"%s\"!\n", outfile);
+      exit(1);
+    }
+    if ( result == 2 ) {
+      fprintf(stderr, "The memory limit is too small for the matrix!\n");
+      exit(1);
+    }
+    if ( result == 3 ) {
+      fprintf(stderr, "Can not read part file \"%s\" or it is broken!\n", argv[bad + 1]);
+      exit(1);
+    }
+    return 0;
+  }
+
+  if ( matrix.treenum > MAXTEXTTREES ) {
+    fprintf(stderr, "The matrix of %u trees is too big to print, use --format binary or binary16 with --output!\n",
+            matrix.treenum);
+    exit(1);
+  }
+  shards = 0;
+  for ( k = 1; k < (unsigned)argc; k++ ) {
+    result = readpart(&matrix, argv[k], &shards, &seen);
+    if ( result == 1 ) {
+      fprintf(stderr, "Can not read part file \"%s\"!\n", argv[k]);
+      exit(1);
+    }
+    if ( result == 2 ) {
+      fprintf(stderr, "\"%s\" is not a part of the same matrix or is repeated!\n", argv[k]);
+      exit(1);
+    }
+  }
+  out = stdout;
+  if ( outfile != NULL && (out = fopen(outfile, "w")) == NULL ) {
+    fprintf(stderr, "Can not write output file \"%s\"!\n", outfile);
+    exit(1);
+  }
+  if ( format == FORMATPHYLIP ) writephylip(out, &matrix);
+  else writetsv(out, &matrix);
+  if ( out != stdout && fclose(out) != 0 ) {
+    fprintf(stderr, "Can not write output file \"%s\"!\n", outfile);
+    exit(1);
+  }
+  freematrix(&matrix);
+  free(seen);
+  return 0;
+} /* main */
@@ -0,0 +1,180 @@
+/*  The program "treedist-moves" walks from a query tree towards a reference tree
+    by NNI or SPR moves: at every step all moves of the current tree are tried
+    and the one giving the smallest distance to the reference (rf, l1 or l2) is
+    made, until no move makes the distance smaller. The distances of a move are
+    updated from those of the current tree (see moves.c), not found again.
+
+    For compilation, treedist-moves requires this file, moves.c, metrics.c, splitdict.c,
+    treedist.c, treeread.c, treedb.c, parallel.c, unpack.c, lca.c and treedist.h.
+
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of TreeDist.
+
+    TreeDist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TreeDist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TreeDist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+
+/* the query compared with the reference anew, as a check of the moves */
+static void checkmove(struct movecomparison *m, struct tree reference, unsigned metric) {
+  struct comparison c;
+  struct tree query;
+  double kept, found;
+
+  query = movedtree(m);
+  startcomparison(&c, query, reference, 1u << metric);
+  kept = movevalue(m, metric);
+  found = metricvalue(&c, metric);
+  finishcomparison(&c);
+  freetree(query);
+  if ( kept != found ) {
+    fprintf(stderr, "Check failed: %s %.6f after a move, %.6f for the same trees\n",
+            metricnames[metric], kept, found);
+    exit(1);
+  }
+} /* checkmove */
+
+static void readone(char *filename, struct tree *intree) {
+  struct treefile infile;
+
+  if ( opentrees(&infile, filename) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", filename);
+    exit(1);
+  }
+  if ( !readtree(&infile, intree) ) {
+    fprintf(stderr, "Wrong tree format in \"%s\"!\n", filename);
+    exit(1);
+  }
+  closetrees(&infile);
+} /* readone */
+
+int main (int argc, char *argv[])
+{
+  struct movecomparison m;
+  struct tree reference, query;
+  unsigned metric = METRICRF, steps = 0, step, s, t, w, u, bests, bestt;
+  unsigned long tried;
+  double value, best;
+  char spr = 0, check = 0;
+  char *newick;
+  int result;
+
+  /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-metric") == 0 && argc > 2) {
+      if (strcmp(argv[2], "rf") == 0) metric = METRICRF;
+      else if (strcmp(argv[2], "l1") == 0) metric = METRICL1;
+      else if (strcmp(argv[2], "l2") == 0) metric = METRICL2;
+      else {
+        fprintf(stderr, "Metric \"%s\" is not one of rf, l1, l2!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-steps") == 0 && argc > 2) {
+      steps = (unsigned)atoi(argv[2]);
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-spr") == 0) spr = 1;
+    else if (strcmp(argv[1], "-check") == 0) check = 1;
+    else break;
+    argv++;
+    argc--;
+  }
+  if (argc < 2 || (argc < 3 && strcmp(argv[1], "-h") != 0 && strcmp(argv[1], "-help") != 0
+                   && strcmp(argv[1], "--help") != 0))
+  {
+    fprintf(stderr, "Usage: %s [-metric rf|l1|l2] [-spr] [-steps n] [-check] <reference tree> <query tree>\n", argv[0]);
+    fprintf(stderr, "Example: %s -metric l1 -spr species.tre gene.tre > moved.tre\n", argv[0]);
+    return 1;
+  }
+  if (strcmp(argv[1], "-h") == 0 ||
+      strcmp(argv[1], "-help") == 0 ||
+      strcmp(argv[1], "--help") == 0 ) {
+    fprintf(stderr, "treedist-moves is a program moving a binary query tree towards a reference\n");
+    fprintf(stderr, "tree of the same leaves: at every step the NNI (or, with -spr, SPR) move giving\n");
+    fprintf(stderr, "the smallest distance to the reference is made, while the distance gets smaller,\n");
+    fprintf(stderr, "at most -steps times if given. The distance (-metric rf, l1 or l2, rf by default)\n");
+    fprintf(stderr, "of a move is updated from that of the current tree instead of being found anew.\n");
+    fprintf(stderr, "The distance after every step goes to the standard error, the last tree to the\n");
+    fprintf(stderr, "standard output. Option -check compares every move with the tree made anew.\n");
+    fprintf(stderr, "Usage: %s [-metric rf|l1|l2] [-spr] [-steps n] [-check] <reference tree> <query tree>\n", argv[0]);
+    fprintf(stderr, "Example: %s -metric l1 -spr species.tre gene.tre > moved.tre\n", argv[0]);
+    return 0;
+  }
+
+  readone(argv[1], &reference);
+  readone(argv[2], &query);
+  result = startmoves(&m, reference, query, metric != METRICRF);
+  if ( result == 1 ) {
+    fprintf(stderr, "The trees should have the same leaves, at least 4!\n");
+    exit(1);
+  }
+  if ( result == 2 ) {
+    fprintf(stderr, "The query tree \"%s\" is not binary!\n", argv[2]);
+    exit(1);
+  }
+  if ( result == 3 ) {
+    fprintf(stderr, "The trees are too big for paths of 16 bits!\n");
+    exit(1);
+  }
+  freetree(query);
+
+  best = movevalue(&m, metric);
+  if ( check ) checkmove(&m, reference, metric);
+  fprintf(stderr, "Start: %s %.4f\n", metricnames[metric], best);
+  for ( step = 1; steps == 0 || step <= steps; step++ ) {
+    /* a move is tried and undone by grafting the subtree back on its old sibling */
+    bests = bestt = MOVENONE;
+    tried = 0;
+    for ( s = 1; s < m.nodesnum; s++ ) {
+      u = m.parent[s];
+      if ( u == 0 || (!spr && m.parent[u] == 0) ) continue;
+      w = m.child[2 * u] == s ? m.child[2 * u + 1] : m.child[2 * u];
+      for ( t = 1; t < m.nodesnum; t++ ) {
+        if ( !spr ) { /* NNI: s onto the sibling of its parent */
+          t = m.child[2 * m.parent[u]] == u ? m.child[2 * m.parent[u] + 1] : m.child[2 * m.parent[u]];
+        }
+        if ( t != w && sprmove(&m, s, t) == 0 ) {
+          tried++;
+          value = movevalue(&m, metric);
+          if ( check ) checkmove(&m, reference, metric);
+          if ( value < best ) {
+            best = value;
+            bests = s;
+            bestt = t;
+          }
+          sprmove(&m, s, w);
+        }
+        if ( !spr ) break;
+      }
+    }
+    if ( bests == MOVENONE ) break;
+    sprmove(&m, bests, bestt);
+    fprintf(stderr, "Step %u: %s %.4f, %lu moves tried\n", step, metricnames[metric], best, tried);
+  }
+
+  newick = movednewick(&m);
+  printf("%s\n", newick);
+  free(newick);
+  finishmoves(&m);
+  freetree(reference);
+  return 0;
+} /* main */
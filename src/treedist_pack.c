@@ -0,0 +1,88 @@
+/*  The program "treedist-pack" converts trees in Newick format into a file
+    of pre-parsed trees (.tdb), which all programs of the package read
+    instead of Newick without parsing. One tree of a .tdb file can be
+    loaded without reading the others.
+    All trees of the input file are written, in the same order.
+
+    For compilation, treedist-pack requires this file, treedist.c, treeread.c,
+    treedb.c, parallel.c and treedist.h.
+
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin 
+
+    This file is part of TreeDist.
+
+    TreeDist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TreeDist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TreeDist (a file named "COPYING.txt"). 
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+
+int main (int argc, char *argv[])
+{
+  struct treefile infile;
+  struct tdbwriter outfile;
+  struct tree *trees;
+  unsigned threads, batch, num, k;
+
+  /* Checking command line */
+  if (argc < 3)
+  {
+    if (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
+                      strcmp(argv[1], "-help") == 0 ||
+                      strcmp(argv[1], "--help") == 0) ) {
+      fprintf(stderr, "treedist-pack converts phylogenetic trees in Newick format ");
+      fprintf(stderr, "into a binary file of pre-parsed trees.\n");
+      fprintf(stderr, "The output file can be given to any program of the package instead of Newick.\n");
+      fprintf(stderr, "Use \"-\" as the input file name to read trees from the standard input.\n");
+      fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+      fprintf(stderr, "Example: %s bootstrap.tre bootstrap.tdb\n", argv[0]);
+      return 0;
+    }
+    fprintf(stderr, "Usage: %s <input file> <output file>\n", argv[0]);
+    fprintf(stderr, "Example: %s bootstrap.tre bootstrap.tdb\n", argv[0]);
+    return 1;
+  }
+
+  if ( opentrees(&infile, argv[1]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+    exit(1);
+  }
+  if ( createtreedb(&outfile, argv[2]) ) {
+    fprintf(stderr, "Can not create output file \"%s\"!\n", argv[2]);
+    exit(1);
+  }
+  /* trees are parsed in parallel by batches and written in the input order */
+  threads = cpucount();
+  batch = 64 * threads;
+  trees = (struct tree*)malloc(sizeof(struct tree) * batch);
+  while ( (num = readtrees(&infile, trees, batch, threads)) > 0 ) {
+    for ( k = 0; k < num; k++ ) {
+      if ( writetreedb(&outfile, trees[k]) ) {
+        fprintf(stderr, "Can not write to \"%s\"!\n", argv[2]);
+        exit(1);
+      }
+      freetree(trees[k]);
+    }
+  }
+  free(trees);
+  closetrees(&infile);
+  if ( finishtreedb(&outfile) ) {
+    fprintf(stderr, "Can not write to \"%s\"!\n", argv[2]);
+    exit(1);
+  }
+  fprintf(stderr, "%u trees written to \"%s\"\n", outfile.treenum, argv[2]);
+  return 0;
+} /* main */
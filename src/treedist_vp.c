@@ -0,0 +1,309 @@
+/*  The program "treedist-vp" finds the trees of a collection closest to given trees
+    exactly, by rf (as rf_dist), l1 (as l1_dist) or l2 (as l2_dist). These distances
+    are metrics for trees of the same leaves, so a vantage-point tree of the collection
+    (see vptree.c) lets the search skip most of the trees by the triangle inequality.
+    First the index is made and written next to the trees (trees.tdb gives trees.vpt);
+    then for every query tree the k nearest trees or all trees within a distance are
+    printed, and the number of distances computed and avoided is reported.
+    All trees of the collection and the queries must have the same leaves.
+
+    For compilation, treedist-vp requires this file, vptree.c, metrics.c, splitdict.c,
+    treedist.c, treeread.c, treedb.c, parallel.c, unpack.c, lca.c and treedist.h.
+
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of TreeDist.
+
+    TreeDist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TreeDist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TreeDist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+
+/* A query compared with trees of the collection */
+struct queryjob {
+  struct reference ref;
+  struct treefile *infile;
+  struct tree *trees; /* all trees, or NULL if they are loaded from the .tdb file */
+  unsigned metric;
+  char *filename;
+};
+
+/* the distance of the index from the query to tree k, the printed one into *value */
+static double querydistance(void *arg, unsigned k, double *value) {
+  struct queryjob *job = (struct queryjob*)arg;
+  struct comparison comp;
+  struct tree intree;
+  double result;
+
+  if ( job->trees == NULL ) {
+    if ( loadtree(&job->infile->db, k, &intree) ) {
+      fprintf(stderr, "Damaged tree #%u in \"%s\"\n", k + 1, job->filename);
+      exit(1);
+    }
+  }
+  else intree = job->trees[k];
+  startreference(&comp, &job->ref, intree);
+  *value = metricvalue(&comp, job->metric);
+  result = vpdistance(&comp, job->metric);
+  finishcomparison(&comp);
+  if ( job->trees == NULL ) freetree(intree);
+  return result;
+} /* querydistance */
+
+/* 1 if a query has the leaves of a tree of the collection */
+static int sameleaves(struct tree query, struct tree intree) {
+  unsigned k;
+
+  if ( query.leavesnum != intree.leavesnum ) return 0;
+  for ( k = 0; k < query.leavesnum; k++ ) {
+    if ( findleaf(intree, query.leaf[k]) >= intree.leavesnum ) return 0;
+  }
+  return 1;
+} /* sameleaves */
+
+/* the index of a file of trees: its name with .vpt instead of .tdb or added */
+static char *indexname(char *treefile) {
+  char *name;
+  size_t length;
+
+  length = strlen(treefile);
+  name = (char*)malloc(length + 5);
+  strcpy(name, treefile);
+  if ( length > 4 && strcmp(name + length - 4, ".tdb") == 0 ) length -= 4;
+  strcpy(name + length, ".vpt");
+  return name;
+} /* indexname */
+
+/****************************************************************
+* buildindex: make the vantage-point tree of all trees of a file
+*****************************************************************/
+static int buildindex(char *treefile, char *indexfile, unsigned metric, unsigned threads) {
+  struct treefile infile;
+  struct tree *trees;
+  struct collection coll;
+  struct vptree vp;
+  unsigned treenum, treealloc, k;
+
+  if ( opentrees(&infile, treefile) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", treefile);
+    exit(1);
+  }
+  treenum = 0;
+  treealloc = 64 * threads;
+  trees = (struct tree*)malloc(sizeof(struct tree) * treealloc);
+  while ( (k = readtrees(&infile, trees + treenum, 64 * threads, threads)) > 0 ) {
+    treenum += k;
+    if ( treenum + 64 * threads > treealloc ) {
+      treealloc *= 2;
+      trees = (struct tree*)realloc(trees, sizeof(struct tree) * treealloc);
+      if ( trees == NULL ) {
+        fprintf(stderr, "Not enough memory for %u trees\n", treenum);
+        exit(1);
+      }
+    }
+  }
+  closetrees(&infile);
+  if ( treenum == 0 ) {
+    fprintf(stderr, "No trees in \"%s\"!\n", treefile);
+    exit(1);
+  }
+
+  threadsnum = 1; /* the trees of a node are shared by threads instead */
+  startcollection(&coll, trees, treenum, 1u << metric, threads);
+  if ( !coll.sameleaves ) {
+    fprintf(stderr, "The trees of \"%s\" should have the same leaves, each once!\n", treefile);
+    exit(1);
+  }
+  if ( trees[0].leavesnum < 4 ) {
+    fprintf(stderr, "The trees of \"%s\" should have at least 4 leaves!\n", treefile);
+    exit(1);
+  }
+  for ( k = 0; k < treenum && metric == METRICRF; k++ ) { /* rf of two of them would be 0/0 */
+    if ( trees[k].branchnum <= trees[k].leavesnum ) {
+      fprintf(stderr, "Tree #%u of \"%s\" has no inner branches, rf is not defined for it!\n", k + 1, treefile);
+      exit(1);
+    }
+  }
+  makevptree(&vp, &coll, metric, threads);
+  if ( writevptree(&vp, indexfile) ) {
+    fprintf(stderr, "Can not write to \"%s\"!\n", indexfile);
+    exit(1);
+  }
+  fprintf(stderr, "%u trees indexed by %s in \"%s\"\n", treenum, metricnames[metric], indexfile);
+  freevptree(&vp);
+  finishcollection(&coll);
+  for ( k = 0; k < treenum; k++ ) freetree(trees[k]);
+  free(trees);
+  return 0;
+} /* buildindex */
+
+int main (int argc, char *argv[])
+{
+  struct treefile infile, queryfile;
+  struct queryjob job;
+  struct vptree vp;
+  struct tree query, first;
+  struct vpmember *found;
+  unsigned metrics[METRICSNUM];
+  unsigned metricsnum = 1, nearest = 10, threads = 1, treenum, querynum, count, computed, k;
+  unsigned long long allcomputed = 0;
+  double radius = -1.0, scale;
+  char build = 0, *indexfile = NULL;
+
+  metrics[0] = METRICRF;
+
+  /* Checking command line */
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    if (strcmp(argv[1], "-build") == 0) build = 1;
+    else if (strcmp(argv[1], "-metric") == 0 && argc > 3) {
+      if ( parsemetrics(argv[2], metrics, &metricsnum) || metricsnum != 1
+           || (metrics[0] != METRICRF && metrics[0] != METRICL1 && metrics[0] != METRICL2) ) {
+        fprintf(stderr, "Wrong metric \"%s\", it should be rf, l1 or l2!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-index") == 0 && argc > 3) {
+      indexfile = argv[2];
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-t") == 0 && argc > 3) {
+      threads = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : cpucount();
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-k") == 0 && argc > 3) {
+      nearest = atoi(argv[2]) > 0 ? (unsigned)atoi(argv[2]) : nearest;
+      argv++;
+      argc--;
+    }
+    else if (strcmp(argv[1], "-range") == 0 && argc > 3) {
+      radius = atof(argv[2]);
+      if ( radius < 0.0 ) {
+        fprintf(stderr, "Wrong range \"%s\"!\n", argv[2]);
+        return 1;
+      }
+      argv++;
+      argc--;
+    }
+    else break;
+    argv++;
+    argc--;
+  }
+  if (argc == 2 && (strcmp(argv[1], "-h") == 0 ||
+                    strcmp(argv[1], "-help") == 0 ||
+                    strcmp(argv[1], "--help") == 0) ) {
+    fprintf(stderr, "treedist-vp finds exactly the trees of a collection closest to query trees.\n");
+    fprintf(stderr, "Option -build makes an index (a vantage-point tree) of the trees of a file\n");
+    fprintf(stderr, "(Newick or .tdb) by -metric rf, l1 or l2 (rf by default) on -t <n> threads\n");
+    fprintf(stderr, "(0 for all processors); it is written next to the trees, with the extension .vpt,\n");
+    fprintf(stderr, "or to the file of option -index <file>.\n");
+    fprintf(stderr, "Without -build, for every tree of the query file the -k <n> nearest trees (10 by\n");
+    fprintf(stderr, "default) or, with -range <r>, all trees within distance r are printed, and\n");
+    fprintf(stderr, "the number of distances computed and avoided is printed to the stderr.\n");
+    fprintf(stderr, "All trees must have the same leaves, at least 4, and for rf inner branches.\n");
+    fprintf(stderr, "The indexed file should be a .tdb file\n");
+    fprintf(stderr, "(see treedist-pack) to load the compared trees only.\n");
+    fprintf(stderr, "Usage: %s -build [-metric rf|l1|l2] [-t <n>] [-index <index>] <trees>\n", argv[0]);
+    fprintf(stderr, "       %s [-k <n> | -range <r>] [-index <index>] <trees> <queries>\n", argv[0]);
+    fprintf(stderr, "Example: %s -build -metric l2 -t 0 genetrees.tdb\n", argv[0]);
+    fprintf(stderr, "Example: %s -k 5 genetrees.tdb query.tre\n", argv[0]);
+    return 0;
+  }
+  if ( (build && argc < 2) || (!build && argc < 3) ) {
+    fprintf(stderr, "Usage: %s -build [-metric rf|l1|l2] [-t <n>] [-index <index>] <trees>\n", argv[0]);
+    fprintf(stderr, "       %s [-k <n> | -range <r>] [-index <index>] <trees> <queries>\n", argv[0]);
+    return 1;
+  }
+  if ( indexfile == NULL ) indexfile = indexname(argv[1]);
+  if ( build ) return buildindex(argv[1], indexfile, metrics[0], threads);
+
+  k = readvptree(&vp, indexfile);
+  if ( k ) {
+    fprintf(stderr, k == 1 ? "Can not open input file \"%s\"!\n" : "Wrong index file \"%s\"!\n", indexfile);
+    exit(1);
+  }
+  if ( opentrees(&infile, argv[1]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[1]);
+    exit(1);
+  }
+  job.infile = &infile;
+  job.metric = vp.metric;
+  job.filename = argv[1];
+  job.trees = NULL;
+  if ( infile.isdb ) treenum = infile.db.treenum; /* compared trees are loaded by loadtree() */
+  else { /* all trees are parsed */
+    job.trees = (struct tree*)malloc(sizeof(struct tree) * (vp.treenum + 1));
+    treenum = readtrees(&infile, job.trees, vp.treenum + 1, cpucount());
+  }
+  if ( treenum != vp.treenum || treenum == 0 || vp.leavesnum < 4 ) {
+    fprintf(stderr, "The index \"%s\" is not made of \"%s\"!\n", indexfile, argv[1]);
+    exit(1);
+  }
+  if ( job.trees != NULL ) first = job.trees[0];
+  else if ( loadtree(&infile.db, 0, &first) ) {
+    fprintf(stderr, "Damaged tree #1 in \"%s\"\n", argv[1]);
+    exit(1);
+  }
+  if ( opentrees(&queryfile, argv[2]) ) {
+    fprintf(stderr, "Can not open input file \"%s\"!\n", argv[2]);
+    exit(1);
+  }
+
+  printf("query\trank\ttree\t%s\n", metricnames[vp.metric]);
+  querynum = 0;
+  while ( readtree(&queryfile, &query) ) {
+    querynum++;
+    if ( !sameleaves(query, first) ) {
+      fprintf(stderr, "Query #%u has other leaves than the trees of \"%s\"!\n", querynum, argv[1]);
+      exit(1);
+    }
+    if ( vp.metric == METRICRF && query.branchnum <= query.leavesnum ) {
+      fprintf(stderr, "Query #%u has no inner branches, rf is not defined for it!\n", querynum);
+      exit(1);
+    }
+    /* rf of a tree within the radius is a number of splits within the radius
+       times the inner branches of both trees */
+    scale = vp.metric == METRICRF ? (double)(query.branchnum - query.leavesnum + vp.maxinner) : 1.0;
+    makereference(&job.ref, query, 1u << vp.metric);
+    found = searchvptree(&vp, radius < 0.0 ? nearest : 0, radius, scale, querydistance, &job, &count, &computed);
+    freereference(&job.ref);
+    freetree(query);
+    for ( k = 0; k < count; k++ ) {
+      printf("%u\t%u\t%u\t%.4f\n", querynum, k + 1, found[k].tree + 1, found[k].distance);
+    }
+    free(found);
+    fprintf(stderr, "Query #%u: %u of %u distances computed, %u avoided\n",
+            querynum, computed, treenum, treenum - computed);
+    allcomputed += computed;
+  }
+  if ( querynum > 0 ) {
+    fprintf(stderr, "%u queries, %.1f of %u distances computed per query (%.1f%% avoided)\n", querynum,
+            (double)allcomputed / querynum, treenum, 100.0 - 100.0 * allcomputed / ((double)querynum * treenum));
+  }
+  closetrees(&queryfile);
+  if ( job.trees != NULL ) {
+    for ( k = 0; k < treenum; k++ ) freetree(job.trees[k]);
+    free(job.trees);
+  }
+  else freetree(first);
+  closetrees(&infile);
+  freevptree(&vp);
+  return 0;
+} /* main */
@@ -0,0 +1,317 @@
+/*  treeread.c is the input layer of Treedist package: it splits a file
+    (or the standard input) into ';'-terminated Newick trees.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "treedist.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define READBLOCK 1048576
+
+/* startunpack() for opentrees(), the file is closed if it fails */
+static int startreading(struct treefile *infile) {
+  if ( startunpack(infile) ) {
+    closetrees(infile);
+    return 1;
+  }
+  return 0;
+} /* startreading */
+
+/****************************************************************
+* opentrees: open a file of trees, "-" stands for the stdin.
+*  A regular file is mapped into memory, anything else is read
+*  by big blocks. A mapped .tdb file is read by loadtree(),
+*  a gzip or zstd file is decompressed on the fly (see unpack.c).
+*  Returns 0 on success.
+*****************************************************************/
+int opentrees(struct treefile *infile, char *filename) {
+  struct stat st;
+  int fd;
+
+  infile->name = filename;
+  infile->stream = NULL;
+  infile->data = NULL;
+  infile->size = 0;
+  infile->pos = 0;
+  infile->bufsize = 0;
+  infile->mapped = 0;
+  infile->isdb = 0;
+  infile->treeindex = 0;
+
+  infile->unpack = NULL;
+
+  if ( strcmp(filename, "-") == 0 ) {
+    infile->stream = stdin;
+    return startreading(infile);
+  }
+  fd = open(filename, O_RDONLY);
+  if ( fd < 0 ) return 1;
+  if ( fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ) {
+    if ( st.st_size > 0 ) {
+      infile->data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if ( infile->data != MAP_FAILED ) {
+        madvise(infile->data, st.st_size, MADV_SEQUENTIAL);
+        infile->size = st.st_size;
+        infile->mapped = 1;
+        close(fd);
+        if ( istreedb(infile->data, infile->size) ) {
+          if ( maptreedb(&infile->db, infile->data, infile->size) ) {
+            closetrees(infile);
+            return 1;
+          }
+          madvise(infile->data, st.st_size, MADV_RANDOM);
+          infile->isdb = 1;
+          return 0;
+        }
+        return startreading(infile);
+      }
+      infile->data = NULL;
+    }
+    else { /* empty file */
+      close(fd);
+      return 0;
+    }
+  }
+  infile->stream = fdopen(fd, "r");
+  if ( infile->stream == NULL ) {
+    close(fd);
+    return 1;
+  }
+  return startreading(infile);
+} /* opentrees */
+
+/* Trees parsed in parallel by readtrees() */
+struct parsejob {
+  char **text; /* Newick strings */
+  struct tree *trees;
+  struct treefile *infile;
+  unsigned first; /* index of the first tree in a .tdb file */
+};
+
+/****************************************************************
+* treeend: the ';' ending the tree that starts at start, or NULL.
+*  A ';' inside a quoted label or a comment [...] does not end
+*  a tree; readbrackets() skips them in the same way, and a quote
+*  inside a name does not start a label (see quotedlabel()).
+*****************************************************************/
+static char *treeend(char *start, size_t rest) {
+  char *end, *stop, *p;
+
+  end = (char*)memchr(start, ';', rest);
+  if ( end == NULL ) return NULL;
+  if ( memchr(start, '\'', end - start) == NULL && memchr(start, '[', end - start) == NULL ) {
+    return end; /* the usual case */
+  }
+  stop = start + rest;
+  for ( p = start; p < stop; p++ ) {
+    if ( *p == ';' ) return p;
+    if ( *p == '[' ) {
+      p = (char*)memchr(p + 1, ']', stop - p - 1);
+      if ( p == NULL ) return NULL;
+    }
+    else if ( *p == '\'' && quotedlabel(start, p - start) ) {
+      for (;;) { /* '' inside the label is one quote */
+        p = (char*)memchr(p + 1, '\'', stop - p - 1);
+        if ( p == NULL ) return NULL;
+        if ( p + 1 == stop || p[1] != '\'' ) break;
+        p++;
+      }
+    }
+  }
+  return NULL;
+} /* treeend */
+
+/****************************************************************
+* nexttree: return the next tree of the file (its text up to
+*  and including ';') and its length in *len, or NULL if there
+*  is no more complete tree. For a mapped file the tree is
+*  a part of the mapping; for a stream it is valid until
+*  the next call.
+*****************************************************************/
+char *nexttree(struct treefile *infile, size_t *len) {
+  char *start, *end;
+  size_t rest, got;
+
+  if ( infile->isdb ) return NULL;
+  for (;;) {
+    start = infile->data + infile->pos;
+    rest = infile->size - infile->pos;
+    end = rest > 0 ? treeend(start, rest) : NULL;
+    if ( end != NULL ) {
+      *len = end - start + 1;
+      infile->pos += *len;
+      return start;
+    }
+    if ( infile->stream == NULL || feof(infile->stream) ) return NULL;
+
+    /* moving the incomplete tree to the buffer start and reading more */
+    if ( infile->pos > 0 ) {
+      memmove(infile->data, start, rest);
+      infile->size = rest;
+      infile->pos = 0;
+    }
+    if ( infile->size == infile->bufsize ) {
+      infile->bufsize = infile->bufsize ? 2 * infile->bufsize : READBLOCK;
+      infile->data = (char*)realloc(infile->data, infile->bufsize);
+      if ( infile->data == NULL ) {
+        fprintf(stderr, "Not enough memory to read \"%s\"\n", infile->name);
+        exit(1);
+      }
+    }
+    got = fread(infile->data + infile->size, 1, infile->bufsize - infile->size, infile->stream);
+    infile->size += got;
+    if ( got == 0 && ferror(infile->stream) ) return NULL;
+  }
+} /* nexttree */
+
+/****************************************************************
+* readtree: parse the next tree of the file into *intree,
+*  return 0 if there is no more trees
+*****************************************************************/
+int readtree(struct treefile *infile, struct tree *intree) {
+  size_t len;
+  char *newick;
+
+  if ( infile->isdb ) {
+    if ( infile->treeindex >= infile->db.treenum ) return 0;
+    if ( loadtree(&infile->db, infile->treeindex, intree) ) {
+      fprintf(stderr, "Damaged tree #%u in \"%s\"\n", infile->treeindex + 1, infile->name);
+      exit(1);
+    }
+    infile->treeindex++;
+    return 1;
+  }
+  newick = nexttree(infile, &len);
+  if ( newick == NULL ) return 0;
+  *intree = readbrackets(newick);
+  return 1;
+} /* readtree */
+
+/****************************************************************
+* readtreeskeleton: read the next tree of the file as a skeleton
+*  (see readskeleton()), return 0 if there is no more trees
+*****************************************************************/
+int readtreeskeleton(struct treefile *infile, struct skeleton *inskeleton) {
+  struct tree intree;
+  size_t len;
+  char *newick;
+
+  if ( infile->isdb ) {
+    if ( !readtree(infile, &intree) ) return 0;
+    *inskeleton = treeskeleton(intree);
+    freetree(intree);
+    return 1;
+  }
+  newick = nexttree(infile, &len);
+  if ( newick == NULL ) return 0;
+  *inskeleton = readskeleton(newick);
+  return 1;
+} /* readtreeskeleton */
+
+static void parseone(void *arg, unsigned k) {
+  struct parsejob *job = (struct parsejob*)arg;
+
+  if ( job->text != NULL ) {
+    job->trees[k] = readbrackets(job->text[k]);
+  }
+  else if ( loadtree(&job->infile->db, job->first + k, job->trees + k) ) {
+    fprintf(stderr, "Damaged tree #%u in \"%s\"\n", job->first + k + 1, job->infile->name);
+    exit(1);
+  }
+} /* parseone */
+
+/****************************************************************
+* readtrees: parse up to maxtrees next trees of the file into
+*  trees[], using up to threads threads, and return the number
+*  of trees. The order of the file is kept. Trees of a mapped
+*  file are parsed in place, those of a stream are copied first.
+*  Every tree is one malloc() block, and glibc gives each thread
+*  its own malloc arena, so the threads do not wait for each other.
+*****************************************************************/
+unsigned readtrees(struct treefile *infile, struct tree *trees, unsigned maxtrees, unsigned threads) {
+  struct parsejob job;
+  char *newick, *text = NULL;
+  size_t len, textsize = 0, textalloc = 0;
+  size_t *offset = NULL;
+  unsigned num = 0, k;
+
+  job.trees = trees;
+  job.infile = infile;
+  job.text = NULL;
+  if ( infile->isdb ) {
+    num = infile->db.treenum - infile->treeindex;
+    if ( num > maxtrees ) num = maxtrees;
+    job.first = infile->treeindex;
+    runparallel(threads, num, parseone, &job);
+    infile->treeindex += num;
+    return num;
+  }
+
+  job.text = (char**)malloc(sizeof(char*) * (maxtrees + 1));
+  if ( !infile->mapped ) offset = (size_t*)malloc(sizeof(size_t) * (maxtrees + 1));
+  while ( num < maxtrees && (newick = nexttree(infile, &len)) != NULL ) {
+    if ( infile->mapped ) {
+      job.text[num++] = newick;
+      continue;
+    }
+    if ( textsize + len > textalloc ) { /* the stream buffer is reused, so the tree is copied */
+      textalloc = 2 * (textsize + len);
+      text = (char*)realloc(text, textalloc);
+      if ( text == NULL ) {
+        fprintf(stderr, "Not enough memory to read \"%s\"\n", infile->name);
+        exit(1);
+      }
+    }
+    memcpy(text + textsize, newick, len);
+    offset[num++] = textsize;
+    textsize += len;
+  }
+  if ( !infile->mapped ) {
+    for ( k = 0; k < num; k++ ) job.text[k] = text + offset[k];
+  }
+  runparallel(threads, num, parseone, &job);
+  free(job.text);
+  free(offset);
+  free(text);
+  return num;
+} /* readtrees */
+
+/****************************************************************
+* closetrees: release the mapping or the buffer of a file
+*****************************************************************/
+void closetrees(struct treefile *infile) {
+  if ( infile->mapped ) {
+    munmap(infile->data, infile->size);
+  }
+  else {
+    free(infile->data);
+  }
+  if ( infile->stream != NULL && infile->stream != stdin ) {
+    fclose(infile->stream);
+  }
+  stopunpack(infile);
+  infile->data = NULL;
+  infile->stream = NULL;
+} /* closetrees */
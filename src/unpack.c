@@ -0,0 +1,291 @@
+/*  unpack.c decompresses gzip and zstd files of trees on the fly
+    for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  A compressed file is recognized by its first bytes. A separate
+    thread decompresses it into a pipe, and the file is then read
+    from the other end of the pipe as a usual stream, so parsing
+    goes on while the next block is decompressed.
+    zstd is supported if the package is compiled with HAVE_ZSTD
+    defined ("make ZSTD=1").
+*/
+
+#include "treedist.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define UNPACKBLOCK 1048576
+#define PIPESIZE 1048576
+
+#define PACKED_NONE 0
+#define PACKED_GZIP 1
+#define PACKED_ZSTD 2
+
+struct unpacker {
+  char *name; /* file name for messages */
+  int format; /* PACKED_GZIP or PACKED_ZSTD */
+  char *in; /* the mapped compressed file, or NULL */
+  size_t insize;
+  size_t inpos;
+  FILE *stream; /* the compressed stream if the file is not mapped */
+  char head[4]; /* bytes read from the stream to recognize it */
+  size_t headlen;
+  char *inbuf;
+  int out; /* the write end of the pipe */
+  pthread_t thread;
+};
+
+/****************************************************************
+* packedformat: which compression a file starting with data uses
+*****************************************************************/
+static int packedformat(const char *data, size_t size) {
+  const unsigned char *b = (const unsigned char*)data;
+
+  if ( size >= 2 && b[0] == 0x1f && b[1] == 0x8b ) return PACKED_GZIP;
+  if ( size >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd ) return PACKED_ZSTD;
+  return PACKED_NONE;
+} /* packedformat */
+
+/****************************************************************
+* readpacked: the next block of compressed data and its length,
+*  0 at the end of the file
+*****************************************************************/
+static size_t readpacked(struct unpacker *unpack, char **block) {
+  size_t len;
+
+  if ( unpack->in != NULL ) { /* zlib takes at most 4 GB at once */
+    len = unpack->insize - unpack->inpos;
+    if ( len > ((size_t)1 << 30) ) len = (size_t)1 << 30;
+    *block = unpack->in + unpack->inpos;
+    unpack->inpos += len;
+    return len;
+  }
+  if ( unpack->headlen > 0 ) {
+    len = unpack->headlen;
+    unpack->headlen = 0;
+    *block = unpack->head;
+    return len;
+  }
+  len = fread(unpack->inbuf, 1, UNPACKBLOCK, unpack->stream);
+  if ( len == 0 && ferror(unpack->stream) ) {
+    fprintf(stderr, "Can not read \"%s\"\n", unpack->name);
+    exit(1);
+  }
+  *block = unpack->inbuf;
+  return len;
+} /* readpacked */
+
+/****************************************************************
+* writeunpacked: write a block into the pipe, return 1 if
+*  the reader has closed it
+*****************************************************************/
+static int writeunpacked(struct unpacker *unpack, const char *data, size_t len) {
+  ssize_t done;
+
+  while ( len > 0 ) {
+    done = write(unpack->out, data, len);
+    if ( done < 0 ) {
+      if ( errno == EINTR ) continue;
+      return 1;
+    }
+    data += done;
+    len -= done;
+  }
+  return 0;
+} /* writeunpacked */
+
+static void damaged(struct unpacker *unpack) {
+  fprintf(stderr, "Damaged compressed file \"%s\"\n", unpack->name);
+  exit(1);
+} /* damaged */
+
+/****************************************************************
+* gunzip: decompress a gzip file, concatenated members included
+*****************************************************************/
+static void gunzip(struct unpacker *unpack, char *outbuf) {
+  z_stream zs;
+  char *block;
+  size_t len;
+  int ret = Z_OK;
+
+  memset(&zs, 0, sizeof(zs));
+  if ( inflateInit2(&zs, 15 + 16) != Z_OK ) damaged(unpack);
+  zs.avail_out = UNPACKBLOCK;
+  /* a full output block may leave output inside zlib, so after the last
+     block of input it is called with no input until the output is not full */
+  do {
+    len = readpacked(unpack, &block);
+    zs.next_in = (Bytef*)block;
+    zs.avail_in = len;
+    while ( zs.avail_in > 0 || (zs.avail_out == 0 && ret != Z_STREAM_END) ) {
+      if ( ret == Z_STREAM_END ) inflateReset(&zs); /* the next member */
+      zs.next_out = (Bytef*)outbuf;
+      zs.avail_out = UNPACKBLOCK;
+      ret = inflate(&zs, Z_NO_FLUSH);
+      if ( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR ) damaged(unpack);
+      if ( writeunpacked(unpack, outbuf, UNPACKBLOCK - zs.avail_out) ) {
+        inflateEnd(&zs);
+        return;
+      }
+    }
+  } while ( len > 0 );
+  inflateEnd(&zs);
+  if ( ret != Z_STREAM_END ) damaged(unpack); /* truncated file */
+} /* gunzip */
+
+#ifdef HAVE_ZSTD
+/****************************************************************
+* unzstd: decompress a zstd file, concatenated frames included
+*****************************************************************/
+static void unzstd(struct unpacker *unpack, char *outbuf) {
+  ZSTD_DCtx *dctx;
+  ZSTD_inBuffer zin;
+  ZSTD_outBuffer zout;
+  char *block;
+  size_t len, ret = 0;
+
+  dctx = ZSTD_createDCtx();
+  zout.size = UNPACKBLOCK;
+  zout.pos = 0;
+  /* as in gunzip(), a full output block may leave output inside the decoder */
+  do {
+    len = readpacked(unpack, &block);
+    zin.src = block;
+    zin.size = len;
+    zin.pos = 0;
+    while ( zin.pos < zin.size || zout.pos == zout.size ) {
+      zout.dst = outbuf;
+      zout.size = UNPACKBLOCK;
+      zout.pos = 0;
+      ret = ZSTD_decompressStream(dctx, &zout, &zin);
+      if ( ZSTD_isError(ret) ) damaged(unpack);
+      if ( writeunpacked(unpack, outbuf, zout.pos) ) {
+        ZSTD_freeDCtx(dctx);
+        return;
+      }
+    }
+  } while ( len > 0 );
+  ZSTD_freeDCtx(dctx);
+  if ( ret != 0 ) damaged(unpack); /* truncated file */
+} /* unzstd */
+#endif
+
+static void *unpackthread(void *arg) {
+  struct unpacker *unpack = (struct unpacker*)arg;
+  sigset_t sigpipe;
+  char *outbuf;
+
+  /* if the reader stops early, write() fails instead of killing the program */
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+  outbuf = (char*)malloc(UNPACKBLOCK);
+  if ( unpack->format == PACKED_GZIP ) gunzip(unpack, outbuf);
+#ifdef HAVE_ZSTD
+  else unzstd(unpack, outbuf);
+#endif
+  free(outbuf);
+  close(unpack->out);
+  return NULL;
+} /* unpackthread */
+
+/****************************************************************
+* startunpack: called by opentrees(); if the file is compressed,
+*  start decompressing it and replace it by the pipe. Returns 0
+*  on success.
+*****************************************************************/
+int startunpack(struct treefile *infile) {
+  struct unpacker *unpack;
+  int format, fds[2];
+
+  infile->unpack = NULL;
+  if ( infile->stream != NULL ) { /* reading the first bytes, they stay in the buffer */
+    infile->bufsize = UNPACKBLOCK;
+    infile->data = (char*)malloc(infile->bufsize);
+    if ( infile->data == NULL ) return 1;
+    infile->size = fread(infile->data, 1, 4, infile->stream);
+  }
+  format = packedformat(infile->data, infile->size);
+  if ( format == PACKED_NONE ) return 0;
+#ifndef HAVE_ZSTD
+  if ( format == PACKED_ZSTD ) {
+    fprintf(stderr, "Can not read zstd-compressed \"%s\": compiled without zstd\n", infile->name);
+    return 1;
+  }
+#endif
+
+  unpack = (struct unpacker*)calloc(1, sizeof(struct unpacker));
+  unpack->name = infile->name;
+  unpack->format = format;
+  if ( infile->mapped ) {
+    unpack->in = infile->data;
+    unpack->insize = infile->size;
+  }
+  else {
+    unpack->stream = infile->stream;
+    memcpy(unpack->head, infile->data, infile->size);
+    unpack->headlen = infile->size;
+    unpack->inbuf = infile->data; /* the buffer is not needed for the pipe yet */
+  }
+  if ( pipe(fds) != 0 ) {
+    free(unpack);
+    return 1;
+  }
+#ifdef F_SETPIPE_SZ
+  fcntl(fds[1], F_SETPIPE_SZ, PIPESIZE);
+#endif
+  unpack->out = fds[1];
+  infile->stream = fdopen(fds[0], "r");
+  infile->data = NULL;
+  infile->size = 0;
+  infile->bufsize = 0;
+  infile->mapped = 0;
+  infile->unpack = unpack;
+  if ( pthread_create(&unpack->thread, NULL, unpackthread, unpack) != 0 ) {
+    fprintf(stderr, "Can not start decompressing \"%s\"\n", infile->name);
+    exit(1);
+  }
+  return 0;
+} /* startunpack */
+
+/****************************************************************
+* stopunpack: called by closetrees() after closing the pipe,
+*  wait for the decompressing thread and release the file
+*****************************************************************/
+void stopunpack(struct treefile *infile) {
+  struct unpacker *unpack = infile->unpack;
+
+  if ( unpack == NULL ) return;
+  pthread_join(unpack->thread, NULL);
+  if ( unpack->in != NULL ) munmap(unpack->in, unpack->insize);
+  if ( unpack->stream != NULL && unpack->stream != stdin ) fclose(unpack->stream);
+  free(unpack->inbuf);
+  free(unpack);
+  infile->unpack = NULL;
+} /* stopunpack */
@@ -0,0 +1,369 @@
+/*  vptree.c makes and searches a vantage-point tree of a collection of trees (.vpt) for Treedist package.
+    Author: Sergei Spirin, Belozersky Institute of Moscow State University, sas@belozersky.msu.ru
+
+    Copyright 2021 Sergei Spirin
+
+    This file is part of Treedist.
+
+    Treedist is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Treedist is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Treedist (a file named "COPYING.txt").
+    If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*  l1 and l2 between trees of the same leaves are metrics, and so is
+    the number of splits of either tree missing in the other; rf is
+    that number divided by the inner branches of both trees, which
+    is not a metric for unresolved trees, so the index keeps the
+    number for rf (see vpdistance()). For a metric d, a query q, a
+    vantage point v and a tree t
+        |d(q, v) - d(v, t)| <= d(q, t).
+    Every node of the vantage-point tree is a tree of the collection;
+    the other trees of its subtree are sorted by their distance to it,
+    the closer half going to the inner child and the rest to the outer
+    one, and the node keeps the smallest and the largest distance of
+    either child. A child is not searched if the interval of distances
+    [d(q, v) - r, d(q, v) + r] misses its distances. Nodes of at most
+    VPBUCKET trees keep them in a bucket with their distances to the
+    vantage point, and a tree of a bucket is skipped by the same rule.
+    The search is exact; distances are floats, so the bounds are
+    widened by VPSLACK against rounding. Found trees are ordered by
+    the printed distance; a tree within it, r, of the query is within
+    r * scale of the query by the distance of the index, and that is
+    the radius searched: for rf scale is the inner branches of the
+    query plus the most inner branches of a tree of the collection.
+
+    Layout of a .vpt file (numbers in the byte order of the machine
+    that wrote it, checked by the byteorder field):
+
+    file header     struct vpheader
+    nodes           nodesnum struct vpnode, the root first
+    buckets         membersnum struct vpmember
+*/
+
+#include "treedist.h"
+
+#define VPMAGIC "TREEVPT\n"
+#define VPVERSION 2
+#define VPBYTEORDER 0x01020304u
+#define VPBUCKET 8
+#define VPSLACK 1e-5
+
+struct vpheader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t treenum;
+  uint32_t leavesnum; /* of every tree */
+  uint32_t metric;
+  uint32_t nodesnum;
+  uint32_t membersnum;
+  uint32_t maxinner; /* the most inner branches of a tree */
+};
+
+/* Trees of a node being made and their distances to its vantage point */
+struct vpjob {
+  struct collection *coll;
+  unsigned metric;
+  unsigned point;
+  struct vpmember *members;
+};
+
+static int comparemembers(const void *x, const void *y) {
+  const struct vpmember *a = (const struct vpmember*)x, *b = (const struct vpmember*)y;
+
+  if ( a->distance != b->distance ) return a->distance < b->distance ? -1 : 1;
+  return a->tree < b->tree ? -1 : (a->tree > b->tree);
+} /* comparemembers */
+
+static void measureone(void *arg, unsigned k) {
+  struct vpjob *job = (struct vpjob*)arg;
+  struct comparison comp;
+
+  startpair(&comp, job->coll, job->point, job->members[k].tree);
+  job->members[k].distance = (float)vpdistance(&comp, job->metric);
+  finishcomparison(&comp);
+} /* measureone */
+
+/****************************************************************
+* vpdistance: the distance between two trees kept by the index,
+*  the number of splits not shared for rf, metricvalue() otherwise
+*****************************************************************/
+double vpdistance(struct comparison *c, unsigned metric) {
+  if ( metric == METRICRF ) return splitdistance(c);
+  return metricvalue(c, metric);
+} /* vpdistance */
+
+/****************************************************************
+* makenode: the node of the trees members[0 ... count - 1]
+*  (their distances are overwritten), returns its number
+*****************************************************************/
+static unsigned makenode(struct vptree *vp, struct collection *coll, struct vpmember *members, unsigned count,
+                         unsigned threads, uint64_t *random) {
+  struct vpjob job;
+  struct vpmember swap;
+  struct vpnode *node;
+  unsigned k, half, number, inner, outer;
+
+  /* a pseudo-random vantage point, the same in every run */
+  *random = *random * 6364136223846793005ull + 1442695040888963407ull;
+  k = (unsigned)((*random >> 33) % count);
+  swap = members[0];
+  members[0] = members[k];
+  members[k] = swap;
+  number = vp->nodesnum++;
+  node = vp->node + number;
+  node->tree = members[0].tree;
+  node->child[0] = node->child[1] = VPNONE;
+  node->first = node->count = 0;
+  node->low[0] = node->low[1] = node->high[0] = node->high[1] = 0.0f;
+  members++;
+  count--;
+  if ( count == 0 ) return number;
+
+  job.coll = coll;
+  job.metric = vp->metric;
+  job.point = node->tree;
+  job.members = members;
+  runparallel(count > 4 * threads ? threads : 1, count, measureone, &job);
+  qsort(members, count, sizeof(struct vpmember), comparemembers);
+  if ( count <= VPBUCKET ) {
+    node->first = vp->membersnum;
+    node->count = count;
+    memcpy(vp->member + vp->membersnum, members, sizeof(struct vpmember) * count);
+    vp->membersnum += count;
+    return number;
+  }
+  half = count / 2;
+  node->low[0] = members[0].distance;
+  node->high[0] = members[half - 1].distance;
+  node->low[1] = members[half].distance;
+  node->high[1] = members[count - 1].distance;
+  inner = makenode(vp, coll, members, half, threads, random);
+  outer = makenode(vp, coll, members + half, count - half, threads, random);
+  node->child[0] = inner;
+  node->child[1] = outer;
+  return number;
+} /* makenode */
+
+/****************************************************************
+* makevptree: the vantage-point tree of a collection of trees of
+*  the same leaves by a metric, distances computed on up to
+*  threads threads
+*****************************************************************/
+void makevptree(struct vptree *vp, struct collection *coll, unsigned metric, unsigned threads) {
+  struct vpmember *members;
+  uint64_t random = 20211;
+  unsigned k;
+
+  vp->treenum = coll->treenum;
+  vp->leavesnum = coll->treenum > 0 ? coll->trees[0].leavesnum : 0;
+  vp->metric = metric;
+  vp->maxinner = 0;
+  for ( k = 0; k < coll->treenum; k++ ) {
+    if ( coll->trees[k].branchnum - coll->trees[k].leavesnum > vp->maxinner ) {
+      vp->maxinner = coll->trees[k].branchnum - coll->trees[k].leavesnum;
+    }
+  }
+  vp->nodesnum = 0;
+  vp->membersnum = 0;
+  vp->node = (struct vpnode*)malloc(sizeof(struct vpnode) * (coll->treenum + 1));
+  vp->member = (struct vpmember*)malloc(sizeof(struct vpmember) * (coll->treenum + 1));
+  members = (struct vpmember*)malloc(sizeof(struct vpmember) * (coll->treenum + 1));
+  if ( vp->node == NULL || vp->member == NULL || members == NULL ) {
+    fprintf(stderr, "Not enough memory for the index of %u trees\n", coll->treenum);
+    exit(1);
+  }
+  for ( k = 0; k < coll->treenum; k++ ) members[k].tree = k;
+  if ( coll->treenum > 0 ) makenode(vp, coll, members, coll->treenum, threads, &random);
+  free(members);
+} /* makevptree */
+
+/****************************************************************
+* writevptree: write the index into a .vpt file, return 0 on success
+*****************************************************************/
+int writevptree(struct vptree *vp, char *filename) {
+  struct vpheader header;
+  FILE *out;
+  int result = 0;
+
+  out = fopen(filename, "wb");
+  if ( out == NULL ) return 1;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, VPMAGIC, 8);
+  header.version = VPVERSION;
+  header.byteorder = VPBYTEORDER;
+  header.treenum = vp->treenum;
+  header.leavesnum = vp->leavesnum;
+  header.metric = vp->metric;
+  header.maxinner = vp->maxinner;
+  header.nodesnum = vp->nodesnum;
+  header.membersnum = vp->membersnum;
+  if ( fwrite(&header, sizeof(header), 1, out) != 1
+       || fwrite(vp->node, sizeof(struct vpnode), vp->nodesnum, out) != vp->nodesnum
+       || fwrite(vp->member, sizeof(struct vpmember), vp->membersnum, out) != vp->membersnum ) result = 1;
+  if ( fclose(out) != 0 ) result = 1;
+  return result;
+} /* writevptree */
+
+/****************************************************************
+* readvptree: read a .vpt file, return 0 on success, 1 if the file
+*  can not be opened, 2 if it is not a .vpt file
+*****************************************************************/
+int readvptree(struct vptree *vp, char *filename) {
+  struct vpheader header;
+  FILE *in;
+  unsigned k;
+  int result = 0;
+
+  in = fopen(filename, "rb");
+  if ( in == NULL ) return 1;
+  if ( fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, VPMAGIC, 8) != 0
+       || header.version != VPVERSION || header.byteorder != VPBYTEORDER || header.metric >= METRICSNUM
+       || header.nodesnum > header.treenum || header.membersnum > header.treenum ) {
+    fclose(in);
+    return 2;
+  }
+  vp->treenum = header.treenum;
+  vp->leavesnum = header.leavesnum;
+  vp->metric = header.metric;
+  vp->maxinner = header.maxinner;
+  vp->nodesnum = header.nodesnum;
+  vp->membersnum = header.membersnum;
+  vp->node = (struct vpnode*)malloc(sizeof(struct vpnode) * (vp->nodesnum + 1));
+  vp->member = (struct vpmember*)malloc(sizeof(struct vpmember) * (vp->membersnum + 1));
+  if ( vp->node == NULL || vp->member == NULL ) {
+    fprintf(stderr, "Not enough memory for the index of %u trees\n", vp->treenum);
+    exit(1);
+  }
+  if ( fread(vp->node, sizeof(struct vpnode), vp->nodesnum, in) != vp->nodesnum
+       || fread(vp->member, sizeof(struct vpmember), vp->membersnum, in) != vp->membersnum ) result = 2;
+  fclose(in);
+  for ( k = 0; k < vp->nodesnum && result == 0; k++ ) { /* the search trusts the numbers */
+    if ( vp->node[k].tree >= vp->treenum
+         || (vp->node[k].child[0] != VPNONE && vp->node[k].child[0] >= vp->nodesnum)
+         || (vp->node[k].child[1] != VPNONE && vp->node[k].child[1] >= vp->nodesnum)
+         || (size_t)vp->node[k].first + vp->node[k].count > vp->membersnum ) result = 2;
+  }
+  for ( k = 0; k < vp->membersnum && result == 0; k++ ) {
+    if ( vp->member[k].tree >= vp->treenum ) result = 2;
+  }
+  if ( result ) freevptree(vp);
+  return result;
+} /* readvptree */
+
+void freevptree(struct vptree *vp) {
+  free(vp->node);
+  free(vp->member);
+  vp->node = NULL;
+  vp->member = NULL;
+} /* freevptree */
+
+/* State of a search: the found trees sorted by distance and tree */
+struct vpsearch {
+  struct vptree *vp;
+  double (*distance)(void *arg, unsigned tree, double *value);
+  void *arg;
+  unsigned nearest; /* k for k-NN, 0 for a range query */
+  double radius; /* of a range query, or the distance of the k-th tree found */
+  double scale; /* the radius by the distance of the index per unit of radius */
+  struct vpmember *found;
+  unsigned foundnum, foundalloc;
+  unsigned computed;
+};
+
+/* add a tree at a distance to the found ones */
+static void addfound(struct vpsearch *s, unsigned tree, double distance) {
+  struct vpmember item;
+  unsigned k;
+
+  item.tree = tree;
+  item.distance = (float)distance;
+  if ( s->nearest > 0 ) {
+    if ( s->foundnum == s->nearest ) { /* the k-th is replaced by a closer one */
+      if ( comparemembers(&item, s->found + s->foundnum - 1) >= 0 ) return;
+      s->foundnum--;
+    }
+    for ( k = s->foundnum; k > 0 && comparemembers(&item, s->found + k - 1) < 0; k-- ) s->found[k] = s->found[k - 1];
+    s->found[k] = item;
+    s->foundnum++;
+    if ( s->foundnum == s->nearest ) s->radius = s->found[s->foundnum - 1].distance;
+  }
+  else if ( distance <= s->radius ) {
+    if ( s->foundnum == s->foundalloc ) {
+      s->foundalloc *= 2;
+      s->found = (struct vpmember*)realloc(s->found, sizeof(struct vpmember) * s->foundalloc);
+    }
+    s->found[s->foundnum++] = item;
+  }
+} /* addfound */
+
+/* the distance of the index from the query to a tree, the found tree added */
+static double measure(struct vpsearch *s, unsigned tree) {
+  double d, value;
+
+  s->computed++;
+  d = s->distance(s->arg, tree, &value);
+  addfound(s, tree, value);
+  return d;
+} /* measure */
+
+static void searchnode(struct vpsearch *s, unsigned number) {
+  struct vpnode *node = s->vp->node + number;
+  struct vpmember *member;
+  double d;
+  unsigned k, side;
+
+  d = measure(s, node->tree);
+  for ( k = 0; k < node->count; k++ ) {
+    member = s->vp->member + node->first + k;
+    if ( fabs(d - member->distance) <= s->radius * s->scale + VPSLACK ) measure(s, member->tree);
+  }
+  side = d < node->low[1] ? 0 : 1; /* the child more likely to be close first */
+  for ( k = 0; k < 2; k++, side ^= 1 ) {
+    if ( node->child[side] == VPNONE ) continue;
+    if ( d - s->radius * s->scale - VPSLACK > node->high[side]
+         || d + s->radius * s->scale + VPSLACK < node->low[side] ) continue;
+    searchnode(s, node->child[side]);
+  }
+} /* searchnode */
+
+/****************************************************************
+* searchvptree: the nearest trees to a query, or all trees within
+*  radius if nearest is 0, sorted by distance and number; distance
+*  (arg, t, &value) is the distance of the index from the query to
+*  tree t, value the distance found trees are ordered by, and no
+*  tree is farther by the first than scale times the second.
+*  Returns a malloc() array, their number in *count and the number
+*  of distances computed in *computed.
+*****************************************************************/
+struct vpmember *searchvptree(struct vptree *vp, unsigned nearest, double radius, double scale,
+                              double (*distance)(void *arg, unsigned tree, double *value), void *arg,
+                              unsigned *count, unsigned *computed) {
+  struct vpsearch s;
+
+  s.vp = vp;
+  s.distance = distance;
+  s.arg = arg;
+  s.nearest = nearest;
+  s.radius = nearest > 0 ? HUGE_VAL : radius;
+  s.scale = scale;
+  s.foundalloc = nearest > 0 ? nearest + 1 : 64;
+  s.found = (struct vpmember*)malloc(sizeof(struct vpmember) * s.foundalloc);
+  s.foundnum = 0;
+  s.computed = 0;
+  if ( vp->nodesnum > 0 ) searchnode(&s, 0);
+  if ( nearest == 0 ) qsort(s.found, s.foundnum, sizeof(struct vpmember), comparemembers);
+  *count = s.foundnum;
+  *computed = s.computed;
+  return s.found;
+} /* searchvptree */